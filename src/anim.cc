@@ -0,0 +1,501 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Animations
+//----------------------------------------------------------------------------------------------------------------------
+//
+//      nim anim <options> <frames...>
+//
+// Converts a sequence of frames (files, directories, wildcards or @manifests, as for batch, in order) through one
+// palette and writes them as a .nan delta stream: the first frame in full and each later one as the spans of bytes
+// that changed since the frame before, so a player only rewrites what moved.  Animated GIFs and APNGs give all of
+// their frames.
+//
+// Frames are decoded and quantised on a pool of threads, several ahead of the one being diffed, while the main thread
+// diffs each against its predecessor in order and streams it to the file.  An animation's frames depend on the ones
+// before, so they are composited on the main thread as they are needed and only quantised on the pool.
+//
+// Without dithering, a pixel always maps to the same index, so only the pixels that differ from the previous frame's
+// are quantised once that frame is decoded.  The main thread copies the rest from the previous frame's indices.
+//
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <anim.h>
+#include <batch.h>
+#include <cmdline.h>
+#include <image.h>
+#include <jobs.h>
+#include <reader.h>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+// Size of a span's header.  Fewer unchanged bytes than this between changes are cheaper to rewrite than to skip.
+static const size_t kSpanHeaderBytes = 4;
+
+// Frames in flight per thread: converting, or converted and waiting to be diffed.
+static const int kFramesPerThread = 2;
+
+static const size_t kMaxSpanField = 65535;
+
+//----------------------------------------------------------------------------------------------------------------------
+// encodeDelta
+
+// Position of the first byte at or after i where a and b differ, comparing 8 bytes at a time.
+static func nextChange(const u8* a, const u8* b, size_t i, size_t size) -> size_t
+{
+    for (; i + 8 <= size; i += 8)
+    {
+        u64 x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y) break;
+    }
+    while (i < size && a[i] == b[i]) ++i;
+    return i;
+}
+
+static func writeSpanField(vector<u8>& out, size_t value) -> void
+{
+    out.push_back(u8(value));
+    out.push_back(u8(value >> 8));
+}
+
+func encodeDelta(const u8* prev, const u8* next, size_t size, vector<u8>& out) -> size_t
+{
+    size_t spanEnd = 0;
+    size_t covered = 0;
+    for (size_t i = prev ? nextChange(prev, next, 0, size) : 0; i < size; i = nextChange(prev, next, spanEnd, size))
+    {
+        // Extend the span over changes until the unchanged gap after them grows too long to be worth covering.
+        size_t start = i;
+        size_t end = prev ? i + 1 : size;
+        for (size_t j = end; j < size && j - end < kSpanHeaderBytes; ++j)
+        {
+            if (prev[j] != next[j]) end = j + 1;
+        }
+
+        size_t skip = start - spanEnd;
+        while (skip > kMaxSpanField)
+        {
+            writeSpanField(out, kMaxSpanField);
+            writeSpanField(out, 0);
+            skip -= kMaxSpanField;
+        }
+        for (size_t pos = start; pos < end; skip = 0)
+        {
+            size_t length = min(end - pos, kMaxSpanField);
+            writeSpanField(out, skip);
+            writeSpanField(out, length);
+            out.insert(out.end(), next + pos, next + pos + length);
+            pos += length;
+        }
+
+        covered += end - start;
+        spanEnd = end;
+        if (!prev) break;
+    }
+
+    return covered;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// convertChanged
+// Quantises the bytes of a w x h frame whose pixels differ from prev, the previous frame's, or every byte if there is
+// no previous frame.  Bytes are laid out as opts.layout says, and a 4-bit byte is changed if either of its pixels is.
+// Each byte written is marked in changed; the others are left for the previous frame's indices.
+
+static func convertChanged(const Quantiser& q, const u32* src, const u32* prev, int w, int h, const ImageOptions& opts,
+                           u8* dst, vector<u8>& changed) -> void
+{
+    int pixelsPerByte = opts.bit4 ? 2 : 1;
+    size_t rowBytes = size_t(w / pixelsPerByte);
+    bool columns = opts.layout == Layout::Column;
+    changed.assign(rowBytes * h, 0);
+    vector<u8> run(rowBytes);
+
+    for (int y = 0; y < h; ++y)
+    {
+        const u32* row = src + size_t(y) * w;
+        const u32* prevRow = prev ? prev + size_t(y) * w : nullptr;
+        auto differs = [&](size_t c) {
+            return !prevRow || memcmp(row + c * pixelsPerByte, prevRow + c * pixelsPerByte,
+                                      pixelsPerByte * sizeof(u32)) != 0;
+        };
+
+        for (size_t c = 0; c < rowBytes;)
+        {
+            if (!differs(c))
+            {
+                ++c;
+                continue;
+            }
+
+            size_t end = c + 1;
+            while (end < rowBytes && differs(end)) ++end;
+            q.convertRows(row + c * pixelsPerByte, int((end - c) * pixelsPerByte), 1, run.data(), opts.bit4);
+            for (size_t i = c; i < end; ++i)
+            {
+                size_t at = columns ? i * h + y : y * rowBytes + i;
+                dst[at] = run[i - c];
+                changed[at] = 1;
+            }
+            c = end;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// anim_handler
+
+func anim_handler(const CmdLine& cmdLine) -> int
+{
+    if (cmdLine.numParams() == 0)
+    {
+        cerr << "ERROR: Invalid parameters." << endl;
+        cerr << "Syntax: " << endl
+            << "    nim anim <options> <frames...>  - Generate a .nan delta stream from a sequence of frames." << endl
+            << endl
+            << "Frames are image files, directories, wildcard patterns or @<manifest> files, taken in order." << endl
+            << "Animated GIFs and PNGs give all of their frames." << endl
+            << endl
+            << "Options:" << endl
+            << "    --pal <filename.nip/.pal>   - Define palette to use in conversion." << endl
+            << "    --out <filename.nan>        - Output file (default: the first frame's name with .nan)." << endl
+            << "    -4                          - Output 4-bit graphics." << endl
+            << "    --bank <n>                  - With -4, convert with the palette's nth bank of 16 colours." << endl
+            << "    --dither <mode>             - none, bayer2, bayer4, bayer8, floyd, atkinson or sierra-lite." << endl
+            << "    --layout <row|column>       - Store pixels row by row (default) or column by column." << endl
+            << "    --jobs <n>                  - Convert using n threads (0 = one per core, default)." << endl
+            << "    -r                          - Include subdirectories of directory inputs." << endl;
+        return 1;
+    }
+
+    auto p = loadPalette(cmdLine.longFlag("pal"), cerr);
+    if (!p)
+    {
+        return 1;
+    }
+
+    // Frames are converted in parallel with each other, one thread each.
+    ImageOptions opts = imageOptions(cmdLine);
+    opts.jobs = 1;
+
+    if (opts.bit4 && opts.bank >= 0)
+    {
+        auto bank = paletteBank(*p, opts.bank);
+        if (!bank)
+        {
+            cerr << "ERROR: The palette has no bank " << opts.bank << "." << endl;
+            return 1;
+        }
+        p = move(bank);
+    }
+    if (opts.bit4 && p->numColours() > 16)
+    {
+        cerr << "ERROR: Invalid palette for 4-bit mode.  Must be 16 colours or less, or choose a bank with --bank."
+            << endl;
+        return 1;
+    }
+
+    vector<string> inputs;
+    for (i64 i = 0; i < cmdLine.numParams(); ++i)
+    {
+        inputs.push_back(cmdLine.param(i));
+    }
+
+    vector<fs::path> files;
+    if (!collectImages(inputs, cmdLine.flag('r'), files))
+    {
+        return 1;
+    }
+    if (files.empty())
+    {
+        cerr << "ERROR: No frames found." << endl;
+        return 1;
+    }
+
+    fs::path outPath = cmdLine.longFlag("out");
+    if (outPath.empty())
+    {
+        outPath = files[0];
+        outPath.replace_extension(".nan");
+    }
+
+    ofstream file(outPath, ios::binary | ios::trunc);
+    if (!file)
+    {
+        cerr << "ERROR: Unable to open " << outPath << endl;
+        return 1;
+    }
+
+    //
+    // Convert the frames ahead of the diff, into a ring of slots
+    //
+
+    // Every frame shares one palette and lookup cube.
+    PaletteSlot palette(move(*p));
+    palette.quantiser.buildCube();
+
+    // A frame's slot is only reused once the frame after it is diffed, so that frame can compare against its source.
+    struct FrameSlot
+    {
+        unique_ptr<ImageReader> reader;
+        string name;
+        vector<u8> pixels;
+        vector<u32> source;     // Decoded pixels, kept for the next frame to compare against when not dithering
+        vector<u8> changed;     // Bytes of pixels quantised, if the others come from the previous frame
+        int width = 0;
+        int height = 0;
+        bool decoded = false;   // Source is complete
+        bool converted = false;
+        string error;           // Why the frame failed to convert, if it did
+        bool ready = false;
+    };
+
+    ThreadPool pool(numJobs(cmdLine, 0));
+    int window = pool.numThreads() * kFramesPerThread;
+    vector<FrameSlot> slots(window);
+    mutex readyLock;
+    condition_variable readyChanged;
+
+    auto convert = [&](int frame) {
+        pool.submit([&, frame] {
+            FrameSlot& slot = slots[frame % window];
+            ImageReader& reader = *slot.reader;
+            slot.width = reader.width();
+            slot.height = reader.height();
+
+            string reason;
+            bool converted = false;
+            // A frame that throws (e.g. running out of memory) fails like an unreadable one, so the diff isn't left
+            // waiting for it.
+            try
+            {
+                if (opts.bit4 && slot.width % 2 == 1)
+                {
+                    reason = "width must be a multiple of 2 for 4-bit mode";
+                }
+                else if (opts.dither != Dither::None || reader.colourTable())
+                {
+                    // Dithered pixels depend on their neighbours, and indexed images are only remapped, which is
+                    // cheaper than comparing them.
+                    slot.pixels.resize(size_t(opts.bit4 ? slot.width / 2 : slot.width) * slot.height);
+                    slot.changed.clear();
+                    converted = convertPixels(palette.quantiser, reader, opts, slot.pixels.data(), nullptr);
+                    if (!converted)
+                    {
+                        reason = reader.error();
+                    }
+                }
+                else if (const u32* src = reader.readRows(slot.height))
+                {
+                    slot.pixels.resize(size_t(opts.bit4 ? slot.width / 2 : slot.width) * slot.height);
+                    slot.source.assign(src, src + size_t(slot.width) * slot.height);
+
+                    // Compare against the previous frame if it has been decoded by now.  Its slot isn't reused until
+                    // this frame is diffed.
+                    const u32* prev = nullptr;
+                    {
+                        lock_guard<mutex> guard(readyLock);
+                        slot.decoded = true;
+                        const FrameSlot& before = slots[(frame + window - 1) % window];
+                        if (frame > 0 && before.decoded && before.width == slot.width && before.height == slot.height)
+                        {
+                            prev = before.source.data();
+                        }
+                    }
+                    convertChanged(palette.quantiser, slot.source.data(), prev, slot.width, slot.height, opts,
+                                   slot.pixels.data(), slot.changed);
+                    converted = true;
+                }
+                else
+                {
+                    reason = reader.error();
+                }
+            }
+            catch (const exception& e)
+            {
+                converted = false;
+                reason = e.what();
+            }
+            slot.reader.reset();
+
+            lock_guard<mutex> guard(readyLock);
+            slot.converted = converted;
+            slot.error = reason;
+            slot.ready = true;
+            readyChanged.notify_all();
+        });
+    };
+
+    // Frames are taken from each file in turn, all of an animated GIF's or APNG's frames before the next file's.  Files
+    // are opened as they are reached, and animations decode and composite their frames here, in order, while the pool
+    // converts the frames before.
+    bool ok = true;
+    size_t nextFile = 0;
+    unique_ptr<FrameReader> source;
+    int sourceFrame = 0;
+    int numFrames = 0;
+
+    auto submitNext = [&]() -> bool {
+        while (ok)
+        {
+            if (!source)
+            {
+                if (nextFile == files.size()) return false;
+
+                string reason;
+                source = openFrames(files[nextFile], reason);
+                if (!source)
+                {
+                    cerr << "ERROR: Could not load image " << files[nextFile] << " (" << reason << ")." << endl;
+                    ok = false;
+                    break;
+                }
+                sourceFrame = 0;
+                ++nextFile;
+            }
+
+            auto reader = source->nextFrame();
+            if (!reader)
+            {
+                if (!source->error().empty())
+                {
+                    cerr << "ERROR: Could not load image " << files[nextFile - 1] << " (" << source->error() << ")."
+                        << endl;
+                    ok = false;
+                    break;
+                }
+                source.reset();
+                continue;
+            }
+
+            if (numFrames == 65535)
+            {
+                cerr << "ERROR: An animation can only have 65535 frames." << endl;
+                ok = false;
+                break;
+            }
+
+            FrameSlot& slot = slots[numFrames % window];
+            {
+                lock_guard<mutex> guard(readyLock);
+                slot.decoded = false;
+            }
+            slot.reader = move(reader);
+            slot.name = files[nextFile - 1].string();
+            if (source->numFrames() > 1) slot.name += " (frame " + to_string(sourceFrame) + ")";
+            ++sourceFrame;
+            convert(numFrames++);
+            return true;
+        }
+
+        return false;
+    };
+
+    for (int i = 0; i < window; ++i)
+    {
+        if (!submitNext()) break;
+    }
+
+    //
+    // Diff each frame against the one before as it arrives, and stream it out
+    //
+
+    vector<u8> prev;
+    vector<u8> data;
+    size_t frameBytes = 0;
+    size_t deltaBytes = 0;
+    int width = 0;
+    int height = 0;
+
+    for (int frame = 0; ok && frame < numFrames; ++frame)
+    {
+        FrameSlot& slot = slots[frame % window];
+        {
+            unique_lock<mutex> guard(readyLock);
+            readyChanged.wait(guard, [&] { return slot.ready; });
+            slot.ready = false;
+        }
+
+        if (!slot.converted)
+        {
+            cerr << "ERROR: Could not load image " << slot.name << " (" << slot.error << ")." << endl;
+            ok = false;
+            break;
+        }
+
+        // The number of frames isn't known until the end, and is filled in then.
+        data.clear();
+        if (frame == 0)
+        {
+            width = slot.width;
+            height = slot.height;
+            u8 flags = (opts.bit4 ? 1 : 0) | (opts.layout == Layout::Column ? 2 : 0);
+            data = { 'N', 'A', 'N', '0', u8(width), u8(width >> 8), u8(height), u8(height >> 8), 0, 0, flags };
+        }
+        else if (slot.width != width || slot.height != height)
+        {
+            cerr << "ERROR: Frame " << slot.name << " is " << slot.width << "x" << slot.height
+                << " but the first frame is " << width << "x" << height << "." << endl;
+            ok = false;
+            break;
+        }
+
+        // Bytes whose pixels are unchanged were left for the previous frame's indices.
+        if (frame > 0 && !slot.changed.empty())
+        {
+            for (size_t i = 0; i < slot.pixels.size(); ++i)
+            {
+                if (!slot.changed[i]) slot.pixels[i] = prev[i];
+            }
+        }
+
+        // Each frame is its size in bytes followed by its spans.
+        size_t sizeAt = data.size();
+        data.resize(sizeAt + 4);
+        encodeDelta(frame ? prev.data() : nullptr, slot.pixels.data(), slot.pixels.size(), data);
+        u32 size = u32(data.size() - sizeAt - 4);
+        for (int i = 0; i < 4; ++i) data[sizeAt + i] = u8(size >> (i * 8));
+
+        if (!file.write((const char*)data.data(), data.size()))
+        {
+            cerr << "ERROR: Unable to write " << outPath << endl;
+            ok = false;
+            break;
+        }
+        frameBytes += slot.pixels.size();
+        deltaBytes += size;
+
+        // This frame's indices become the ones to diff against, and the previous frame's slot is reused for a later
+        // frame, now that this one no longer needs its source.
+        swap(prev, slot.pixels);
+        if (frame > 0) submitNext();
+    }
+
+    pool.wait();
+
+    const u8 count[2] = { u8(numFrames), u8(numFrames >> 8) };
+    if (ok && !file.seekp(8).write((const char*)count, 2))
+    {
+        cerr << "ERROR: Unable to write " << outPath << endl;
+        ok = false;
+    }
+    if (!ok)
+    {
+        file.close();
+        error_code ec;
+        fs::remove(outPath, ec);
+        return 1;
+    }
+
+    cout << "Wrote " << numFrames << (numFrames == 1 ? " frame" : " frames") << " to " << outPath.string() << ": "
+        << deltaBytes << " bytes of spans for " << frameBytes << " bytes of frames ("
+        << (frameBytes ? deltaBytes * 100 / frameBytes : 0) << "%)." << endl;
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,28 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Animations
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+
+class CmdLine;
+
+//----------------------------------------------------------------------------------------------------------------------
+// encodeDelta
+// Appends the spans of next that differ from prev to out, each as a 2-byte count of unchanged bytes since the end of
+// the previous span, a 2-byte length and the span's bytes.  Runs of changes separated by only a few unchanged bytes
+// share a span, since a new span header would cost more than the bytes it skips.  Skips and lengths too large for 16
+// bits are split across extra spans.  Without prev, the whole of next is one change.  Returns the number of bytes
+// covered by spans.
+
+func encodeDelta(const u8* prev, const u8* next, size_t size, vector<u8>& out) -> size_t;
+
+//----------------------------------------------------------------------------------------------------------------------
+// anim_handler
+// 'nim anim <options> <frames...>'
+
+func anim_handler(const CmdLine& cmdLine) -> int;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
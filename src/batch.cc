@@ -0,0 +1,418 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Batch conversion
+//----------------------------------------------------------------------------------------------------------------------
+//
+//      nim batch <options> <inputs...>
+//
+// Each input is an image file, a directory (every image in it), a wildcard pattern such as "sprites/*.png", or
+// @<manifest>.  A manifest lists one image per line, optionally followed by the palette to convert it with.  Blank
+// lines and lines starting with '#' are ignored, and relative paths are relative to the manifest.
+//
+// Every distinct palette is loaded once and shared by all images that use it.  Files are converted concurrently and
+// a failure only affects the file concerned.
+//
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <batch.h>
+#include <cmdline.h>
+#include <image.h>
+#include <jobs.h>
+#include <manifest.h>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+
+//----------------------------------------------------------------------------------------------------------------------
+// Batch items
+
+struct BatchItem
+{
+    fs::path input;
+    string palette;
+    fs::path output = {};       // Filled in by batch_handler once the output directory is known
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// isImageFile
+// Returns true if the file has an extension stb_image can load.
+
+static func isImageFile(const fs::path& path) -> bool
+{
+    static const set<string> kExtensions = {
+        ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif", ".psd", ".hdr", ".pic", ".pnm", ".ppm", ".pgm"
+    };
+
+    string ext = path.extension().string();
+    for (auto& c : ext) c = char(tolower(c));
+    return kExtensions.find(ext) != kExtensions.end();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// matchWildcard
+// Matches a file name against a pattern containing '*' (any run of characters) and '?' (any single character).
+
+static func matchWildcard(const char* pattern, const char* name) -> bool
+{
+    const char* starPattern = nullptr;
+    const char* starName = nullptr;
+
+    while (*name)
+    {
+        if (*pattern == '*')
+        {
+            starPattern = ++pattern;
+            starName = name;
+        }
+        else if (*pattern == '?' || *pattern == *name)
+        {
+            ++pattern;
+            ++name;
+        }
+        else if (starPattern)
+        {
+            pattern = starPattern;
+            name = ++starName;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (*pattern == '*') ++pattern;
+    return *pattern == 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// addDirectory
+
+static func addDirectory(const fs::path& dir, bool recurse, const string& palette, vector<BatchItem>& items) -> void
+{
+    vector<fs::path> files;
+    if (recurse)
+    {
+        for (const auto& entry : fs::recursive_directory_iterator(dir))
+        {
+            if (entry.is_regular_file() && isImageFile(entry.path())) files.push_back(entry.path());
+        }
+    }
+    else
+    {
+        for (const auto& entry : fs::directory_iterator(dir))
+        {
+            if (entry.is_regular_file() && isImageFile(entry.path())) files.push_back(entry.path());
+        }
+    }
+
+    // Directory iteration order is unspecified; sort so runs are repeatable.
+    sort(files.begin(), files.end());
+    for (auto& file : files)
+    {
+        items.push_back({ move(file), palette });
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// addInput
+// Expands a single input argument into batch items.  Returns false if the input could not be found.
+
+static func addInput(const string& input, bool recurse, const string& palette, vector<BatchItem>& items) -> bool
+{
+    fs::path path = input;
+    error_code ec;
+
+    if (input.find_first_of("*?") != string::npos)
+    {
+        fs::path dir = path.parent_path();
+        string pattern = path.filename().string();
+        if (dir.empty()) dir = ".";
+
+        vector<fs::path> files;
+        for (const auto& entry : fs::directory_iterator(dir, ec))
+        {
+            if (entry.is_regular_file() && matchWildcard(pattern.c_str(), entry.path().filename().string().c_str()))
+            {
+                files.push_back(entry.path());
+            }
+        }
+        if (ec) return false;
+
+        sort(files.begin(), files.end());
+        for (auto& file : files)
+        {
+            items.push_back({ move(file), palette });
+        }
+        return true;
+    }
+
+    if (fs::is_directory(path, ec))
+    {
+        addDirectory(path, recurse, palette, items);
+        return true;
+    }
+
+    if (fs::is_regular_file(path, ec))
+    {
+        items.push_back({ path, palette });
+        return true;
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// addManifest
+// Reads a manifest of '<image> [<palette>]' lines.  Names containing spaces can be quoted.
+
+static func addManifest(const fs::path& manifest, bool recurse, const string& palette, vector<BatchItem>& items)
+    -> bool
+{
+    ifstream f(manifest);
+    if (!f.is_open())
+    {
+        cerr << "ERROR: Unable to open manifest " << manifest << "." << endl;
+        return false;
+    }
+
+    fs::path base = manifest.parent_path();
+    bool ok = true;
+    string line;
+    int lineNum = 0;
+
+    while (getline(f, line))
+    {
+        ++lineNum;
+
+        istringstream ss(line);
+        string input, pal;
+        if (!(ss >> quoted(input)) || input[0] == '#') continue;
+        ss >> quoted(pal);
+
+        string itemPal = pal.empty() ? palette : (base / pal).string();
+        if (!addInput((base / input).string(), recurse, itemPal, items))
+        {
+            cerr << "ERROR: " << manifest.string() << "(" << lineNum << "): Cannot find '" << input << "'." << endl;
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// gatherItems
+// Expands every input into batch items, dropping repeated files.  Returns the number of inputs that failed.
+
+static func gatherItems(const vector<string>& inputs, bool recurse, const string& defaultPal, vector<BatchItem>& items)
+    -> int
+{
+    int numErrors = 0;
+    for (const auto& input : inputs)
+    {
+        bool ok = input[0] == '@'
+            ? addManifest(input.substr(1), recurse, defaultPal, items)
+            : addInput(input, recurse, defaultPal, items);
+        if (!ok)
+        {
+            if (input[0] != '@') cerr << "ERROR: Cannot find '" << input << "'." << endl;
+            ++numErrors;
+        }
+    }
+
+    // Drop repeated files, keeping the first occurrence.
+    set<string> seen;
+    items.erase(remove_if(items.begin(), items.end(), [&](const BatchItem& item) {
+        return !seen.insert(fs::absolute(item.input).lexically_normal().string()).second;
+    }), items.end());
+
+    return numErrors;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// collectImages
+
+func collectImages(const vector<string>& inputs, bool recurse, vector<fs::path>& files) -> bool
+{
+    vector<BatchItem> items;
+    int numErrors = gatherItems(inputs, recurse, string(), items);
+    for (auto& item : items)
+    {
+        files.push_back(move(item.input));
+    }
+    return numErrors == 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// batch_handler
+
+func batch_handler(const CmdLine& cmdLine) -> int
+{
+    if (cmdLine.numParams() == 0)
+    {
+        cerr << "ERROR: Invalid parameters." << endl;
+        cerr << "Syntax: " << endl
+            << "    nim batch <options> <inputs...>  - Generate .nim files for many images." << endl
+            << endl
+            << "Inputs are image files, directories, wildcard patterns or @<manifest> files." << endl
+            << endl
+            << "Options:" << endl
+            << "    --pal <filename.nip/.pal>   - Define palette to use in conversion." << endl
+            << "    --out <directory>           - Write .nim files to this directory." << endl
+            << "    --jobs <n>                  - Convert using n threads (0 = one per core, default)." << endl
+            << "    -r                          - Include subdirectories of directory inputs." << endl
+            << "    -i                          - Incremental: skip images whose inputs are unchanged." << endl
+            << "    -4                          - Output 4-bit graphics." << endl;
+        return 1;
+    }
+
+    //
+    // Gather the inputs
+    //
+
+    vector<string> inputs;
+    for (i64 i = 0; i < cmdLine.numParams(); ++i)
+    {
+        inputs.push_back(cmdLine.param(i));
+    }
+
+    vector<BatchItem> items;
+    int numErrors = gatherItems(inputs, cmdLine.flag('r'), cmdLine.longFlag("pal"), items);
+
+    //
+    // Load each distinct palette once
+    //
+
+    map<string, unique_ptr<PaletteSlot>> palettes;
+    for (const auto& item : items)
+    {
+        if (palettes.find(item.palette) != palettes.end()) continue;
+
+        auto p = loadPalette(item.palette, cerr);
+        palettes[item.palette] = p ? make_unique<PaletteSlot>(move(*p)) : nullptr;
+    }
+
+    fs::path outDir = cmdLine.longFlag("out");
+    if (!outDir.empty())
+    {
+        error_code ec;
+        fs::create_directories(outDir, ec);
+        if (ec)
+        {
+            cerr << "ERROR: Unable to create directory " << outDir << "." << endl;
+            return 1;
+        }
+    }
+
+    //
+    // Work out the outputs.  Two inputs with the same name but a different directory or extension would write the same
+    // file, so only the first of them is converted.
+    //
+
+    set<string> outputs;
+    items.erase(remove_if(items.begin(), items.end(), [&](BatchItem& item) {
+        item.output = item.input;
+        item.output.replace_extension(".nim");
+        if (!outDir.empty()) item.output = outDir / item.output.filename();
+
+        if (outputs.insert(fs::absolute(item.output).lexically_normal().string()).second) return false;
+        cerr << "ERROR: " << item.input.string() << " would overwrite " << item.output << "." << endl;
+        ++numErrors;
+        return true;
+    }), items.end());
+
+    //
+    // Convert
+    //
+
+    ImageOptions opts = imageOptions(cmdLine);
+    opts.jobs = 1;
+
+    ThreadPool pool(numJobs(cmdLine, 0));
+    mutex errLock;
+    atomic<int> numConverted(0);
+    atomic<int> numFailed(0);
+    atomic<int> numSkipped(0);
+    ConvertStats stats;
+    Manifest manifest;
+    string optionsKey = opts.key();
+
+    for (const auto& item : items)
+    {
+        PaletteSlot* slot = palettes[item.palette].get();
+        if (!slot)
+        {
+            ++numFailed;
+            continue;
+        }
+
+        pool.submit([&, slot] {
+            const fs::path& outPath = item.output;
+
+            BuildKey key(item.input, item.palette, optionsKey);
+            if (opts.incremental && manifest.upToDate(outPath, key))
+            {
+                ++numSkipped;
+                return;
+            }
+
+            ConvertStats itemStats;
+            ConvertStats* st = opts.stats ? &itemStats : nullptr;
+
+            // Lookup cubes pay for themselves over a batch.  The first conversion using a palette builds it.
+            {
+                StageTimer timer(st, Stage::Cube);
+                slot->quantiser.buildCube();
+            }
+
+            ostringstream err;
+            if (convertImage(slot->quantiser, item.input, outPath, opts, err, st) == 0)
+            {
+                ++numConverted;
+                if (opts.incremental) manifest.record(outPath, key);
+                if (st)
+                {
+                    lock_guard<mutex> guard(errLock);
+                    stats.merge(itemStats);
+                }
+            }
+            else
+            {
+                ++numFailed;
+                lock_guard<mutex> guard(errLock);
+                cerr << item.input.string() << ": " << err.str();
+            }
+        });
+    }
+
+    pool.wait();
+    if (pool.numFailed())
+    {
+        cerr << "ERROR: " << pool.numFailed() << (pool.numFailed() == 1 ? " file" : " files")
+            << " failed with an unexpected error." << endl;
+        numFailed += pool.numFailed();
+    }
+    if (opts.incremental && !manifest.save(cerr))
+    {
+        ++numErrors;
+    }
+
+    cout << "Converted " << numConverted << " of " << items.size() << " files";
+    if (numSkipped) cout << ", " << numSkipped << " up to date";
+    if (numFailed) cout << " (" << numFailed << " failed)";
+    cout << "." << endl;
+
+    if (opts.stats)
+    {
+        printStats(cout, stats, opts.statsJson);
+    }
+
+    return (numErrors || numFailed) ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,22 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Batch conversion
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+
+class CmdLine;
+
+func batch_handler(const CmdLine& cmdLine) -> int;
+
+//----------------------------------------------------------------------------------------------------------------------
+// collectImages
+// Expands inputs as batch does (image files, directories, wildcard patterns and @manifests, whose palettes are
+// ignored) into a list of distinct files.  Inputs that can't be found are reported to cerr.  Returns false if there
+// were any.
+
+func collectImages(const vector<string>& inputs, bool recurse, vector<fs::path>& files) -> bool;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
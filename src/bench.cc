@@ -0,0 +1,520 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Conversion benchmarks
+//----------------------------------------------------------------------------------------------------------------------
+//
+//      nim bench <options> [<filter>]
+//
+// Generates deterministic synthetic images at common Next screen and sprite sheet sizes and times each stage of the
+// conversion pipeline separately.  The indexed sprite sheet is saved as a palette PNG, so its total is the remapping
+// path rather than the search:
+//
+//      decode      Load the image from a PNG file into RGBA pixels.
+//      quantise    Map RGBA pixels to 8-bit palette indices.
+//      pack        Map RGBA pixels to 4-bit indices packed two to a byte (16 colour palette).
+//      write       Write the .nim header and pixel data to a file.
+//      total       The whole of 'nim image': decode, quantise and write, with a new quantiser each run so that
+//                  building the lookup cube is included when 'nim image' would build it.
+//
+// Each stage is run a number of times and its throughput reported in Mpixels/s for the best, median and 99th
+// percentile run.  Only images whose name contains the filter are run.  The decoded pixels are checked against the
+// generated ones, so a broken decoder fails the benchmark rather than speeding it up.
+//
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <bench.h>
+#include <cmdline.h>
+#include <image.h>
+#include <jobs.h>
+#include <mapping.h>
+#include <reader.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+//----------------------------------------------------------------------------------------------------------------------
+// Synthetic images
+
+struct BenchImage
+{
+    string name;
+    int width;
+    int height;
+    vector<u32> pixels;
+    bool indexed;               // Save as a palette PNG
+};
+
+static func rgba(u32 r, u32 g, u32 b, u32 a) -> u32
+{
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+// xorshift32, so the images are identical on every run and every machine.
+struct Random
+{
+    u32 m_state = 0x12345678;
+
+    func next() -> u32
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+};
+
+static func clampByte(double v) -> u32
+{
+    return u32(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+static func gradientImage(int w, int h) -> vector<u32>
+{
+    vector<u32> pixels(size_t(w) * h);
+    for (int y = 0; y < h; ++y)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            pixels[size_t(y) * w + x] = rgba(x * 255 / (w - 1), y * 255 / (h - 1), (x + y) * 255 / (w + h - 2), 255);
+        }
+    }
+    return pixels;
+}
+
+static func noiseImage(int w, int h) -> vector<u32>
+{
+    Random rnd;
+    vector<u32> pixels(size_t(w) * h);
+    for (auto& p : pixels)
+    {
+        p = rnd.next() | 0xff000000;
+    }
+    return pixels;
+}
+
+// Smooth shading with a little grain, like a downscaled photograph.
+static func photoImage(int w, int h) -> vector<u32>
+{
+    Random rnd;
+    vector<u32> pixels(size_t(w) * h);
+    for (int y = 0; y < h; ++y)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            double grain = double(rnd.next() % 17) - 8;
+            double r = 128 + 90 * sin(x * 0.031 + y * 0.017) + grain;
+            double g = 110 + 80 * sin(x * 0.013 - y * 0.041 + 1.0) + grain;
+            double b = 100 + 70 * cos((x + y) * 0.022) + grain;
+            pixels[size_t(y) * w + x] = rgba(clampByte(r), clampByte(g), clampByte(b), 255);
+        }
+    }
+    return pixels;
+}
+
+// A sheet of 16x16 sprites: discs and boxes in flat hardware colours with an outline, on a transparent background.
+// Fill colours are chosen from the hardware colours that fit colourMask.
+static func spriteImage(int w, int h, u32 colourMask) -> vector<u32>
+{
+    Random rnd;
+    vector<u32> pixels(size_t(w) * h, 0);
+    for (int sy = 0; sy < h; sy += 16)
+    {
+        for (int sx = 0; sx < w; sx += 16)
+        {
+            u32 c = rnd.next() & colourMask;
+            int r = c & 7, g = (c >> 3) & 7, b = (c >> 6) & 7;
+            u32 fill = rgba(kColour_3bit[r], kColour_3bit[g], kColour_3bit[b], 255);
+            u32 outline = rgba(kColour_3bit[r / 2], kColour_3bit[g / 2], kColour_3bit[b / 2], 255);
+            bool disc = rnd.next() & 1;
+            for (int y = 0; y < 16; ++y)
+            {
+                for (int x = 0; x < 16; ++x)
+                {
+                    int dx = 2 * x - 15;
+                    int dy = 2 * y - 15;
+                    int d = disc ? dx * dx + dy * dy : max(dx * dx, dy * dy);
+                    pixels[size_t(sy + y) * w + sx + x] = d < 144 ? fill : d < 196 ? outline : 0;
+                }
+            }
+        }
+    }
+    return pixels;
+}
+
+static func benchImages() -> vector<BenchImage>
+{
+    struct Size { int w; int h; };
+    static const Size kScreens[] = { { 256, 192 }, { 320, 256 }, { 640, 256 } };
+
+    vector<BenchImage> images;
+    auto add = [&](const char* kind, int w, int h, vector<u32> pixels, bool indexed = false) {
+        images.push_back({ string(kind) + " " + to_string(w) + "x" + to_string(h), w, h, move(pixels), indexed });
+    };
+
+    for (const auto& s : kScreens) add("gradient", s.w, s.h, gradientImage(s.w, s.h));
+    for (const auto& s : kScreens) add("noise", s.w, s.h, noiseImage(s.w, s.h));
+    for (const auto& s : kScreens) add("photo", s.w, s.h, photoImage(s.w, s.h));
+    add("sprites", 256, 256, spriteImage(256, 256, 0x1ff));
+    add("indexed", 256, 256, spriteImage(256, 256, 0x3f), true);
+    return images;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// PNG encoding
+// Just enough of a PNG encoder to feed the decoder: Sub filtered rows, compressed with fixed Huffman codes and
+// matches against the previous pixel (or 4 indices back), split into 8K IDAT chunks like most encoders.  Indexed
+// images use one byte per pixel, with their colours in order of first use.
+
+class BitWriter
+{
+public:
+    BitWriter(vector<u8>& out) : m_out(out), m_bits(0), m_numBits(0) {}
+
+    func put(u32 bits, int count) -> void
+    {
+        m_bits |= bits << m_numBits;
+        m_numBits += count;
+        while (m_numBits >= 8)
+        {
+            m_out.push_back(u8(m_bits));
+            m_bits >>= 8;
+            m_numBits -= 8;
+        }
+    }
+
+    // Huffman codes are stored most significant bit first.
+    func putCode(u32 code, int count) -> void
+    {
+        u32 reversed = 0;
+        for (int i = 0; i < count; ++i) reversed |= ((code >> i) & 1) << (count - 1 - i);
+        put(reversed, count);
+    }
+
+    func flush() -> void
+    {
+        if (m_numBits > 0) put(0, 8 - m_numBits);
+    }
+
+private:
+    vector<u8>& m_out;
+    u32 m_bits;
+    int m_numBits;
+};
+
+static func putSymbol(BitWriter& bits, int symbol) -> void
+{
+    if (symbol < 144)       bits.putCode(0x30 + symbol, 8);
+    else if (symbol < 256)  bits.putCode(0x190 + symbol - 144, 9);
+    else if (symbol < 280)  bits.putCode(symbol - 256, 7);
+    else                    bits.putCode(0xc0 + symbol - 280, 8);
+}
+
+static func deflate(const vector<u8>& data) -> vector<u8>
+{
+    static const int kLengthBase[] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const int kLengthExtra[] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+
+    vector<u8> out = { 0x78, 0x01 };
+    BitWriter bits(out);
+    bits.put(1, 1);             // Final block
+    bits.put(1, 2);             // Fixed Huffman codes
+
+    size_t i = 0;
+    while (i < data.size())
+    {
+        size_t len = 0;
+        while (i >= 4 && len < 258 && i + len < data.size() && data[i + len] == data[i + len - 4]) ++len;
+
+        if (len < 3)
+        {
+            putSymbol(bits, data[i++]);
+            continue;
+        }
+
+        int code = 28;
+        while (kLengthBase[code] > int(len)) --code;
+        putSymbol(bits, 257 + code);
+        bits.put(u32(len - kLengthBase[code]), kLengthExtra[code]);
+        bits.putCode(3, 5);     // Distance 4
+        i += len;
+    }
+
+    putSymbol(bits, 256);
+    bits.flush();
+
+    u32 a = 1, b = 0;
+    for (u8 v : data)
+    {
+        a = (a + v) % 65521;
+        b = (b + a) % 65521;
+    }
+    u32 adler = (b << 16) | a;
+    for (int s = 24; s >= 0; s -= 8) out.push_back(u8(adler >> s));
+    return out;
+}
+
+static func crc32(const u8* data, size_t size) -> u32
+{
+    static const auto kTable = [] {
+        array<u32, 256> table;
+        for (u32 n = 0; n < 256; ++n)
+        {
+            u32 c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    u32 c = 0xffffffff;
+    for (size_t i = 0; i < size; ++i) c = kTable[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffff;
+}
+
+static func putChunk(vector<u8>& png, const char* type, const u8* data, size_t size) -> void
+{
+    for (int s = 24; s >= 0; s -= 8) png.push_back(u8(size >> s));
+    size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data, data + size);
+    u32 crc = crc32(png.data() + start, png.size() - start);
+    for (int s = 24; s >= 0; s -= 8) png.push_back(u8(crc >> s));
+}
+
+static func encodePng(const BenchImage& image) -> vector<u8>
+{
+    int w = image.width;
+    int h = image.height;
+
+    int bytesPerPixel = image.indexed ? 1 : 4;
+    vector<u32> colours;
+    vector<u8> raw;
+    raw.reserve(size_t(w * bytesPerPixel + 1) * h);
+    for (int y = 0; y < h; ++y)
+    {
+        const u32* pixels = image.pixels.data() + size_t(y) * w;
+        vector<u8> row;
+        if (image.indexed)
+        {
+            for (int x = 0; x < w; ++x)
+            {
+                auto it = find(colours.begin(), colours.end(), pixels[x]);
+                row.push_back(u8(it - colours.begin()));
+                if (it == colours.end()) colours.push_back(pixels[x]);
+            }
+        }
+        else
+        {
+            row.assign((const u8 *)pixels, (const u8 *)(pixels + w));
+        }
+
+        raw.push_back(1);
+        for (size_t i = 0; i < row.size(); ++i)
+        {
+            raw.push_back(u8(row[i] - (i >= size_t(bytesPerPixel) ? row[i - bytesPerPixel] : 0)));
+        }
+    }
+    vector<u8> z = deflate(raw);
+
+    static const u8 kSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    u8 ihdr[13] = { u8(w >> 24), u8(w >> 16), u8(w >> 8), u8(w), u8(h >> 24), u8(h >> 16), u8(h >> 8), u8(h),
+                    8, u8(image.indexed ? 3 : 6), 0, 0, 0 };
+
+    vector<u8> png(kSignature, kSignature + 8);
+    putChunk(png, "IHDR", ihdr, sizeof(ihdr));
+    if (image.indexed)
+    {
+        vector<u8> plte;
+        vector<u8> trns;
+        for (u32 c : colours)
+        {
+            plte.insert(plte.end(), { u8(c), u8(c >> 8), u8(c >> 16) });
+            trns.push_back(u8(c >> 24));
+        }
+        putChunk(png, "PLTE", plte.data(), plte.size());
+        putChunk(png, "tRNS", trns.data(), trns.size());
+    }
+    for (size_t i = 0; i < z.size(); i += 8192)
+    {
+        putChunk(png, "IDAT", z.data() + i, min(z.size() - i, size_t(8192)));
+    }
+    putChunk(png, "IEND", nullptr, 0);
+    return png;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Timing
+
+using Clock = chrono::steady_clock;
+
+// Runs fn once to warm up, then times it reps times.  Returns the sorted times in seconds.
+static func timeRuns(int reps, const function<void()>& fn) -> vector<double>
+{
+    fn();
+
+    vector<double> times;
+    times.reserve(reps);
+    for (int i = 0; i < reps; ++i)
+    {
+        auto start = Clock::now();
+        fn();
+        times.push_back(chrono::duration<double>(Clock::now() - start).count());
+    }
+
+    sort(times.begin(), times.end());
+    return times;
+}
+
+static func report(const BenchImage& image, const char* stage, const vector<double>& times) -> void
+{
+    // Nearest rank percentiles.
+    auto percentile = [&](double p) {
+        size_t rank = size_t(ceil(p * times.size()));
+        return times[max(rank, size_t(1)) - 1];
+    };
+    double mpixels = double(image.width) * image.height / 1e6;
+
+    cout << left << setw(20) << image.name << setw(10) << stage << right << fixed << setprecision(2)
+        << setw(10) << mpixels / times.front()
+        << setw(10) << mpixels / percentile(0.5)
+        << setw(10) << mpixels / percentile(0.99) << endl;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Bench command handler
+
+func bench_handler(const CmdLine& cmdLine) -> int
+{
+    if (cmdLine.numParams() > 1)
+    {
+        cerr << "ERROR: Invalid parameters." << endl;
+        cerr << "Syntax: " << endl
+            << "    nim bench <options> [<filter>]  - Benchmark the conversion stages." << endl
+            << endl
+            << "Options:" << endl
+            << "    --reps <n>                  - Time each stage n times (default 20)." << endl
+            << "    --jobs <n>                  - Convert using n threads (0 = one per core)." << endl
+            << "    --pal <filename.nip/.pal>   - Define palette to use in conversion." << endl;
+        return 1;
+    }
+
+    string filter = cmdLine.numParams() ? cmdLine.param(0) : string();
+    auto repsStr = cmdLine.longFlag("reps");
+    int reps = max(1, repsStr.empty() ? 20 : stoi(repsStr));
+
+    auto palette = loadPalette(cmdLine.longFlag("pal"), cerr);
+    if (!palette)
+    {
+        return 1;
+    }
+
+    vector<Colour> colours16;
+    for (int i = 0; i < 16; ++i)
+    {
+        colours16.push_back((*palette)[i * palette->numColours() / 16]);
+    }
+    Palette palette16(move(colours16), 0xff);
+
+    ImageOptions opts = imageOptions(cmdLine);
+    opts.bit4 = false;
+    opts.incremental = false;
+
+    fs::path dir = fs::temp_directory_path() / "nim-bench";
+    error_code ec;
+    fs::create_directories(dir, ec);
+
+    cout << "Benchmarking with " << reps << " repetitions and " << opts.jobs << (opts.jobs == 1 ? " thread." : " threads.")
+        << endl << endl
+        << left << setw(30) << "" << right << setw(30) << "------ Mpixels/s ------" << endl
+        << left << setw(20) << "image" << setw(10) << "stage" << right
+        << setw(10) << "best" << setw(10) << "median" << setw(10) << "p99" << endl;
+
+    int result = 0;
+    for (const auto& image : benchImages())
+    {
+        if (image.name.find(filter) == string::npos) continue;
+
+        int w = image.width;
+        int h = image.height;
+        string fileName = image.name;
+        replace(fileName.begin(), fileName.end(), ' ', '_');
+        fs::path pngPath = dir / (fileName + ".png");
+        fs::path nimPath = dir / (fileName + ".nim");
+
+        vector<u8> png = encodePng(image);
+        ofstream(pngPath, ios::binary | ios::trunc).write((const char *)png.data(), png.size());
+
+        // decode
+        bool decodedOk = true;
+        auto times = timeRuns(reps, [&] {
+            string reason;
+            auto reader = openImage(pngPath, reason);
+            const u32* pixels = reader ? reader->readRows(h) : nullptr;
+            if (!pixels || memcmp(pixels, image.pixels.data(), image.pixels.size() * sizeof(u32)) != 0)
+            {
+                decodedOk = false;
+            }
+        });
+        if (!decodedOk)
+        {
+            cerr << "ERROR: Decoded " << image.name << " does not match the generated image." << endl;
+            result = 1;
+            continue;
+        }
+        report(image, "decode", times);
+
+        // quantise and pack, using the lookup cube when convertImage would
+        vector<u8> indices(size_t(w) * h);
+        auto quantiseRuns = [&](Quantiser& q, bool bit4) {
+            if (i64(w) * h >= kCubeMinPixels * opts.jobs) q.buildCube();
+            size_t rowBytes = bit4 ? w / 2 : w;
+            return timeRuns(reps, [&] {
+                parallelFor(h, opts.jobs, [&](int begin, int end) {
+                    q.convertRows(image.pixels.data() + size_t(begin) * w, w, end - begin,
+                                  indices.data() + begin * rowBytes, bit4);
+                });
+            });
+        };
+
+        Quantiser q(*palette);
+        report(image, "quantise", quantiseRuns(q, false));
+
+        Quantiser q16(palette16);
+        report(image, "pack", quantiseRuns(q16, true));
+
+        // write
+        report(image, "write", timeRuns(reps, [&] {
+            MappedFile f = MappedFile::create(nimPath, 8 + indices.size());
+            if (f.isOpen())
+            {
+                u16 size[2] = { u16(w), u16(h) };
+                memcpy(f.data(), "NIM0", 4);
+                memcpy(f.data() + 4, size, 4);
+                memcpy(f.data() + 8, indices.data(), indices.size());
+            }
+        }));
+
+        // total
+        report(image, "total", timeRuns(reps, [&] {
+            ostringstream err;
+            Quantiser fresh(*palette);
+            if (convertImage(fresh, pngPath, nimPath, opts, err) != 0) result = 1;
+        }));
+    }
+
+    fs::remove_all(dir, ec);
+    return result;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,14 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Conversion benchmarks
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+
+class CmdLine;
+
+func bench_handler(const CmdLine& cmdLine) -> int;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
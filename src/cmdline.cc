@@ -4,38 +4,14 @@
 
 #include <core.h>
 #include <cmdline.h>
+#include <platform.h>
 
 //---------------------------------------------------------------------------------------------------------------------
 // Constructor
 
-CmdLine::CmdLine(int argc, char** argv)
+CmdLine::CmdLine(int argc, char** argv, const set<string>& switches)
 {
-    //
-    // Get executable path name
-    //
-
-    int len = MAX_PATH;
-    for (;;)
-    {
-        char* buf = new char[len];
-        if (buf)
-        {
-            DWORD pathLen = GetModuleFileNameA(0, buf, len);
-            if (GetLastError() == ERROR_INSUFFICIENT_BUFFER)
-            {
-                len = 3 * len / 2;
-                delete[] buf;
-                continue;
-            }
-
-            while (buf[pathLen] != '\\') --pathLen;
-            buf[pathLen] = 0;
-
-            m_exePath = buf;
-            delete[] buf;
-            break;
-        }
-    }
+    m_exePath = executableDir();
 
     //
     // Get command
@@ -70,8 +46,8 @@ CmdLine::CmdLine(int argc, char** argv)
                 }
                 else
                 {
-                    // Long flags: --<word> <parameter>
-                    if (**(argv + 1) == 0)
+                    // Long flags: --<word> <parameter>, or just --<word> for switches
+                    if (switches.count(*argv + 2) || *(argv + 1) == nullptr || **(argv + 1) == 0)
                     {
                         m_longFlags[*argv + 2] = string();
                     }
@@ -162,6 +138,15 @@ func CmdLine::longFlag(string name) const -> string
     }
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+// hasLongFlag
+// Returns true if the flag was given, with or without a parameter.
+
+func CmdLine::hasLongFlag(string name) const -> bool
+{
+    return m_longFlags.find(name) != m_longFlags.end();
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 // secondaryParams
 
@@ -13,7 +13,8 @@ class CmdLine
 public:
     using CmdHandler = function<int(const CmdLine&)>;
 public:
-    CmdLine(int argc, char** argv);
+    // Long flags named in switches take no parameter (e.g. '--stats').
+    CmdLine(int argc, char** argv, const set<string>& switches = {});
 
     func command() const -> const string&;
     func exePath() const -> const string&;
@@ -21,6 +22,7 @@ public:
     func param(i64 i) const -> const string&;
     func flag(char flag) const -> bool;
     func longFlag(string name) const->string;
+    func hasLongFlag(string name) const -> bool;
     func secondaryParams() const -> const vector<string>&;
 
     func addCommand(string&& cmd, CmdHandler handler) -> void;
@@ -36,3 +38,7 @@ private:
     map<string, CmdHandler> m_handlers;
 };
 
+// The long flags of nim's commands that take no parameter.  Every command line nim parses uses these, whether from
+// main() or a serve request.
+inline const set<string> kNimSwitches = { "stats", "from" };
+
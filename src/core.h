@@ -7,8 +7,8 @@
 //----------------------------------------------------------------------------------------------------------------------
 // Includes
 
-#include <Windows.h>
 #include <cstdint>
+#include <filesystem>
 #include <functional>
 #include <map>
 #include <optional>
@@ -30,9 +30,16 @@ using i16 = int16_t;
 using i32 = int32_t;
 using i64 = int64_t;
 
+//----------------------------------------------------------------------------------------------------------------------
+// Version
+// Bump whenever the output for the same inputs and options changes, so incremental builds redo their work.
+
+inline constexpr const char* kNimVersion = "0.2";
+
 //----------------------------------------------------------------------------------------------------------------------
 
 using namespace std;
+namespace fs = std::filesystem;
 
 //----------------------------------------------------------------------------------------------------------------------
 //----------------------------------------------------------------------------------------------------------------------
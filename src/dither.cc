@@ -0,0 +1,351 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Dithering
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <dither.h>
+#include <jobs.h>
+#include <scratch.h>
+#include <cstring>
+#include <iterator>
+#include <thread>
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#   define NIM_SSE2 1
+#   include <emmintrin.h>
+#endif
+
+// Range of the ordered dithering offsets: one step between 3-bit hardware components.
+static const int kOrderedSpread = 36;
+
+// Pixels an error diffusion row processes between reports of its progress to the row below.
+static const int kChunkPixels = 64;
+
+//----------------------------------------------------------------------------------------------------------------------
+// Mode names
+
+static const struct
+{
+    Dither mode;
+    const char* name;
+}
+kModes[] = {
+    { Dither::None, "none" },
+    { Dither::Bayer2, "bayer2" },
+    { Dither::Bayer4, "bayer4" },
+    { Dither::Bayer8, "bayer8" },
+    { Dither::FloydSteinberg, "floyd" },
+    { Dither::Atkinson, "atkinson" },
+    { Dither::SierraLite, "sierra-lite" },
+};
+
+func parseDither(const string& name) -> optional<Dither>
+{
+    for (const auto& m : kModes)
+    {
+        if (name == m.name) return m.mode;
+    }
+    return {};
+}
+
+func ditherName(Dither mode) -> const char*
+{
+    for (const auto& m : kModes)
+    {
+        if (mode == m.mode) return m.name;
+    }
+    return "none";
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Error diffusion kernels
+// Where each pixel's error goes, in 16ths.  Atkinson deliberately passes on only 3/4 of the error.
+
+struct Spread
+{
+    int dx;
+    int dy;
+    int weight;
+};
+
+static const Spread kFloydSteinberg[] = { { 1, 0, 7 }, { -1, 1, 3 }, { 0, 1, 5 }, { 1, 1, 1 } };
+static const Spread kAtkinson[] = { { 1, 0, 2 }, { 2, 0, 2 }, { -1, 1, 2 }, { 0, 1, 2 }, { 1, 1, 2 }, { 0, 2, 2 } };
+static const Spread kSierraLite[] = { { 1, 0, 8 }, { -1, 1, 4 }, { 0, 1, 4 } };
+
+//----------------------------------------------------------------------------------------------------------------------
+// Bayer matrices
+// Built by the usual recursion, M(2n) = [4M, 4M+2; 4M+3, 4M+1], and turned into per-pixel offsets.  Each row of
+// offsets is repeated to 8 pixels so that every mode's pattern lines up with 4-pixel SIMD loads.  Offsets are stored
+// as separate positive and negative parts for saturating byte arithmetic, with the alpha byte left at zero.
+
+struct OrderedPattern
+{
+    u32 add[8][8];
+    u32 sub[8][8];
+};
+
+static func makePattern(int n) -> OrderedPattern
+{
+    vector<int> m = { 0 };
+    for (int size = 1; size < n; size *= 2)
+    {
+        vector<int> next(size_t(4) * size * size);
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+            {
+                int v = 4 * m[size_t(y) * size + x];
+                next[size_t(y) * 2 * size + x] = v;
+                next[size_t(y) * 2 * size + x + size] = v + 2;
+                next[size_t(y + size) * 2 * size + x] = v + 3;
+                next[size_t(y + size) * 2 * size + x + size] = v + 1;
+            }
+        }
+        m = move(next);
+    }
+
+    OrderedPattern pattern;
+    for (int y = 0; y < 8; ++y)
+    {
+        for (int x = 0; x < 8; ++x)
+        {
+            int offset = (2 * m[size_t(y % n) * n + x % n] + 1 - n * n) * kOrderedSpread / (2 * n * n);
+            u32 add = u32(max(offset, 0));
+            u32 sub = u32(max(-offset, 0));
+            pattern.add[y][x] = add | (add << 8) | (add << 16);
+            pattern.sub[y][x] = sub | (sub << 8) | (sub << 16);
+        }
+    }
+    return pattern;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// applyPattern
+// Offsets one row of pixels by its row of the pattern, clamping each component to 0-255.
+
+static func addSaturated(u32 a, u32 b) -> u32
+{
+    u32 r = 0;
+    for (int s = 0; s < 32; s += 8)
+    {
+        r |= u32(min(int((a >> s) & 0xff) + int((b >> s) & 0xff), 255)) << s;
+    }
+    return r;
+}
+
+static func subSaturated(u32 a, u32 b) -> u32
+{
+    u32 r = 0;
+    for (int s = 0; s < 32; s += 8)
+    {
+        r |= u32(max(int((a >> s) & 0xff) - int((b >> s) & 0xff), 0)) << s;
+    }
+    return r;
+}
+
+static func applyPattern(const u32* src, u32* dst, int width, const u32* add, const u32* sub) -> void
+{
+    int x = 0;
+
+#if NIM_SSE2
+    const __m128i add0 = _mm_loadu_si128((const __m128i*)add);
+    const __m128i add1 = _mm_loadu_si128((const __m128i*)(add + 4));
+    const __m128i sub0 = _mm_loadu_si128((const __m128i*)sub);
+    const __m128i sub1 = _mm_loadu_si128((const __m128i*)(sub + 4));
+
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i p0 = _mm_loadu_si128((const __m128i*)(src + x));
+        __m128i p1 = _mm_loadu_si128((const __m128i*)(src + x + 4));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_subs_epu8(_mm_adds_epu8(p0, add0), sub0));
+        _mm_storeu_si128((__m128i*)(dst + x + 4), _mm_subs_epu8(_mm_adds_epu8(p1, add1), sub1));
+    }
+#endif
+
+    for (; x < width; ++x)
+    {
+        dst[x] = subSaturated(addSaturated(src[x], add[x & 7]), sub[x & 7]);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Ditherer
+//----------------------------------------------------------------------------------------------------------------------
+
+Ditherer::Ditherer(const Quantiser& q, Dither mode, int width, int maxBandRows)
+    : m_quantiser(q)
+    , m_mode(mode)
+    , m_width(width)
+    , m_ringRows(maxBandRows + 3)
+    , m_errorStride(size_t(width + 3) * 3)
+{
+    const Palette& p = q.palette();
+    for (int i = 0; i < p.numColours(); ++i)
+    {
+        m_colours.push_back(u32(kColour_3bit[p[i].m_red]) | (u32(kColour_3bit[p[i].m_green]) << 8) |
+                            (u32(kColour_3bit[p[i].m_blue]) << 16));
+    }
+
+    if (mode == Dither::FloydSteinberg || mode == Dither::Atkinson || mode == Dither::SierraLite)
+    {
+        m_errors1.assign(m_errorStride * m_ringRows, 0);
+        m_errors2.assign(m_errorStride * m_ringRows, 0);
+        m_progress.reset(new atomic<int>[maxBandRows]);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// convertRows
+
+func Ditherer::convertRows(const u32* src, int firstRow, int numRows, u8* dst, bool bit4, int numJobs) -> void
+{
+    if (m_mode == Dither::Bayer2 || m_mode == Dither::Bayer4 || m_mode == Dither::Bayer8)
+    {
+        convertOrdered(src, firstRow, numRows, dst, bit4, numJobs);
+        return;
+    }
+
+    for (int r = 0; r < numRows; ++r)
+    {
+        m_progress[r].store(0, memory_order_relaxed);
+    }
+
+    // Rows are dealt out in turn, so each thread works a few rows behind the one before it.
+    int numThreads = max(1, min(numJobs, numRows));
+    size_t rowBytes = bit4 ? m_width / 2 : m_width;
+    parallelFor(numThreads, numThreads, [&](int begin, int end) {
+        for (int t = begin; t < end; ++t)
+        {
+            for (int r = t; r < numRows; r += numThreads)
+            {
+                diffuseRow(src + size_t(r) * m_width, r, firstRow + r, dst + r * rowBytes, bit4);
+            }
+        }
+    });
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// convertOrdered
+
+func Ditherer::convertOrdered(const u32* src, int firstRow, int numRows, u8* dst, bool bit4, int numJobs) -> void
+{
+    static const OrderedPattern kBayer2 = makePattern(2);
+    static const OrderedPattern kBayer4 = makePattern(4);
+    static const OrderedPattern kBayer8 = makePattern(8);
+    const OrderedPattern& pattern = m_mode == Dither::Bayer2 ? kBayer2 : m_mode == Dither::Bayer4 ? kBayer4 : kBayer8;
+
+    size_t rowBytes = bit4 ? m_width / 2 : m_width;
+    parallelFor(numRows, numJobs, [&](int begin, int end) {
+        ScratchBuffer buffer;
+        u32* row = buffer.get<u32>(m_width);
+        for (int r = begin; r < end; ++r)
+        {
+            int y = (firstRow + r) & 7;
+            applyPattern(src + size_t(r) * m_width, row, m_width, pattern.add[y], pattern.sub[y]);
+            m_quantiser.convertRows(row, m_width, 1, dst + r * rowBytes, bit4);
+        }
+    });
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// diffuseRow
+// Errors are kept per channel in 16ths.  A pixel's error comes from three places: earlier pixels in its own row
+// (kept locally), the row above (errors1) and two rows above (errors2).  Each error row has a single writer, so rows
+// on different threads never write to the same memory.
+
+func Ditherer::diffuseRow(const u32* src, int bandRow, int y, u8* dst, bool bit4) -> void
+{
+    const Spread* spread;
+    int numSpread;
+    switch (m_mode)
+    {
+    case Dither::Atkinson:
+        spread = kAtkinson;
+        numSpread = int(size(kAtkinson));
+        break;
+    case Dither::SierraLite:
+        spread = kSierraLite;
+        numSpread = int(size(kSierraLite));
+        break;
+    default:
+        spread = kFloydSteinberg;
+        numSpread = int(size(kFloydSteinberg));
+        break;
+    }
+
+    ScratchBuffer ownBuffer;
+    ScratchBuffer indexBuffer;
+    i32* own = ownBuffer.get<i32>(m_errorStride);
+    u8* indices = indexBuffer.get<u8>(m_width);
+    memset(own, 0, m_errorStride * sizeof(i32));
+
+    const i32* in1 = errorRow(m_errors1, y);
+    const i32* in2 = errorRow(m_errors2, y);
+    i32* out1 = errorRow(m_errors1, y + 1);
+    i32* out2 = errorRow(m_errors2, y + 2);
+    memset(out1, 0, m_errorStride * sizeof(i32));
+    memset(out2, 0, m_errorStride * sizeof(i32));
+    i32* targets[3] = { own, out1, out2 };
+
+    // A pixel receives errors from up to one pixel to its right in the row above, so that row must stay ahead.
+    const atomic<int>* above = bandRow > 0 ? &m_progress[bandRow - 1] : nullptr;
+    u8 transparent = m_quantiser.palette().getTransColour();
+
+    for (int x0 = 0; x0 < m_width; x0 += kChunkPixels)
+    {
+        int x1 = min(x0 + kChunkPixels, m_width);
+        if (above)
+        {
+            int needed = min(x1 + 1, m_width);
+            while (above->load(memory_order_acquire) < needed) this_thread::yield();
+        }
+
+        for (int x = x0; x < x1; ++x)
+        {
+            u32 pixel = src[x];
+            if ((pixel >> 24) != 255)
+            {
+                indices[x] = transparent;
+                continue;
+            }
+
+            size_t e = size_t(x + 1) * 3;
+            int want[3];
+            for (int c = 0; c < 3; ++c)
+            {
+                int error = (in1[e + c] + in2[e + c] + own[e + c] + 8) >> 4;
+                want[c] = min(max(int((pixel >> (8 * c)) & 0xff) + error, 0), 255);
+            }
+
+            u8 index = m_quantiser.index(u32(want[0]) | (u32(want[1]) << 8) | (u32(want[2]) << 16) | 0xff000000);
+            indices[x] = index;
+
+            u32 actual = m_colours[index];
+            for (int c = 0; c < 3; ++c)
+            {
+                int error = want[c] - int((actual >> (8 * c)) & 0xff);
+                for (int i = 0; i < numSpread; ++i)
+                {
+                    targets[spread[i].dy][e + spread[i].dx * 3 + c] += error * spread[i].weight;
+                }
+            }
+        }
+
+        m_progress[bandRow].store(x1, memory_order_release);
+    }
+
+    if (bit4)
+    {
+        for (int x = 0; x < m_width; x += 2)
+        {
+            dst[x / 2] = u8((indices[x] << 4) + indices[x + 1]);
+        }
+    }
+    else
+    {
+        memcpy(dst, indices, m_width);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,74 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Dithering
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+#include <quantise.h>
+#include <atomic>
+
+//----------------------------------------------------------------------------------------------------------------------
+// Dither
+// Dithering modes for '--dither <mode>'.
+
+enum class Dither
+{
+    None,
+    Bayer2,             // Ordered, with 2x2, 4x4 or 8x8 Bayer matrices
+    Bayer4,
+    Bayer8,
+    FloydSteinberg,     // Error diffusion
+    Atkinson,
+    SierraLite,
+};
+
+// Returns the mode for a '--dither' name, or nothing if the name is unknown.
+func parseDither(const string& name) -> optional<Dither>;
+func ditherName(Dither mode) -> const char*;
+
+//----------------------------------------------------------------------------------------------------------------------
+// Ditherer
+// Converts an image to palette indices with dithering, a band of rows at a time from top to bottom, keeping the error
+// diffusion state between bands.
+//
+// Ordered modes offset each pixel by its Bayer threshold (spread over one hardware colour step) in a branch-free SIMD
+// pass and then convert as usual, so rows are independent.  Error diffusion runs rows on several threads in a row-lag
+// wavefront: each row starts once the row above is far enough ahead that every error it will receive has been
+// written.  Every pixel sees exactly the errors a single thread would give it, so the output does not depend on the
+// number of threads.
+
+class Ditherer
+{
+public:
+    // mode must not be Dither::None.
+    Ditherer(const Quantiser& q, Dither mode, int width, int maxBandRows);
+
+    // Converts numRows rows of RGBA pixels starting at image row firstRow, packing as Quantiser::convertRows() does.
+    // numRows must not exceed maxBandRows.
+    func convertRows(const u32* src, int firstRow, int numRows, u8* dst, bool bit4, int numJobs) -> void;
+
+private:
+    func convertOrdered(const u32* src, int firstRow, int numRows, u8* dst, bool bit4, int numJobs) -> void;
+    func diffuseRow(const u32* src, int bandRow, int y, u8* dst, bool bit4) -> void;
+
+    // Error rows are a ring indexed by image row, large enough to hold a band and the two rows below it.
+    func errorRow(vector<i32>& errors, int y) -> i32*
+    {
+        return errors.data() + size_t(y % m_ringRows) * m_errorStride;
+    }
+
+private:
+    const Quantiser& m_quantiser;
+    Dither m_mode;
+    int m_width;
+    int m_ringRows;
+    size_t m_errorStride;
+    vector<u32> m_colours;                  // RGB of each palette entry, for measuring the error
+    vector<i32> m_errors1;                  // Errors diffused from the row above, per row and channel
+    vector<i32> m_errors2;                  // Errors diffused from two rows above
+    unique_ptr<atomic<int>[]> m_progress;   // Pixels finished in each row of the current band
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
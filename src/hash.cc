@@ -0,0 +1,139 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Hashing
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <hash.h>
+#include <cstring>
+#include <fstream>
+
+static const u64 kPrime1 = 0x9e3779b185ebca87ull;
+static const u64 kPrime2 = 0xc2b2ae3d27d4eb4full;
+
+static func rotl(u64 x, int r) -> u64
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Constructor
+
+Hasher::Hasher(u64 seed)
+    : m_state(seed ^ kPrime2)
+    , m_tail(0)
+    , m_tailSize(0)
+    , m_length(0)
+{
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// mix
+
+func Hasher::mix(u64 word) -> void
+{
+    m_state ^= rotl(word * kPrime2, 31) * kPrime1;
+    m_state = rotl(m_state, 27) * kPrime1 + kPrime2;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// update
+
+func Hasher::update(const void* data, size_t size) -> Hasher&
+{
+    const u8* bytes = (const u8*)data;
+    m_length += size;
+
+    // Finish any partial word first.
+    while (size && m_tailSize)
+    {
+        m_tail |= u64(*bytes++) << (m_tailSize * 8);
+        --size;
+        if (++m_tailSize == 8)
+        {
+            mix(m_tail);
+            m_tail = 0;
+            m_tailSize = 0;
+        }
+    }
+
+    for (; size >= 8; size -= 8, bytes += 8)
+    {
+        u64 word;
+        memcpy(&word, bytes, 8);
+        mix(word);
+    }
+
+    while (size--)
+    {
+        m_tail |= u64(*bytes++) << (m_tailSize++ * 8);
+    }
+
+    return *this;
+}
+
+func Hasher::update(u64 value) -> Hasher&
+{
+    return update(&value, sizeof(value));
+}
+
+func Hasher::update(const string& str) -> Hasher&
+{
+    update(u64(str.size()));
+    return update(str.data(), str.size());
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// digest
+
+func Hasher::digest() const -> u64
+{
+    u64 h = m_state ^ m_length;
+    if (m_tailSize) h ^= rotl(m_tail * kPrime2, 31) * kPrime1;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// hashFile
+
+func hashFile(const fs::path& path, u64& hash) -> bool
+{
+    ifstream f(path, ios::binary);
+    if (!f.is_open())
+    {
+        return false;
+    }
+
+    Hasher hasher;
+    vector<char> buffer(64 * 1024);
+    while (f)
+    {
+        f.read(buffer.data(), buffer.size());
+        hasher.update(buffer.data(), size_t(f.gcount()));
+    }
+
+    hash = hasher.digest();
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// stampFile
+
+func stampFile(const fs::path& path) -> u64
+{
+    error_code ec;
+    auto size = fs::file_size(path, ec);
+    if (ec) return 0;
+    auto time = fs::last_write_time(path, ec);
+    if (ec) return 0;
+
+    return Hasher().update(u64(size)).update(u64(time.time_since_epoch().count())).digest();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
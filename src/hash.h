@@ -0,0 +1,47 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Hashing
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// Hasher
+// Incremental 64-bit non-cryptographic hash.  Good for detecting changed content and bucketing, not for security.
+
+class Hasher
+{
+public:
+    Hasher(u64 seed = 0);
+
+    func update(const void* data, size_t size) -> Hasher&;
+    func update(u64 value) -> Hasher&;
+    func update(const string& str) -> Hasher&;
+
+    func digest() const -> u64;
+
+private:
+    func mix(u64 word) -> void;
+
+private:
+    u64 m_state;
+    u64 m_tail;             // Bytes not yet making up a whole word
+    int m_tailSize;
+    u64 m_length;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// hashFile
+// Hashes the contents of a file.  Returns false if it cannot be read.
+
+func hashFile(const fs::path& path, u64& hash) -> bool;
+
+//----------------------------------------------------------------------------------------------------------------------
+// stampFile
+// Returns a hash of a file's size and modification time, or 0 if it does not exist.
+
+func stampFile(const fs::path& path) -> u64;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,776 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Image conversion
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <cmdline.h>
+#include <image.h>
+#include <jobs.h>
+#include <manifest.h>
+#include <mapping.h>
+#include <reader.h>
+#include <scratch.h>
+#include <zx0.h>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+// Pixels decoded per band and per thread when streaming an image.
+static const i64 kBandPixels = 64 * 1024;
+
+// Block of output transposed at a time for column-major layouts: rows converted together, and byte columns written
+// down them before moving on, so the block stays in L1.
+static const int kTransposeRows = 32;
+static const size_t kTransposeColumns = 64;
+
+// Bytes of payload compressed as one independent block when the payload is not split into pages.
+static const int kCompressBlockSize = 16384;
+
+//----------------------------------------------------------------------------------------------------------------------
+// parseLayout
+
+func parseLayout(const string& name) -> optional<Layout>
+{
+    if (name == "row") return Layout::Row;
+    if (name == "column") return Layout::Column;
+    return {};
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// parseCompression
+
+func parseCompression(const string& name) -> optional<Compression>
+{
+    if (name == "none") return Compression::None;
+    if (name == "zx0") return Compression::Zx0;
+    return {};
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// imageOptions
+
+func imageOptions(const CmdLine& cmdLine) -> ImageOptions
+{
+    ImageOptions opts;
+    opts.bit4 = cmdLine.flag('4');
+    opts.jobs = numJobs(cmdLine);
+    opts.incremental = cmdLine.flag('i');
+    opts.statsJson = cmdLine.longFlag("stats-format") == "json";
+    opts.stats = cmdLine.hasLongFlag("stats") || opts.statsJson;
+
+    string dither = cmdLine.longFlag("dither");
+    if (!dither.empty())
+    {
+        auto mode = parseDither(dither);
+        if (!mode)
+        {
+            throw runtime_error("Unknown dither mode '" + dither + "'.");
+        }
+        opts.dither = *mode;
+    }
+
+    string split = cmdLine.longFlag("split");
+    if (!split.empty())
+    {
+        if (split == "8k" || split == "8K" || split == "8192") opts.pageSize = 8192;
+        else if (split == "16k" || split == "16K" || split == "16384") opts.pageSize = 16384;
+        else throw runtime_error("Pages must be 8k or 16k, not '" + split + "'.");
+    }
+
+    string layout = cmdLine.longFlag("layout");
+    if (!layout.empty())
+    {
+        auto parsed = parseLayout(layout);
+        if (!parsed)
+        {
+            throw runtime_error("Unknown layout '" + layout + "'.");
+        }
+        opts.layout = *parsed;
+    }
+
+    string compress = cmdLine.longFlag("compress");
+    if (!compress.empty())
+    {
+        auto parsed = parseCompression(compress);
+        if (!parsed)
+        {
+            throw runtime_error("Unknown compression '" + compress + "'.");
+        }
+        opts.compression = *parsed;
+    }
+
+    string bank = cmdLine.longFlag("bank");
+    if (!bank.empty())
+    {
+        opts.bank = stoi(bank);
+        if (opts.bank < 0 || opts.bank > 15)
+        {
+            throw runtime_error("Palette bank " + bank + " is not between 0 and 15.");
+        }
+    }
+
+    return opts;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// key
+
+func ImageOptions::key() const -> string
+{
+    string key = string("image") + (bit4 ? " -4" : "");
+    if (bank >= 0)
+    {
+        key += " --bank " + to_string(bank);
+    }
+    if (layout != Layout::Row)
+    {
+        key += " --layout column";
+    }
+    if (pageSize)
+    {
+        key += " --split " + to_string(pageSize);
+    }
+    if (compression == Compression::Zx0)
+    {
+        key += " --compress zx0";
+    }
+    if (dither != Dither::None)
+    {
+        key += string(" --dither ") + ditherName(dither);
+    }
+    return key;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// loadPalette
+
+func loadPalette(const string& path, ostream& err) -> optional<Palette>
+{
+    if (path.empty())
+    {
+        return Palette();
+    }
+
+    ifstream f(path, ios::binary);
+    if (!f.is_open())
+    {
+        err << "ERROR: Cannot find '" << path << "'." << endl;
+        return {};
+    }
+
+    Palette p(f);
+    if (p.numColours() == 0)
+    {
+        err << "ERROR: Unable to load the palette file '" << path << "'." << endl;
+        return {};
+    }
+
+    return p;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// paletteBank
+
+func paletteBank(const Palette& p, int bank) -> optional<Palette>
+{
+    int first = bank * 16;
+    if (bank < 0 || first >= p.numColours())
+    {
+        return {};
+    }
+
+    vector<Colour> colours;
+    for (int i = first; i < min(first + 16, p.numColours()); ++i)
+    {
+        colours.push_back(p[i]);
+    }
+    return Palette(move(colours), u8(p.getTransColour() % 16));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// transposeRows
+// Writes numRows rows of converted bytes, starting at image row firstRow, into a column-major payload: byte column c
+// of row y goes to c * height + y.  For 4-bit output a byte column holds two pixels, so nibble pairs stay together.
+
+static func transposeRows(const u8* src, size_t rowBytes, int numRows, u8* dst, int height, int firstRow) -> void
+{
+    for (size_t c0 = 0; c0 < rowBytes; c0 += kTransposeColumns)
+    {
+        size_t c1 = min(c0 + kTransposeColumns, rowBytes);
+        for (size_t c = c0; c < c1; ++c)
+        {
+            u8* column = dst + c * height + firstRow;
+            for (int r = 0; r < numRows; ++r)
+            {
+                column[r] = src[r * rowBytes + c];
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// convertPixels
+
+func convertPixels(Quantiser& q, ImageReader& reader, const ImageOptions& opts, u8* pixels, ConvertStats* st)
+    -> bool
+{
+    int w = reader.width();
+    int h = reader.height();
+
+    // Indexed images only look up their own colours, and are then remapped a byte at a time, unless they are being
+    // dithered.  Otherwise, large images amortise the cost of building a lookup cube; small ones search the palette
+    // directly.
+    const u32* colours = opts.dither == Dither::None ? reader.colourTable() : nullptr;
+    array<u8, 256> remap;
+    if (colours)
+    {
+        StageTimer timer(st, Stage::Quantise);
+        remap = q.remapTable(colours);
+    }
+    else if (i64(w) * h >= kCubeMinPixels * opts.jobs)
+    {
+        StageTimer timer(st, Stage::Cube);
+        q.buildCube();
+    }
+
+    // Decode and convert a band of rows at a time.  Images already decoded in full go in one band.  Within a band,
+    // rows are split between the threads and each writes straight into its slice of the output.
+    size_t rowBytes = opts.bit4 ? w / 2 : w;
+    int bandRows = reader.isBuffered() ? h : max(1, int(kBandPixels * opts.jobs / w));
+    bandRows = min(bandRows, h);
+    LookupCounts lookups;
+    mutex countsLock;
+
+    unique_ptr<Ditherer> ditherer;
+    if (opts.dither != Dither::None)
+    {
+        ditherer = make_unique<Ditherer>(q, opts.dither, w, bandRows);
+    }
+
+    for (int row = 0; row < h; row += bandRows)
+    {
+        int numRows = min(bandRows, h - row);
+        const u32* src = nullptr;
+        const u8* srcIndices = nullptr;
+        {
+            StageTimer timer(st, Stage::Decode);
+            if (colours)
+            {
+                srcIndices = reader.readIndices(numRows);
+            }
+            else
+            {
+                src = reader.readRows(numRows);
+            }
+        }
+        if (!src && !srcIndices)
+        {
+            return false;
+        }
+
+        // Converts a slice of the band's rows with convert(firstRow, numRows, out).  Row-major output goes straight
+        // into place.  Column-major output goes through a small block of rows, which is then transposed into the
+        // columns while it is still in cache.
+        bool columns = opts.layout == Layout::Column;
+        u8* dst = pixels + size_t(row) * rowBytes;
+        auto convertSlice = [&](int begin, int end, auto&& convert) {
+            if (!columns)
+            {
+                convert(begin, end - begin, dst + begin * rowBytes);
+                return;
+            }
+
+            ScratchBuffer buffer;
+            u8* block = buffer.get<u8>(kTransposeRows * rowBytes);
+            for (int r = begin; r < end; r += kTransposeRows)
+            {
+                int n = min(kTransposeRows, end - r);
+                convert(r, n, block);
+                transposeRows(block, rowBytes, n, pixels, h, row + r);
+            }
+        };
+
+        if (colours)
+        {
+            StageTimer timer(st, Stage::Quantise);
+            parallelFor(numRows, opts.jobs, [&](int begin, int end) {
+                convertSlice(begin, end, [&](int first, int n, u8* out) {
+                    Quantiser::remapRows(srcIndices + size_t(first) * w, remap, w, n, out, opts.bit4);
+                });
+            });
+            lookups.remapped += u64(numRows) * w;
+        }
+        else if (ditherer)
+        {
+            // Error diffusion runs its own threads over the whole band, so the band is transposed afterwards.
+            StageTimer timer(st, Stage::Quantise);
+            ScratchBuffer buffer;
+            u8* band = columns ? buffer.get<u8>(size_t(numRows) * rowBytes) : dst;
+            ditherer->convertRows(src, row, numRows, band, opts.bit4, opts.jobs);
+            if (columns)
+            {
+                parallelFor(numRows, opts.jobs, [&](int begin, int end) {
+                    for (int r = begin; r < end; r += kTransposeRows)
+                    {
+                        transposeRows(band + size_t(r) * rowBytes, rowBytes, min(kTransposeRows, end - r), pixels, h,
+                                      row + r);
+                    }
+                });
+            }
+            lookups.dithered += u64(numRows) * w;
+        }
+        else
+        {
+            {
+                StageTimer timer(st, Stage::Quantise);
+                parallelFor(numRows, opts.jobs, [&](int begin, int end) {
+                    LookupCounts counts;
+                    convertSlice(begin, end, [&](int first, int n, u8* out) {
+                        q.convertRows(src + size_t(first) * w, w, n, out, opts.bit4, st ? &counts : nullptr);
+                    });
+                    if (st)
+                    {
+                        lock_guard<mutex> guard(countsLock);
+                        lookups.merge(counts);
+                    }
+                });
+            }
+
+            if (st)
+            {
+                q.countLookups(src, size_t(numRows) * w, lookups);
+            }
+        }
+    }
+
+    if (st)
+    {
+        st->lookups.merge(lookups);
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// pagePath
+
+func pagePath(const fs::path& outPath, int page) -> fs::path
+{
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%02d.bin", page);
+    return outPath.parent_path() / (outPath.stem().string() + suffix);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Output files
+// A conversion writes the .nim and its page files under temporary names next to the final ones, and only renames them
+// into place once it has succeeded, so a failed conversion leaves the previous output alone.
+
+static func tempPath(const fs::path& path) -> fs::path
+{
+    return path.parent_path() / (path.filename().string() + ".tmp");
+}
+
+// Removes the temporary files of a failed conversion.
+static func discardOutput(const fs::path& outPath, int numPages) -> void
+{
+    error_code ec;
+    fs::remove(tempPath(outPath), ec);
+    for (int page = 0; page < numPages; ++page)
+    {
+        fs::remove(tempPath(pagePath(outPath, page)), ec);
+    }
+}
+
+// Renames the temporary .nim and numPages page files over the outputs.  Page files numbered beyond them, left by an
+// earlier conversion to more pages or with --split, are removed, so only the pages of this conversion remain.
+static func commitOutput(const fs::path& outPath, int numPages, ostream& err) -> bool
+{
+    error_code ec;
+    for (int page = 0; page < numPages; ++page)
+    {
+        fs::path path = pagePath(outPath, page);
+        fs::rename(tempPath(path), path, ec);
+        if (ec)
+        {
+            err << "ERROR: Unable to write " << path << endl;
+            discardOutput(outPath, numPages);
+            return false;
+        }
+    }
+
+    fs::rename(tempPath(outPath), outPath, ec);
+    if (ec)
+    {
+        err << "ERROR: Unable to write " << outPath << endl;
+        discardOutput(outPath, 0);
+        return false;
+    }
+
+    for (int page = numPages; fs::remove(pagePath(outPath, page), ec); ++page) {}
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// writePages
+// Writes temporary page files straight from the output, each page on its own thread.  Each of pages is a page's data
+// and size.
+
+static func writePages(const vector<pair<const u8*, size_t>>& pages, const fs::path& outPath, const ImageOptions& opts,
+                       ostream& err) -> bool
+{
+    atomic<bool> ok(true);
+    mutex errLock;
+
+    parallelFor(int(pages.size()), opts.jobs, [&](int begin, int end) {
+        for (int page = begin; page < end; ++page)
+        {
+            fs::path path = tempPath(pagePath(outPath, page));
+            MappedFile f = MappedFile::create(path, pages[page].second);
+            if (!f.isOpen())
+            {
+                lock_guard<mutex> guard(errLock);
+                err << "ERROR: Unable to open " << path << endl;
+                ok = false;
+                continue;
+            }
+            memcpy(f.data(), pages[page].first, pages[page].second);
+        }
+    });
+
+    return ok;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// compressBlocks
+// Compresses a payload in independent blocks, each on its own thread, and unpacks each block again to check it.
+// Returns nothing if any block fails to come back unchanged.
+
+static func compressBlocks(const u8* payload, size_t size, size_t blockSize, int jobs) -> optional<vector<vector<u8>>>
+{
+    int numBlocks = int((size + blockSize - 1) / blockSize);
+    vector<vector<u8>> blocks(numBlocks);
+    atomic<bool> ok(true);
+
+    parallelFor(numBlocks, jobs, [&](int begin, int end) {
+        vector<u8> check;
+        for (int b = begin; b < end; ++b)
+        {
+            const u8* src = payload + size_t(b) * blockSize;
+            size_t length = min(blockSize, size - size_t(b) * blockSize);
+            blocks[b] = zx0Compress(src, length);
+
+            check.resize(length);
+            if (!zx0Decompress(blocks[b].data(), blocks[b].size(), check.data(), length) ||
+                memcmp(check.data(), src, length) != 0)
+            {
+                ok = false;
+            }
+        }
+    });
+
+    if (!ok) return {};
+    return blocks;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// writeCompressed
+// Compresses a converted payload and writes it as a NIM1 file, and its blocks as page files for opts.pageSize.
+// Returns the number of bytes written, or 0 on failure.
+
+static func writeCompressed(const u8* payload, size_t size, int w, int h, const fs::path& outPath,
+                            const ImageOptions& opts, ostream& err, ConvertStats* st) -> u64
+{
+    struct Header
+    {
+        char id[4];
+        u16 width;
+        u16 height;
+        u8 flags;
+        u8 algorithm;
+        u16 blockSize;
+        u16 numBlocks;
+    };
+
+    // The header counts blocks in 16 bits.
+    size_t blockSize = opts.pageSize ? opts.pageSize : kCompressBlockSize;
+    size_t numBlocks = (size + blockSize - 1) / blockSize;
+    if (numBlocks > 65535)
+    {
+        err << "ERROR: A compressed image can only have 65535 blocks, but " << outPath << " needs " << numBlocks << "."
+            << endl;
+        return 0;
+    }
+
+    optional<vector<vector<u8>>> blocks;
+    {
+        StageTimer timer(st, Stage::Compress);
+        blocks = compressBlocks(payload, size, blockSize, opts.jobs);
+    }
+    if (!blocks)
+    {
+        err << "ERROR: The compressed pixel data for " << outPath << " did not unpack correctly." << endl;
+        return 0;
+    }
+
+    StageTimer timer(st, Stage::Write);
+    size_t fileSize = sizeof(Header) + 2 * numBlocks;
+    for (const auto& block : *blocks) fileSize += block.size();
+
+    MappedFile f = MappedFile::create(tempPath(outPath), fileSize);
+    if (!f.isOpen())
+    {
+        err << "ERROR: Unable to open " << tempPath(outPath) << endl;
+        return 0;
+    }
+
+    Header hdr;
+    hdr.id[0] = 'N';
+    hdr.id[1] = 'I';
+    hdr.id[2] = 'M';
+    hdr.id[3] = '1';
+    hdr.width = w;
+    hdr.height = h;
+    hdr.flags = 1;
+    hdr.algorithm = u8(opts.compression);
+    hdr.blockSize = u16(blockSize);
+    hdr.numBlocks = u16(numBlocks);
+    memcpy(f.data(), &hdr, sizeof(Header));
+
+    u8* sizes = f.data() + sizeof(Header);
+    u8* dst = sizes + 2 * numBlocks;
+    vector<pair<const u8*, size_t>> pages;
+    for (const auto& block : *blocks)
+    {
+        *sizes++ = u8(block.size());
+        *sizes++ = u8(block.size() >> 8);
+        memcpy(dst, block.data(), block.size());
+        pages.push_back({ dst, block.size() });
+        dst += block.size();
+    }
+
+    u64 bytesWritten = f.size();
+    if (opts.pageSize)
+    {
+        if (!writePages(pages, outPath, opts, err))
+        {
+            f.close();
+            discardOutput(outPath, int(pages.size()));
+            return 0;
+        }
+        bytesWritten += f.size() - sizeof(Header) - 2 * numBlocks;
+    }
+    f.close();
+
+    if (!commitOutput(outPath, opts.pageSize ? int(numBlocks) : 0, err))
+    {
+        return 0;
+    }
+    return bytesWritten;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// convertImage
+
+func convertImage(Quantiser& paletteQuantiser, const fs::path& inPath, const fs::path& outPath,
+                  const ImageOptions& opts, ostream& err, ConvertStats* stats) -> int
+{
+    // A 4-bit sprite can use any 16-colour bank of a larger palette through the palette offset.  Its indices are
+    // relative to the bank, so it gets a quantiser of its own.  With only 16 colours this is cheap to build.
+    optional<PaletteSlot> bankSlot;
+    if (opts.bit4 && opts.bank >= 0)
+    {
+        auto bank = paletteBank(paletteQuantiser.palette(), opts.bank);
+        if (!bank)
+        {
+            err << "ERROR: The palette has no bank " << opts.bank << "." << endl;
+            return 1;
+        }
+        bankSlot.emplace(move(*bank));
+    }
+
+    Quantiser& q = bankSlot ? bankSlot->quantiser : paletteQuantiser;
+    const Palette& p = q.palette();
+
+    // Stats are gathered locally and only added to the caller's once the conversion succeeds.
+    auto start = chrono::steady_clock::now();
+    ConvertStats local;
+    ConvertStats* st = stats ? &local : nullptr;
+
+    string reason;
+    unique_ptr<ImageReader> reader;
+    {
+        StageTimer timer(st, Stage::Decode);
+        reader = openImage(inPath, reason);
+    }
+    if (!reader)
+    {
+        err << "ERROR: Could not load image " << inPath << " (" << reason << ")." << endl;
+        return 1;
+    }
+
+    int w = reader->width();
+    int h = reader->height();
+
+    if (opts.bit4)
+    {
+        if (p.numColours() > 16)
+        {
+            err << "ERROR: Invalid palette for 4-bit mode.  Must be 16 colours or less, or choose a bank with --bank."
+                << endl;
+            return 1;
+        }
+
+        if (w % 2 == 1)
+        {
+            err << "ERROR: Width must be a multiple of 2 for 4-bit mode." << endl;
+            return 1;
+        }
+    }
+
+    size_t rowBytes = opts.bit4 ? w / 2 : w;
+    u64 bytesWritten = 0;
+
+    if (opts.compression != Compression::None)
+    {
+        // The blocks' compressed sizes go in the header, so the payload is converted in memory first.
+        vector<u8> pixels(rowBytes * h);
+        if (!convertPixels(q, *reader, opts, pixels.data(), st))
+        {
+            err << "ERROR: Could not load image " << inPath << " (" << reader->error() << ")." << endl;
+            return 1;
+        }
+
+        bytesWritten = writeCompressed(pixels.data(), pixels.size(), w, h, outPath, opts, err, st);
+        if (!bytesWritten)
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        struct Header
+        {
+            char id[4];
+            u16 width;
+            u16 height;
+        };
+
+        // The output is created at its final size and mapped, so the quantiser writes each row straight into the file.
+        MappedFile f;
+        {
+            StageTimer timer(st, Stage::Write);
+            f = MappedFile::create(tempPath(outPath), sizeof(Header) + u64(rowBytes) * h);
+            if (!f.isOpen())
+            {
+                err << "ERROR: Unable to open " << tempPath(outPath) << endl;
+                return 1;
+            }
+
+            Header hdr;
+            hdr.id[0] = 'N';
+            hdr.id[1] = 'I';
+            hdr.id[2] = 'M';
+            hdr.id[3] = '0';
+            hdr.width = w;
+            hdr.height = h;
+            memcpy(f.data(), &hdr, sizeof(Header));
+        }
+
+        if (!convertPixels(q, *reader, opts, f.data() + sizeof(Header), st))
+        {
+            err << "ERROR: Could not load image " << inPath << " (" << reader->error() << ")." << endl;
+            f.close();
+            discardOutput(outPath, 0);
+            return 1;
+        }
+
+        bytesWritten = f.size();
+        int numPages = 0;
+        if (opts.pageSize)
+        {
+            StageTimer timer(st, Stage::Write);
+            const u8* payload = f.data() + sizeof(Header);
+            size_t size = f.size() - sizeof(Header);
+            vector<pair<const u8*, size_t>> pages;
+            for (size_t offset = 0; offset < size; offset += opts.pageSize)
+            {
+                pages.push_back({ payload + offset, min(size_t(opts.pageSize), size - offset) });
+            }
+            numPages = int(pages.size());
+            if (!writePages(pages, outPath, opts, err))
+            {
+                f.close();
+                discardOutput(outPath, numPages);
+                return 1;
+            }
+            bytesWritten += size;
+        }
+        {
+            StageTimer timer(st, Stage::Write);
+            f.close();
+            if (!commitOutput(outPath, numPages, err))
+            {
+                return 1;
+            }
+        }
+    }
+
+    if (stats)
+    {
+        error_code ec;
+        u64 bytesRead = fs::file_size(inPath, ec);
+
+        local.files = 1;
+        local.width = w;
+        local.height = h;
+        local.pixels = u64(w) * h;
+        local.paletteColours = p.numColours();
+        local.bytesRead = ec ? 0 : bytesRead;
+        local.bytesWritten = bytesWritten;
+        local.seconds[int(Stage::Total)] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        stats->merge(local);
+    }
+
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// imageCommand
+
+func imageCommand(const CmdLine& cmdLine, PaletteSlot& slot, ostream& err, fs::path& outPath,
+                  optional<ConvertStats>& stats) -> int
+{
+    ImageOptions opts = imageOptions(cmdLine);
+    outPath = cmdLine.param(0);
+    outPath.replace_extension(".nim");
+    stats.reset();
+
+    Manifest manifest;
+    BuildKey key(cmdLine.param(0), cmdLine.longFlag("pal"), opts.key());
+    if (opts.incremental && manifest.upToDate(outPath, key))
+    {
+        manifest.save(err);
+        return 0;
+    }
+
+    ConvertStats convertStats;
+    if (convertImage(slot.quantiser, cmdLine.param(0), outPath, opts, err, opts.stats ? &convertStats : nullptr) != 0)
+    {
+        return 1;
+    }
+
+    if (opts.incremental)
+    {
+        manifest.record(outPath, key);
+        manifest.save(err);
+    }
+    if (opts.stats)
+    {
+        stats = convertStats;
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
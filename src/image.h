@@ -0,0 +1,134 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Image conversion
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+#include <dither.h>
+#include <palette.h>
+#include <quantise.h>
+#include <stats.h>
+#include <ostream>
+
+class CmdLine;
+class ImageReader;
+
+//----------------------------------------------------------------------------------------------------------------------
+// Layout
+// Order of the pixels in a .nim payload, for '--layout <row|column>'.  Layer 2's 320x256x8 and 640x256x4 modes store
+// pixels column by column.
+
+enum class Layout
+{
+    Row,
+    Column,
+};
+
+// Returns the layout for a '--layout' name, or nothing if the name is unknown.
+func parseLayout(const string& name) -> optional<Layout>;
+
+//----------------------------------------------------------------------------------------------------------------------
+// Compression
+// Compression of a .nim payload, for '--compress <none|zx0>'.  The values are the algorithm ids stored in NIM1 headers.
+
+enum class Compression : u8
+{
+    None,
+    Zx0,
+};
+
+// Returns the compression for a '--compress' name, or nothing if the name is unknown.
+func parseCompression(const string& name) -> optional<Compression>;
+
+//----------------------------------------------------------------------------------------------------------------------
+// ImageOptions
+// Options controlling how an image is converted to a .nim file.
+
+struct ImageOptions
+{
+    bool bit4 = false;          // Pack two 4-bit indices per byte
+    int bank = -1;              // With bit4, convert with colours 16*bank to 16*bank+15 of the palette
+    Dither dither = Dither::None;
+    Layout layout = Layout::Row;
+    int pageSize = 0;           // Also write the payload in files of this many bytes (8K pages or 16K banks)
+    Compression compression = Compression::None;
+    int jobs = 1;               // Threads used to convert a single image
+    bool incremental = false;   // Skip conversions whose inputs are unchanged
+    bool stats = false;         // Print timings and counters after converting
+    bool statsJson = false;     // Print them as JSON rather than text
+
+    // Describes the options that affect the output, for incremental builds.
+    func key() const -> string;
+};
+
+// Reads the image options from the command line.  Throws runtime_error for an unknown '--dither' mode or '--layout',
+// a '--bank' outside 0-15, a '--split' other than 8k or 16k or an unknown '--compress' algorithm.
+func imageOptions(const CmdLine& cmdLine) -> ImageOptions;
+
+//----------------------------------------------------------------------------------------------------------------------
+// PaletteSlot
+// A loaded palette and its quantiser, kept together so the quantiser's reference stays valid.  Shared by every
+// conversion that uses the palette.
+
+struct PaletteSlot
+{
+    PaletteSlot(Palette&& p) : palette(move(p)), quantiser(palette) {}
+
+    Palette palette;
+    Quantiser quantiser;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// loadPalette
+// Loads a .nip or .pal file.  An empty path gives the default palette.  Errors are written to err.
+
+func loadPalette(const string& path, ostream& err) -> optional<Palette>;
+
+//----------------------------------------------------------------------------------------------------------------------
+// paletteBank
+// Colours 16*bank to 16*bank+15 of a palette, as a palette of their own for 4-bit images that select the bank through
+// the palette offset.  The transparent index is taken modulo 16.  Returns nothing if the palette has no such bank.
+
+func paletteBank(const Palette& p, int bank) -> optional<Palette>;
+
+//----------------------------------------------------------------------------------------------------------------------
+// convertPixels
+// Reads every row of an image and converts it with the quantiser's palette, dithering as opts says, into pixels:
+// width * height bytes, or half that packed for opts.bit4, in opts.layout order.  Timings and lookup counts are added
+// to st if given.  Returns false if the image fails to decode, with the reason in reader.error().
+
+func convertPixels(Quantiser& q, ImageReader& reader, const ImageOptions& opts, u8* pixels, ConvertStats* st)
+    -> bool;
+
+//----------------------------------------------------------------------------------------------------------------------
+// convertImage
+// Loads the image at inPath, converts it with the quantiser's palette and writes a .nim file to outPath.  Errors are
+// written to err.  If stats is given, the conversion's timings and counters are added to it.  A 4-bit conversion with
+// opts.bank uses only that bank of 16 colours.  With opts.pageSize, the payload is also split into page files for
+// loading into 8K pages or 16K banks.  With opts.compression, the payload is compressed in independent blocks of one
+// page (16K without opts.pageSize) and written as a NIM1 file, and each page file holds one compressed block.  The
+// outputs only replace existing files once the conversion has succeeded.  Returns 0 on success, 1 on failure.
+
+func convertImage(Quantiser& q, const fs::path& inPath, const fs::path& outPath, const ImageOptions& opts,
+                  ostream& err, ConvertStats* stats = nullptr) -> int;
+
+//----------------------------------------------------------------------------------------------------------------------
+// imageCommand
+// Carries out an 'image' command line with a loaded palette: converts its image to <name>.nim, in outPath, with the
+// options it gives, and with -i skips the conversion if the build manifest says the output is up to date.  Errors are
+// written to err.  If a conversion ran with --stats, its stats are returned in stats.  Returns 0 on success, 1 on
+// failure.  Shared by 'nim image' and image requests to 'nim serve'.
+
+func imageCommand(const CmdLine& cmdLine, PaletteSlot& slot, ostream& err, fs::path& outPath,
+                  optional<ConvertStats>& stats) -> int;
+
+// Path of a page of the payload written for opts.pageSize: <name>_<page>.bin, numbered from 00, next to the .nim.
+func pagePath(const fs::path& outPath, int page) -> fs::path;
+
+// Minimum number of pixels per thread in an image before convertImage builds a ColourCube for its palette.  The cube
+// takes about as long to build on one thread as the SIMD search takes over this many pixels.
+inline constexpr i64 kCubeMinPixels = 256 * 1024;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
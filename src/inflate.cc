@@ -0,0 +1,394 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Streaming zlib decompression
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <inflate.h>
+#include <cstring>
+
+static const u16 kLengthBase[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const u8 kLengthExtra[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const u16 kDistBase[] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+static const u8 kDistExtra[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Input bytes read past the end of the stream before it is considered truncated.
+static const int kMaxPadding = 16;
+
+static func reverseBits(u32 v, int n) -> u32
+{
+    u32 r = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        r = (r << 1) | (v & 1);
+        v >>= 1;
+    }
+    return r;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Huffman::build
+// Builds canonical Huffman decoding tables from code lengths.  Codes up to kFastBits long decode with one table
+// lookup; longer ones are found by comparing against the left-aligned limits of each length.
+
+func Inflater::Huffman::build(const u8* lengths, int numSymbols) -> bool
+{
+    int counts[17] = {};
+    u32 nextCode[17];
+
+    memset(fast, 0, sizeof(fast));
+    for (int i = 0; i < numSymbols; ++i)
+    {
+        ++counts[lengths[i]];
+    }
+    counts[0] = 0;
+
+    u32 code = 0;
+    int symbol = 0;
+    for (int len = 1; len < 16; ++len)
+    {
+        nextCode[len] = code;
+        firstCode[len] = u16(code);
+        firstSymbol[len] = u16(symbol);
+        code += counts[len];
+        if (counts[len] && code - 1 >= (1u << len)) return false;
+        maxCode[len] = code << (16 - len);
+        code <<= 1;
+        symbol += counts[len];
+    }
+    maxCode[16] = 0x10000;
+
+    for (int i = 0; i < numSymbols; ++i)
+    {
+        int len = lengths[i];
+        if (!len) continue;
+
+        int slot = nextCode[len] - firstCode[len] + firstSymbol[len];
+        symbols[slot] = u16(i);
+        if (len <= kFastBits)
+        {
+            for (u32 j = reverseBits(nextCode[len], len); j < (1u << kFastBits); j += (1u << len))
+            {
+                fast[j] = u16((len << 9) | i);
+            }
+        }
+        ++nextCode[len];
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Constructor
+
+Inflater::Inflater(Source source)
+    : m_source(move(source))
+    , m_inPos(nullptr)
+    , m_inEnd(nullptr)
+    , m_inputEnded(false)
+    , m_padding(0)
+    , m_bitBuffer(0)
+    , m_numBits(0)
+    , m_state(State::Header)
+    , m_finalBlock(false)
+    , m_failed(false)
+    , m_storedLeft(0)
+    , m_copyLen(0)
+    , m_copyDist(0)
+    , m_window(m_windowBuffer.get<u8>(kWindowSize))
+    , m_windowPos(0)
+{
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// fill
+// Tops up the bit buffer to at least 57 bits.  Past the end of the input it shifts in zeros, but only a few bytes'
+// worth before flagging the stream as truncated.
+
+func Inflater::fill() -> void
+{
+    while (m_numBits <= 56)
+    {
+        if (m_inPos == m_inEnd)
+        {
+            const u8* data = nullptr;
+            size_t n = m_inputEnded ? 0 : m_source(data);
+            if (n == 0)
+            {
+                m_inputEnded = true;
+                if (++m_padding > kMaxPadding) m_failed = true;
+                m_numBits += 8;
+                continue;
+            }
+            m_inPos = data;
+            m_inEnd = data + n;
+        }
+
+        m_bitBuffer |= u64(*m_inPos++) << m_numBits;
+        m_numBits += 8;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// bits
+// Removes n bits (up to 32) from the stream, least significant first.
+
+func Inflater::bits(int n) -> u32
+{
+    if (m_numBits < n) fill();
+    u32 v = u32(m_bitBuffer & ((u64(1) << n) - 1));
+    m_bitBuffer >>= n;
+    m_numBits -= n;
+    return v;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// decode
+// Decodes one symbol.  Returns -1 for an invalid code.
+
+func Inflater::decode(const Huffman& h) -> int
+{
+    if (m_numBits < 16) fill();
+
+    u16 entry = h.fast[m_bitBuffer & ((1 << Huffman::kFastBits) - 1)];
+    if (entry)
+    {
+        int len = entry >> 9;
+        m_bitBuffer >>= len;
+        m_numBits -= len;
+        return entry & 511;
+    }
+
+    u32 k = reverseBits(u32(m_bitBuffer & 0xffff), 16);
+    int len = Huffman::kFastBits + 1;
+    while (k >= h.maxCode[len]) ++len;
+    if (len == 16) return -1;
+
+    int slot = (k >> (16 - len)) - h.firstCode[len] + h.firstSymbol[len];
+    m_bitBuffer >>= len;
+    m_numBits -= len;
+    return h.symbols[slot];
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// readDynamicTables
+
+func Inflater::readDynamicTables() -> bool
+{
+    static const u8 kOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    int numLengths = bits(5) + 257;
+    int numDists = bits(5) + 1;
+    int numCodeLengths = bits(4) + 4;
+
+    u8 codeLengths[19] = {};
+    for (int i = 0; i < numCodeLengths; ++i)
+    {
+        codeLengths[kOrder[i]] = u8(bits(3));
+    }
+
+    Huffman codeLengthTable;
+    if (!codeLengthTable.build(codeLengths, 19)) return false;
+
+    u8 lengths[286 + 32];
+    int n = 0;
+    while (n < numLengths + numDists)
+    {
+        int sym = decode(codeLengthTable);
+        if (sym < 0) return false;
+
+        if (sym < 16)
+        {
+            lengths[n++] = u8(sym);
+            continue;
+        }
+
+        int repeat;
+        u8 value = 0;
+        if (sym == 16)
+        {
+            if (n == 0) return false;
+            repeat = 3 + bits(2);
+            value = lengths[n - 1];
+        }
+        else if (sym == 17)
+        {
+            repeat = 3 + bits(3);
+        }
+        else
+        {
+            repeat = 11 + bits(7);
+        }
+
+        if (n + repeat > numLengths + numDists) return false;
+        memset(lengths + n, value, repeat);
+        n += repeat;
+    }
+
+    return m_lengths.build(lengths, numLengths) && m_distances.build(lengths + numLengths, numDists);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// startBlock
+
+func Inflater::startBlock() -> bool
+{
+    m_finalBlock = bits(1) != 0;
+    switch (bits(2))
+    {
+    case 0:
+        {
+            // Stored: skip to a byte boundary then read LEN and NLEN.
+            bits(m_numBits & 7);
+            u32 len = bits(16);
+            u32 nlen = bits(16);
+            if ((len ^ 0xffff) != nlen) return false;
+            m_storedLeft = len;
+            m_state = State::Stored;
+            return true;
+        }
+
+    case 1:
+        {
+            u8 lengths[288 + 32];
+            memset(lengths, 8, 144);
+            memset(lengths + 144, 9, 112);
+            memset(lengths + 256, 7, 24);
+            memset(lengths + 280, 8, 8);
+            memset(lengths + 288, 5, 32);
+            m_state = State::Compressed;
+            return m_lengths.build(lengths, 288) && m_distances.build(lengths + 288, 32);
+        }
+
+    case 2:
+        m_state = State::Compressed;
+        return readDynamicTables();
+
+    default:
+        return false;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// fail
+
+func Inflater::fail() -> size_t
+{
+    m_failed = true;
+    m_state = State::Done;
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// read
+
+func Inflater::read(u8* dst, size_t size) -> size_t
+{
+    const u64 mask = kWindowSize - 1;
+    size_t n = 0;
+
+    auto put = [&](u8 b) {
+        dst[n++] = b;
+        m_window[m_windowPos++ & mask] = b;
+    };
+
+    while (n < size)
+    {
+        if (m_failed)
+        {
+            return n + fail();
+        }
+
+        if (m_copyLen)
+        {
+            int count = int(min(size_t(m_copyLen), size - n));
+            m_copyLen -= count;
+            while (count--)
+            {
+                put(m_window[(m_windowPos - m_copyDist) & mask]);
+            }
+            continue;
+        }
+
+        switch (m_state)
+        {
+        case State::Header:
+            {
+                u32 cmf = bits(8);
+                u32 flg = bits(8);
+                if (((cmf << 8) | flg) % 31 != 0 || (cmf & 15) != 8 || (flg & 32)) return n + fail();
+                m_state = State::BlockStart;
+            }
+            break;
+
+        case State::BlockStart:
+            if (m_finalBlock)
+            {
+                m_state = State::Done;
+            }
+            else if (!startBlock())
+            {
+                return n + fail();
+            }
+            break;
+
+        case State::Stored:
+            if (m_storedLeft == 0)
+            {
+                m_state = State::BlockStart;
+            }
+            else
+            {
+                put(u8(bits(8)));
+                --m_storedLeft;
+            }
+            break;
+
+        case State::Compressed:
+            {
+                int sym = decode(m_lengths);
+                if (sym < 0) return n + fail();
+
+                if (sym < 256)
+                {
+                    put(u8(sym));
+                }
+                else if (sym == 256)
+                {
+                    m_state = State::BlockStart;
+                }
+                else
+                {
+                    sym -= 257;
+                    if (sym >= 29) return n + fail();
+                    int len = kLengthBase[sym] + bits(kLengthExtra[sym]);
+
+                    int distSym = decode(m_distances);
+                    if (distSym < 0 || distSym >= 30) return n + fail();
+                    int dist = kDistBase[distSym] + bits(kDistExtra[distSym]);
+                    if (u64(dist) > m_windowPos) return n + fail();
+
+                    m_copyLen = len;
+                    m_copyDist = dist;
+                }
+            }
+            break;
+
+        case State::Done:
+            return n;
+        }
+    }
+
+    return n;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
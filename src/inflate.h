@@ -0,0 +1,85 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Streaming zlib decompression
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+#include <scratch.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// Inflater
+// Decompresses a zlib stream (RFC 1950/1951) incrementally, keeping only the 32K history window in memory.
+// Compressed input is pulled from a source function that points data at the next block of input and returns its size,
+// or 0 at the end of the input.  The block must stay valid until the source is called again.
+
+class Inflater
+{
+public:
+    using Source = function<size_t(const u8*& data)>;
+
+    Inflater(Source source);
+
+    // Reads up to size bytes of decompressed data.  Returns fewer only at the end of the stream or on an error.
+    func read(u8* dst, size_t size) -> size_t;
+
+    func failed() const -> bool { return m_failed; }
+
+private:
+    struct Huffman
+    {
+        static const int kFastBits = 9;
+
+        func build(const u8* lengths, int numSymbols) -> bool;
+
+        u16 fast[1 << kFastBits];   // (length << 9) | symbol for codes up to kFastBits long, 0 if longer
+        u16 firstCode[17];
+        u16 firstSymbol[17];
+        u32 maxCode[18];            // Exclusive upper bound of left-aligned 16-bit codes of each length
+        u16 symbols[288];
+    };
+
+    func fill() -> void;
+    func bits(int n) -> u32;
+    func decode(const Huffman& h) -> int;
+    func startBlock() -> bool;
+    func readDynamicTables() -> bool;
+    func fail() -> size_t;
+
+private:
+    enum class State
+    {
+        Header,
+        BlockStart,
+        Stored,
+        Compressed,
+        Done,
+    };
+
+    Source m_source;
+    const u8* m_inPos;
+    const u8* m_inEnd;
+    bool m_inputEnded;
+    int m_padding;              // Zero bytes supplied after the end of the input
+
+    u64 m_bitBuffer;
+    int m_numBits;
+
+    State m_state;
+    bool m_finalBlock;
+    bool m_failed;
+    u32 m_storedLeft;
+    int m_copyLen;
+    int m_copyDist;
+
+    Huffman m_lengths;
+    Huffman m_distances;
+
+    static const int kWindowSize = 32768;
+    ScratchBuffer m_windowBuffer;
+    u8* m_window;
+    u64 m_windowPos;            // Total bytes output so far
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,318 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Parallel job execution
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <cmdline.h>
+#include <jobs.h>
+#include <platform.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// numJobs
+
+func numJobs(const CmdLine& cmdLine, int defaultJobs) -> int
+{
+    auto jobsStr = cmdLine.longFlag("jobs");
+    int jobs = jobsStr.empty() ? defaultJobs : stoi(jobsStr);
+
+    if (jobs <= 0)
+    {
+        jobs = max(1, int(thread::hardware_concurrency()));
+    }
+
+    return jobs;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// BandThreads
+// The threads parallelFor runs its bands on, parked between calls.  Bands must all run at once (error diffusion has
+// each band wait on the one before), so a band is never queued behind other work as on a ThreadPool: it takes an idle
+// thread, or starts a new one if every thread is busy.
+
+class BandThreads
+{
+public:
+    ~BandThreads()
+    {
+        {
+            lock_guard<mutex> guard(m_lock);
+            m_stop = true;
+            for (auto& w : m_workers) w->wake.notify_one();
+        }
+        for (auto& w : m_workers) w->t.join();
+    }
+
+    // Runs job on a thread of its own.
+    func start(function<void()> job) -> void
+    {
+        lock_guard<mutex> guard(m_lock);
+        if (m_idle.empty())
+        {
+            m_workers.push_back(make_unique<Worker>());
+            Worker* w = m_workers.back().get();
+            w->job = move(job);
+            w->t = thread([this, w] { run(w); });
+            return;
+        }
+
+        Worker* w = m_idle.back();
+        m_idle.pop_back();
+        w->job = move(job);
+        w->wake.notify_one();
+    }
+
+private:
+    struct Worker
+    {
+        thread t;
+        condition_variable wake;
+        function<void()> job;
+    };
+
+    func run(Worker* w) -> void
+    {
+        unique_lock<mutex> guard(m_lock);
+        for (;;)
+        {
+            w->wake.wait(guard, [&] { return m_stop || w->job; });
+            if (!w->job) return;
+
+            function<void()> job = move(w->job);
+            w->job = nullptr;
+            guard.unlock();
+            job();
+            guard.lock();
+            m_idle.push_back(w);
+        }
+    }
+
+private:
+    mutex m_lock;
+    vector<unique_ptr<Worker>> m_workers;
+    vector<Worker*> m_idle;
+    bool m_stop = false;
+};
+
+static func bandThreads() -> BandThreads&
+{
+    static BandThreads threads;
+    return threads;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// parallelFor
+
+func parallelFor(int count, int numJobs, function<void(int begin, int end)> fn) -> void
+{
+    int numBands = min(count, numJobs);
+    if (numBands <= 1)
+    {
+        if (count > 0) fn(0, count);
+        return;
+    }
+
+    // Bands other than the first count themselves off here.  The last one notifies while holding the lock, so this
+    // frame can't be gone before it lets go.
+    mutex lock;
+    condition_variable finished;
+    int remaining = numBands - 1;
+    exception_ptr error;
+
+    for (int band = 1; band < numBands; ++band)
+    {
+        int begin = int(i64(count) * band / numBands);
+        int end = int(i64(count) * (band + 1) / numBands);
+        bandThreads().start([&, begin, end] {
+            exception_ptr bandError;
+            try
+            {
+                fn(begin, end);
+            }
+            catch (...)
+            {
+                bandError = current_exception();
+            }
+
+            lock_guard<mutex> guard(lock);
+            if (bandError && !error) error = bandError;
+            if (--remaining == 0) finished.notify_all();
+        });
+    }
+
+    exception_ptr firstError;
+    try
+    {
+        fn(0, int(i64(count) / numBands));
+    }
+    catch (...)
+    {
+        firstError = current_exception();
+    }
+
+    {
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&] { return remaining == 0; });
+        if (!firstError) firstError = error;
+    }
+    if (firstError) rethrow_exception(firstError);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// ThreadPool
+//----------------------------------------------------------------------------------------------------------------------
+
+// The pool the current thread works for, if any, and the index of its queue in that pool.
+static thread_local const ThreadPool* tl_workerPool = nullptr;
+static thread_local int tl_workerIndex = -1;
+
+ThreadPool::ThreadPool(int numThreads)
+    : m_queued(0)
+    , m_pending(0)
+    , m_nextQueue(0)
+    , m_failed(0)
+    , m_stop(false)
+    , m_pinThreads(numThreads > 1 && numThreads == int(thread::hardware_concurrency()))
+{
+    numThreads = max(1, numThreads);
+    for (int i = 0; i < numThreads; ++i)
+    {
+        m_queues.emplace_back(make_unique<Queue>());
+    }
+    for (int i = 0; i < numThreads; ++i)
+    {
+        m_threads.emplace_back([this, i] { run(i); });
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Destructor
+// Finishes all outstanding jobs before stopping the workers.
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (auto& t : m_threads)
+    {
+        t.join();
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// submit
+
+func ThreadPool::submit(Job job) -> void
+{
+    // A job running on another pool's worker is dealt out like any other thread's.
+    int index = tl_workerPool == this ? tl_workerIndex : -1;
+    if (index < 0)
+    {
+        lock_guard<mutex> guard(m_lock);
+        index = m_nextQueue;
+        m_nextQueue = (m_nextQueue + 1) % numThreads();
+    }
+
+    {
+        lock_guard<mutex> guard(m_queues[index]->lock);
+        m_queues[index]->jobs.push_back(move(job));
+    }
+    {
+        lock_guard<mutex> guard(m_lock);
+        ++m_queued;
+        ++m_pending;
+    }
+    m_wake.notify_one();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// wait
+// Blocks until every submitted job has finished.  Must not be called from a job.
+
+func ThreadPool::wait() -> void
+{
+    unique_lock<mutex> guard(m_lock);
+    m_idle.wait(guard, [this] { return m_pending == 0; });
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// take
+// Pops a job from the back of our own queue, or steals one from the front of another.
+
+func ThreadPool::take(int index, Job& job) -> bool
+{
+    {
+        Queue& own = *m_queues[index];
+        lock_guard<mutex> guard(own.lock);
+        if (!own.jobs.empty())
+        {
+            job = move(own.jobs.back());
+            own.jobs.pop_back();
+            return true;
+        }
+    }
+
+    for (int i = 1; i < numThreads(); ++i)
+    {
+        Queue& victim = *m_queues[(index + i) % numThreads()];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.jobs.empty())
+        {
+            job = move(victim.jobs.front());
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// run
+// Worker thread loop.  A worker only looks for a job after claiming one from m_queued, so a job is always there to
+// be found.
+
+func ThreadPool::run(int index) -> void
+{
+    tl_workerPool = this;
+    tl_workerIndex = index;
+    if (m_pinThreads)
+    {
+        pinThread(index);
+    }
+
+    for (;;)
+    {
+        {
+            unique_lock<mutex> guard(m_lock);
+            m_wake.wait(guard, [this] { return m_stop || m_queued > 0; });
+            if (m_queued == 0) return;
+            --m_queued;
+        }
+
+        Job job;
+        while (!take(index, job)) {}
+        try
+        {
+            job();
+        }
+        catch (...)
+        {
+            ++m_failed;
+        }
+
+        bool idle;
+        {
+            lock_guard<mutex> guard(m_lock);
+            idle = (--m_pending == 0);
+        }
+        if (idle) m_idle.notify_all();
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
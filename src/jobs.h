@@ -0,0 +1,82 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Parallel job execution
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class CmdLine;
+
+//----------------------------------------------------------------------------------------------------------------------
+// numJobs
+// Returns the number of worker threads requested via '--jobs <n>'.  0 means one per hardware thread.  Without the
+// flag, defaultJobs is used.
+
+func numJobs(const CmdLine& cmdLine, int defaultJobs = 1) -> int;
+
+//----------------------------------------------------------------------------------------------------------------------
+// parallelFor
+// Splits the range [0, count) into at most numJobs contiguous bands and calls fn(begin, end) for each band
+// concurrently.  Returns once every band has completed.  The calling thread processes the first band itself, and the
+// others run on threads kept parked between calls, so calling this for every band of an image is cheap.  If any band
+// throws, the exception is rethrown here once all bands have finished.
+
+func parallelFor(int count, int numJobs, function<void(int begin, int end)> fn) -> void;
+
+//----------------------------------------------------------------------------------------------------------------------
+// ThreadPool
+// A fixed set of worker threads, each with its own job queue.  Workers take jobs from the back of their own queue and
+// steal from the front of other workers' queues when theirs is empty, so uneven jobs balance out.  Jobs submitted
+// from a worker go onto that worker's queue; others are dealt out round robin.  A pool with one worker per hardware
+// thread pins each worker to its own CPU, keeping its caches and scratch buffers warm.  A job that throws is counted
+// as failed rather than ending the process.
+
+class ThreadPool
+{
+public:
+    using Job = function<void()>;
+
+    ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    func numThreads() const -> int { return int(m_threads.size()); }
+
+    func submit(Job job) -> void;
+    func wait() -> void;
+
+    // Number of jobs that have thrown an exception so far.
+    func numFailed() const -> int { return m_failed; }
+
+private:
+    struct Queue
+    {
+        mutex lock;
+        deque<Job> jobs;
+    };
+
+    func run(int index) -> void;
+    func take(int index, Job& job) -> bool;
+
+private:
+    vector<unique_ptr<Queue>> m_queues;
+    vector<thread> m_threads;
+    mutex m_lock;
+    condition_variable m_wake;
+    condition_variable m_idle;
+    i64 m_queued;               // Jobs sitting in queues not yet claimed by a worker
+    i64 m_pending;              // Jobs submitted but not yet finished
+    int m_nextQueue;
+    atomic<int> m_failed;
+    bool m_stop;
+    bool m_pinThreads;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
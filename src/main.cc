@@ -10,6 +10,13 @@
 //
 //      palette <filename.pal>              Generate a .nip file (Next Image Palette)
 //      palette -d <filename.nip>           Generate a RRRGGGBB palette as a .nip file
+//      palette --from <inputs...>          Generate a palette for images (as for batch) by median cut and k-means
+//          --colours <n>                       Palette size, including the transparent entry (default 256)
+//          --out <filename.nip>                Output file (default palette.nip)
+//          --banks <n>                         Generate up to n banks of 16 colours for 4-bit sprites instead, listing
+//                                              each sprite's bank in <filename>.banks
+//          --jobs <n>                          Number of images to read at once (0 = one per core, default)
+//          -r                                  Search directories recursively
 //
 //      Shared flags:
 //          -9                          Use 9-bit palettes
@@ -17,9 +24,63 @@
 //
 //      image <filename.ext>                Generate a .nim file.  Supports many image formats.
 //          --pal <filename.nip/pal>            Define the palette to use in conversion (otherwise uses default palette)
+//          --jobs <n>                          Number of threads to convert with (0 = one per core, default 1)
+//          --bank <n>                          With -4, convert with colours 16n to 16n+15 of the palette
+//          --layout <row|column>               Order of the pixels (default row).  Column suits Layer 2's 320x256x8
+//                                              and 640x256x4 modes, whose bytes run down each column
+//          --split <8k|16k>                    Also write the pixel data in 8K page or 16K bank sized files,
+//                                              <name>_00.bin, <name>_01.bin... ready to load into the Next's memory
+//          --compress <none|zx0>               Compress the pixel data with ZX0 in independent blocks of one page
+//                                              (16K without --split) and write a NIM1 file.  Each page file then
+//                                              holds one compressed block
+//          --dither <mode>                     Dither with a Bayer matrix (bayer2, bayer4, bayer8) or by error
+//                                              diffusion (floyd, atkinson, sierra-lite).  Default none
+//          -i                                  Incremental: skip images whose inputs and options are unchanged since
+//                                              they were last converted (tracked in .nim-manifest files)
+//          --stats                             Print stage timings, pixel, byte and lookup counts and peak memory
+//          --stats-format <text|json>          Format of the stats (default text)
+//
+//      batch <inputs...>                   Generate .nim files for many images (files, directories, wildcards or
+//                                          @manifest files).  Accepts the image flags and:
+//          --out <directory>                   Write the .nim files to this directory
+//          -r                                  Search directories recursively
+//
+//      tiles <filename.ext>                Generate 4-bit 8x8 tiles (.nit) and a tilemap (.ntm), storing repeated tiles
+//                                          once.  Accepts --pal, --bank, --dither and --jobs (default one per core)
+//                                          and:
+//          -m                                  Also match mirrored and rotated tiles
+//
+//      sprites <filename.ext>              Generate 16x16 sprite patterns (.spr, in sprite RAM order) from a sheet,
+//                                          skipping empty cells, and list the sprites in a .sprites file.  Accepts -4,
+//                                          --pal, --bank, --dither and --jobs (default one per core) and:
+//          --grid <w>x<h>                      Size of the sheet's cells, multiples of 16 (default 16x16)
+//          -a                                  Find sprites by their transparent surroundings instead of a grid
+//
+//      anim <frames...>                    Generate a .nan delta stream from a sequence of frames (files,
+//                                          directories, wildcards or @manifest files, in order), converted through
+//                                          one palette.  Animated GIFs and APNGs give all of their frames.  Accepts
+//                                          --pal, -4, --bank, --dither, --layout, --jobs (default one per core) and
+//                                          -r, and:
+//          --out <filename.nan>                Output file (default: the first frame's name with .nan)
+//
+//      serve                               Read commands (e.g. 'image x.png -4') from stdin, one per line, replying
+//                                          'OK <file>' or 'ERROR <message>'.  Palettes stay loaded between requests
+//
+//      bench [<filter>]                    Time the conversion stages on generated images
+//          --reps <n>                          Number of timed runs per stage (default 20)
+//          --jobs <n>, --pal <filename>        As for image
 //
 //----------------------------------------------------------------------------------------------------------------------
 
+//----------------------------------------------------------------------------------------------------------------------
+// B U I L D I N G
+//----------------------------------------------------------------------------------------------------------------------
+//
+// Windows:     forge (see forge.ini)
+// Linux:       g++ -std=c++17 -O2 -pthread -Wno-multichar -Isrc src/*.cc -o nim
+//
+// Operating system specifics are kept to platform.cc and mapping.cc.
+//
 //----------------------------------------------------------------------------------------------------------------------
 // F I L E   F O R M A T S
 //----------------------------------------------------------------------------------------------------------------------
@@ -47,240 +108,83 @@
 //
 // N = 1 byte * Width * Height or 0.5 byte * width * height
 //
+// Pixels are stored row by row, or with '--layout column' column by column as Layer 2's 320x256 and 640x256 modes
+// expect.  In 4-bit images each byte column holds two pixels, the left one in the high nibble.
+//
+// Images converted with '--compress' are NIM1 files instead:
+//
+//  Offset  Length  Description
+//  0       4       "NIM1" - tag identifying file format and version
+//  4       2       Width (little endian)
+//  6       2       Height (little endian)
+//  8       1       Flags (bit 0: pixel data is compressed)
+//  9       1       Compression algorithm (1 = ZX0)
+//  10      2       Block size (little endian)
+//  12      2       Number of blocks, B (little endian)
+//  14      2*B     Compressed size of each block (little endian)
+//  14+2*B  -       Compressed blocks
+//
+// The pixel data, laid out as for NIM0, is cut into blocks of the block size (the last may be shorter) and each block
+// is compressed on its own, so it can be unpacked straight into its 8K page or 16K bank.  ZX0 blocks use the forward
+// format with 2.x offsets that the standard Z80 routine dzx0_standard.asm unpacks.
+//
 //----------------------------------------------------------------------------------------------------------------------
-
-
-#include <core.h>
-#include <cassert>
-#include <cmdline.h>
-#include <iostream>
-#include <fstream>
-#include <filesystem>
-
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
-
-namespace fs = std::filesystem;
-
+// N A N   F I L E   F O R M A T
 //----------------------------------------------------------------------------------------------------------------------
-// Utilties
+//  Offset  Length  Description
+//  0       4       "NAN0" - tag identifying file format and version
+//  4       2       Width (little endian)
+//  6       2       Height (little endian)
+//  8       2       Number of frames (little endian)
+//  10      1       Flags (bit 0: 4-bit pixels, bit 1: column layout)
+//  11      -       Frames
+//
+// Each frame is a 4-byte size (little endian) followed by that many bytes of spans.  A span is a 2-byte count of bytes
+// to leave unchanged since the end of the previous span (or the start of the frame), a 2-byte length N and then N
+// bytes of pixel data to write, all little endian.  Pixel data is laid out as in a NIM0 file.  The first frame
+// writes every byte; later ones only write the bytes that changed since the frame before, and a few unchanged bytes
+// between changes.  Spans with a length of 0 only skip.
+//
 //----------------------------------------------------------------------------------------------------------------------
-
-static int kColour_3bit[] = { 0, 36, 73, 109, 146, 182, 219, 255 };
-static int kColour_2bit[] = { 0, 85, 170, 255 };
-
-func gfxReduce3(u8 v) -> u8
-{
-    int minIdx = 0;
-    int minDiff = 255;
-
-    for (int i = 0; i < 8; ++i)
-    {
-        int diff = abs((int)v - (int)kColour_3bit[i]);
-        if (0 == diff)
-        {
-            minIdx = i;
-            break;
-        }
-        if (diff < minDiff)
-        {
-            minDiff = diff;
-            minIdx = i;
-        }
-    }
-
-    return (u8)minIdx;
-}
-
-func gfxReduce2(u8 v) -> u8
-{
-    int minIdx = 0;
-    int minDiff = 255;
-
-    for (int i = 0; i < 4; ++i)
-    {
-        int diff = abs((int)v - (int)kColour_2bit[i]);
-        if (0 == diff)
-        {
-            minIdx = i;
-            break;
-        }
-        if (diff < minDiff)
-        {
-            minDiff = diff;
-            minIdx = i;
-        }
-    }
-
-    return (u8)minIdx;
-}
-
-
+// N I T   F I L E   F O R M A T
 //----------------------------------------------------------------------------------------------------------------------
-// Data structures
+//  Offset  Length  Description
+//  0       4       "NIT0" - tag identifying file format and version
+//  4       2       Number of tiles (little endian)
+//  6       N       Tile data
+//
+// N = 32 bytes * number of tiles.  Each tile is 8x8 4-bit pixels, row by row, with the left pixel of each pair in the
+// high nibble.
+//
+//----------------------------------------------------------------------------------------------------------------------
+// N T M   F I L E   F O R M A T
+//----------------------------------------------------------------------------------------------------------------------
+//  Offset  Length  Description
+//  0       4       "NTM0" - tag identifying file format and version
+//  4       2       Width in tiles (little endian)
+//  6       2       Height in tiles (little endian)
+//  8       N       Tilemap entries
+//
+// N = 2 bytes * Width * Height, row by row, in the Next's tilemap format.  The first byte is bits 0-7 of the tile
+// number.  The second has bit 8 of the tile number in bit 0, rotate (clockwise, before mirroring) in bit 1, Y mirror
+// in bit 2, X mirror in bit 3 and the palette offset in bits 4-7.
+//
 //----------------------------------------------------------------------------------------------------------------------
 
-struct Colour
-{
-    Colour(u8 red, u8 green, u8 blue) : m_red(red), m_green(green), m_blue(blue) {}
-    Colour() : Colour(0, 0, 0) {}
-
-    u8 m_red;
-    u8 m_green;
-    u8 m_blue;
-};
-
-class Palette
-{
-public:
-    Palette()
-        : m_transparentColour(0xe3)
-    {
-        for (int i = 0; i < 256; ++i)
-        {
-            u8 r = (i & 0xe0) >> 5;
-            u8 g = (i & 0x1c) >> 2;
-            u8 b = ((i & 0x03) << 1) + (((i & 0x02) >> 1) | (i & 0x01));
-
-            m_colours.push_back(Colour(r, g, b));
-        }
-    }
-
-    Palette(ifstream& f)
-        : m_transparentColour(0xe3)
-    {
-        vector<Colour> colours;
-
-        u32 tag;
-        f.read((char *)&tag, 4);
-        if (tag == '0PIN')
-        {
-            // .NIP file
-            u8 numColours;
-            u8 flags;
-
-            f.read((char *)&numColours, 1);
-            f.read((char *)&flags, 1);
-
-            int actualNumColours = numColours ? numColours : 256;
-            for (int i = 0; i < actualNumColours; ++i)
-            {
-                u8 p1, p2;
-                f.read((char *)&p1, 1);
-                if (flags & 1)
-                {
-                    f.read((char *)&p2, 1);
-                }
-                else
-                {
-                    p2 = ((p1 & 2) >> 1) | (p1 & 1);
-                }
-
-                u8 r = ((p1 & 0xe0) >> 5);
-                u8 g = ((p1 & 0x1c) >> 2);
-                u8 b = ((p1 & 0x03) << 1) | (p2 & 1);
-
-                colours.push_back(Colour(r, g, b));
-            }
-
-            f.read((char *)&m_transparentColour, 1);
-        }
-        else
-        {
-            f.seekg(0, ios::beg);
-
-            string line;
-            f >> line;
-            if (line == "JASC-PAL")
-            {
-                f >> line;
-                if (line == "0100")
-                {
-                    f >> line;
-                    size_t num = size_t(stoi(line));
-
-                    int i = 0;
-                    while (!f.eof())
-                    {
-                        int red, green, blue;
-                        f >> red >> green >> blue;
-
-                        if (red < 0 || red > 255 ||
-                            green < 0 || green > 255 ||
-                            blue < 0 || blue > 255)
-                        {
-                            cerr << "ERROR: Invalid .pal file" << endl;
-                            return;
-                        }
-
-                        colours.emplace_back(gfxReduce3(u8(red)), gfxReduce3(u8(green)), gfxReduce3(u8(blue)));
-
-                        if (++i == num) break;
-                    }
-
-                    if (num != colours.size())
-                    {
-                        cerr << "ERROR: Invalid number of colours found in the palette." << endl;
-  
-                        //#todo: truncate or expand with black rather than error?
-                        return;
-                    }
-                }
-            }
-        }
-
-
-        m_colours = move(colours);
-    }
-
-    func numColours() const -> int{ return int(m_colours.size()); }
-
-    func operator[] (int i) const -> const Colour& { return m_colours[i]; }
-
-    func getTransColour() const -> u8 { return m_transparentColour; }
-
-    func write(ofstream& f, bool extended) const -> bool
-    {
-        struct Header
-        {
-            char id[4];
-            u8 numColours;
-            u8 flags;
-        };
-
-        Header h;
-        h.id[0] = 'N';
-        h.id[1] = 'I';
-        h.id[2] = 'P';
-        h.id[3] = '0';
-        h.numColours = u8(m_colours.size() & 0xff);
-        h.flags = extended ? 1 : 0;
-
-        f.write((char *)&h, sizeof(h));
-
-        for (const auto& colour : m_colours)
-        {
-            u8 p1 = ((colour.m_red) << 5) | ((colour.m_green) << 2) | ((colour.m_blue >> 1));
-            u8 p2 = (colour.m_blue & 1);
-
-            f.write((char *)&p1, 1);
-            if (extended) f.write((char *)&p2, 1);
-        }
-
-        f.write((char *)&m_transparentColour, 1);
-
-        return 0;
-    }
-
-    func setTransparent(u8 index) -> void
-    {
-        m_transparentColour = index;
-    }
 
-private:
-    vector<Colour> m_colours;
-    u8 m_transparentColour;
-};
+#include <core.h>
+#include <anim.h>
+#include <batch.h>
+#include <bench.h>
+#include <cmdline.h>
+#include <image.h>
+#include <palette.h>
+#include <palgen.h>
+#include <serve.h>
+#include <sprites.h>
+#include <tiles.h>
+#include <iostream>
+#include <fstream>
 
 //----------------------------------------------------------------------------------------------------------------------
 // Palette command handler
@@ -301,37 +205,20 @@ func write_palette(const Palette& p, fs::path outPath, bool extended) -> int
 
 //----------------------------------------------------------------------------------------------------------------------
 
-func indexStr(const string& str) -> u8
+func palette_handler(const CmdLine& cmdLine) -> int
 {
-    if (str[0] == '$')
+    if (cmdLine.hasLongFlag("from"))
     {
-        // hex string
-        u8 t = 0;
-        for (auto c : str)
-        {
-            if (c >= '0' && c <= '9') { t <<= 4; t += (c - '0'); }
-            if (c >= 'a' && c <= 'f') { t <<= 4; t += (c - 'a' + 10); }
-            if (c >= 'A' && c <= 'F') { t <<= 4; t += (c - 'A' + 10); }
-        }
-
-        return t;
+        return palette_from_handler(cmdLine);
     }
-    else
-    {
-        return u8(stoi(str));
-    }
-}
 
-//----------------------------------------------------------------------------------------------------------------------
-
-func palette_handler(const CmdLine& cmdLine) -> int
-{
     if (cmdLine.numParams() != 1)
     {
         cerr << "ERROR: Invalid parameters." << endl;
         cerr << "Syntax: " << endl
             << "    nim palette <filename.pal>  - Generate .nip file." << endl
-            << "    nim palette --default       - Generate default RRRGGGBB palette." << endl;
+            << "    nim palette --default       - Generate default RRRGGGBB palette." << endl
+            << "    nim palette --from <images> - Generate a palette for a set of images." << endl;
         return 1;
     }
 
@@ -380,138 +267,6 @@ func palette_handler(const CmdLine& cmdLine) -> int
 // Image command handler
 //----------------------------------------------------------------------------------------------------------------------
 
-func process_image(const Palette& p, const CmdLine& cmdLine) -> int
-{
-    int w, h, bpp;
-    fs::path path = cmdLine.param(0);
-
-    u32* img = (u32 *)stbi_load(path.string().c_str(), &w, &h, &bpp, 4);
-    if (!img)
-    {
-        cerr << "ERROR: Could not load image " << path << endl;
-        return 1;
-    }
-    vector<u8> dst;
-    bool bit4 = false;
-
-    if (cmdLine.flag('4'))
-    {
-        if (p.numColours() > 16)
-        {
-            cerr << "ERROR: Invalid palette for 4-bit mode.  Must be 16 colours or less." << endl;
-            return 1;
-        }
-
-        if (w % 2 == 1)
-        {
-            cerr << "ERROR: Width must be a multiple of 2 for 4-bit mode." << endl;
-            return 1;
-        }
-
-        bit4 = true;
-    }
-
-    // Convert image
-    u32* s = img;
-    for (int row = 0; row < h; ++row)
-    {
-        u8 idx = 0;
-
-        for (int col = 0; col < w; ++col)
-        {
-            u8 a = (*s & 0xff000000) >> 24;
-            u8 b = (*s & 0x00ff0000) >> 16;
-            u8 g = (*s & 0x0000ff00) >> 8;
-            u8 r = (*s & 0x000000ff);
-
-            u8 x;   // Final index value
-
-            if (a != 255)
-            {
-                x = p.getTransColour();
-            }
-            else
-            {
-                float p0[3] = { float(r), float(g), float(b) };
-                float d = 256 * 256 * 256;
-
-                for (int i = 0; i < p.numColours(); ++i)
-                {
-                    if (i == p.getTransColour()) continue;
-
-                    float p1[3] = { float(kColour_3bit[p[i].m_red]), float(kColour_3bit[p[i].m_green]), float(kColour_3bit[p[i].m_blue]) };
-
-                    float dx = p1[0] - p0[0];
-                    float dy = p1[1] - p0[1];
-                    float dz = p1[2] - p0[2];
-                    float dist = (dx*dx + dy * dy + dz * dz);
-
-                    if (dist < d)
-                    {
-                        d = dist;
-                        x = i;
-                    }
-                }
-            }
-
-            if (bit4)
-            {
-                if (col % 2 == 0)
-                {
-                    // First nibble
-                    idx = (x << 4);
-                }
-                else
-                {
-                    idx = idx + x;
-                    dst.push_back(idx);
-                }
-            }
-            else
-            {
-                dst.push_back(x);
-            }
-
-            ++s;
-        }
-    }
-
-    assert((!bit4 && (dst.size() == w * h)) || (bit4 && (dst.size() == (w * h / 2))));
-
-    fs::path outPath = cmdLine.param(0);
-    outPath.replace_extension(".nim");
-    ofstream f(outPath, ios::binary | ios::trunc);
-    if (f)
-    {
-        struct Header
-        {
-            char id[4];
-            u16 width;
-            u16 height;
-        };
-
-        Header hdr;
-        hdr.id[0] = 'N';
-        hdr.id[1] = 'I';
-        hdr.id[2] = 'M';
-        hdr.id[3] = '0';
-        hdr.width = w;
-        hdr.height = h;
-        f.write((char *)&hdr, sizeof(Header));
-        f.write((char *)dst.data(), dst.size());
-        f.close();
-    }
-    else
-    {
-        cerr << "ERROR: Unable to open " << outPath << endl;
-        return 1;
-    }
-
-    return 0;
-}
-
-//----------------------------------------------------------------------------------------------------------------------
-
 func image_handler(const CmdLine& cmdLine) -> int
 {
     if (cmdLine.numParams() != 1)
@@ -521,35 +276,35 @@ func image_handler(const CmdLine& cmdLine) -> int
             << "    nim image <options> <filename.ext>  - Generate .nim file." << endl
             << endl
             << "Options:" << endl
-            << "    --pal <filename.nip/.pal>   - Define palette to use in conversion." << endl;
+            << "    --pal <filename.nip/.pal>   - Define palette to use in conversion." << endl
+            << "    --bank <n>                  - With -4, convert with the palette's nth bank of 16 colours." << endl
+            << "    --jobs <n>                  - Convert using n threads (0 = one per core)." << endl
+            << "    --dither <mode>             - none, bayer2, bayer4, bayer8, floyd, atkinson or sierra-lite." << endl
+            << "    --layout <row|column>       - Store pixels row by row (default) or column by column." << endl
+            << "    --split <8k|16k>            - Also write the pixels as <name>_<n>.bin files of 8K or 16K." << endl
+            << "    --compress <none|zx0>       - Compress the pixels with ZX0, one block per page." << endl
+            << "    -i                          - Incremental: skip if the image, palette and options are unchanged." << endl
+            << "    --stats                     - Print stage timings and counters." << endl
+            << "    --stats-format <text|json>  - Print stats as text (default) or JSON." << endl;
         return 1;
     }
 
-    auto palStr = cmdLine.longFlag("pal");
-    u8 transparentIndex = 0xe3;
-
-    if (!palStr.empty())
+    auto p = loadPalette(cmdLine.longFlag("pal"), cerr);
+    if (!p)
     {
-        ifstream f(palStr, ios::binary);
-        if (f.is_open())
-        {
-            Palette p(f);
-            return process_image(p, cmdLine);
-        }
-        else
-        {
-            cerr << "ERROR: Cannot file '" << palStr << "'." << endl;
-            return 1;
-        }
+        return 1;
     }
-    else
+
+    PaletteSlot slot(move(*p));
+    fs::path outPath;
+    optional<ConvertStats> stats;
+    int result = imageCommand(cmdLine, slot, cerr, outPath, stats);
+    if (result == 0 && stats)
     {
-        Palette p;
-        return process_image(p, cmdLine);
+        printStats(cout, *stats, imageOptions(cmdLine).statsJson);
     }
 
-
-    return 0;
+    return result;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -568,6 +323,31 @@ func format_handler(const CmdLine& cmdLine) -> int
         << "    6       2       Height (little endian)." << endl
         << "    8       -       Pixel data (width*height bytes)." << endl
         << endl
+        << "NIM (compressed with --compress)" << endl
+        << "--------------------------------" << endl
+        << "    Offset  Length  Description" << endl
+        << "    ------  ------  -----------" << endl
+        << "    0       4       \"NIM1\" tag identifying file format and version." << endl
+        << "    4       2       Width (little endian)." << endl
+        << "    6       2       Height (little endian)." << endl
+        << "    8       1       Flags (bit 0: pixel data is compressed)." << endl
+        << "    9       1       Compression algorithm (1 = ZX0)." << endl
+        << "    10      2       Block size (little endian)." << endl
+        << "    12      2       Number of blocks, B (little endian)." << endl
+        << "    14      2*B     Compressed size of each block (little endian)." << endl
+        << "    14+2*B  -       Compressed blocks, each unpacking to one block of pixel data." << endl
+        << endl
+        << "NAN" << endl
+        << "---" << endl
+        << "    Offset  Length  Description" << endl
+        << "    ------  ------  -----------" << endl
+        << "    0       4       \"NAN0\" tag identifying file format and version." << endl
+        << "    4       2       Width (little endian)." << endl
+        << "    6       2       Height (little endian)." << endl
+        << "    8       2       Number of frames (little endian)." << endl
+        << "    10      1       Flags (bit 0: 4-bit pixels, bit 1: column layout)." << endl
+        << "    11      -       Frames: a 4-byte size, then spans of a 2-byte skip, a 2-byte length N and N bytes." << endl
+        << endl
         << "NIP" << endl
         << "---" << endl
         << "    Offset  Length  Description" << endl
@@ -577,6 +357,23 @@ func format_handler(const CmdLine& cmdLine) -> int
         << "    5       1       Flags (bit 0: 0=8-bit, 1=9-bit)." << endl
         << "    6       N       Palette data (1 or 2 * number of colours)." << endl
         << "    6+N     1       Transparency colour." << endl
+        << endl
+        << "NIT" << endl
+        << "---" << endl
+        << "    Offset  Length  Description" << endl
+        << "    ------  ------  -----------" << endl
+        << "    0       4       \"NIT0\" tag identifying file format and version." << endl
+        << "    4       2       Number of tiles (little endian)." << endl
+        << "    6       -       Tile data (32 bytes of 4-bit pixels per 8x8 tile)." << endl
+        << endl
+        << "NTM" << endl
+        << "---" << endl
+        << "    Offset  Length  Description" << endl
+        << "    ------  ------  -----------" << endl
+        << "    0       4       \"NTM0\" tag identifying file format and version." << endl
+        << "    4       2       Width in tiles (little endian)." << endl
+        << "    6       2       Height in tiles (little endian)." << endl
+        << "    8       -       Tilemap entries (2 bytes each, in the Next's tilemap format)." << endl
         << endl;
 
     return 0;
@@ -588,13 +385,33 @@ func format_handler(const CmdLine& cmdLine) -> int
 
 func main(int argc, char** argv) -> int
 {
-    CmdLine cmdLine(argc, argv);
+    CmdLine cmdLine(argc, argv, kNimSwitches);
 
     cmdLine.addCommand("palette", palette_handler);
     cmdLine.addCommand("image", image_handler);
+    cmdLine.addCommand("batch", batch_handler);
+    cmdLine.addCommand("tiles", tiles_handler);
+    cmdLine.addCommand("sprites", sprites_handler);
+    cmdLine.addCommand("anim", anim_handler);
+    cmdLine.addCommand("bench", bench_handler);
+    cmdLine.addCommand("serve", [](const CmdLine& c) {
+        return serve_handler(c, { { "palette", palette_handler }, { "batch", batch_handler } });
+    });
     cmdLine.addCommand("format", format_handler);
 
-    if (cmdLine.dispatch() == -1)
+    // Handlers throw for malformed option values, e.g. '--jobs x' or an unknown dither mode.
+    int result;
+    try
+    {
+        result = cmdLine.dispatch();
+    }
+    catch (const exception& e)
+    {
+        cerr << "ERROR: " << e.what() << endl;
+        return 1;
+    }
+
+    if (result == -1)
     {
         cerr << "ERROR: Unknown command." << endl << endl;
 
@@ -602,16 +419,57 @@ func main(int argc, char** argv) -> int
             << "Commands:" << endl
             << "    palette <flags> <filename.pal>     Generate a .nip file" << endl
             << "    palette <flags> -d <filename.nip>  Generate a default RRRGGGBB palette" << endl
+            << "    palette <flags> --from <inputs...> Generate a palette for a set of images" << endl
             << "    image <flags> <filename.ext>       Generate a .nim file from source image" << endl
+            << "    batch <flags> <inputs...>          Generate .nim files from many images" << endl
+            << "    tiles <flags> <filename.ext>       Generate tiles and a tilemap from source image" << endl
+            << "    sprites <flags> <filename.ext>     Generate sprite patterns from a sprite sheet" << endl
+            << "    anim <flags> <frames...>           Generate a delta stream from frames or animated GIFs/PNGs" << endl
+            << "    bench <flags> [<filter>]           Benchmark the conversion stages" << endl
+            << "    serve                              Convert requests read from stdin, keeping palettes loaded" << endl
             << "    format                             Show formats" << endl << endl
             << "palette flags:" << endl
             << "    -9                                 Use 9-bit palettes (RRRGGGBBB)" << endl
             << "    --transparent <colour>             Set transparency colour (index only)" << endl
+            << "    --colours <n>                      With --from: palette size (default 256)" << endl
+            << "    --out <filename.nip>               With --from: output file (default palette.nip)" << endl
+            << "    --banks <n>                        With --from: up to n 16-colour banks for 4-bit sprites" << endl
             << "image flags:" << endl
             << "    --pal <filename.nip/pal>           Define the palette to use in conversion" << endl
             << "    -4                                 Output 4-bit graphics" << endl
+            << "    --bank <n>                         With -4, use colours 16n to 16n+15 of the palette" << endl
+            << "    --jobs <n>                         Number of threads to use (0 = one per core, default 1)" << endl
+            << "    --dither <mode>                    none, bayer2/4/8, floyd, atkinson or sierra-lite" << endl
+            << "    --layout <row|column>              Store pixels row by row (default) or column by column" << endl
+            << "    --split <8k|16k>                   Also write the pixels in 8K page or 16K bank sized files" << endl
+            << "    --compress <none|zx0>              Compress the pixels with ZX0 and write a NIM1 file" << endl
+            << "    -i                                 Only convert if the image, palette or options changed" << endl
+            << "    --stats                            Print stage timings and counters" << endl
+            << "    --stats-format <text|json>         Print the stats as text (default) or JSON" << endl
+            << "batch flags:" << endl
+            << "    (image flags)                      As for image, but --jobs defaults to one per core" << endl
+            << "    --out <directory>                  Write .nim files to this directory" << endl
+            << "    -r                                 Search directories recursively" << endl
+            << "tiles flags:" << endl
+            << "    --pal, --bank, --dither, --jobs    As for image, but --jobs defaults to one per core" << endl
+            << "    -m                                 Also match mirrored and rotated tiles" << endl
+            << "sprites flags:" << endl
+            << "    (image flags)                      As for image, but --jobs defaults to one per core" << endl
+            << "    --grid <w>x<h>                     Size of the sheet's cells (default 16x16)" << endl
+            << "    -a                                 Find sprites automatically instead of using a grid" << endl
+            << "anim flags:" << endl
+            << "    (image flags)                      As for image, but --jobs defaults to one per core, and -i," << endl
+            << "                                       --split, --compress and --stats don't apply" << endl
+            << "    --out <filename.nan>               Output file (default: the first frame's name with .nan)" << endl
+            << "    -r                                 Search directories recursively" << endl
+            << "bench flags:" << endl
+            << "    --reps <n>                         Number of timed runs per stage (default 20)" << endl
+            << "    --jobs <n>, --pal <filename>       As for image" << endl
             << endl;
+        return 1;
     }
+
+    return result;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
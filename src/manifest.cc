@@ -0,0 +1,209 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Incremental build manifest
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <hash.h>
+#include <image.h>
+#include <manifest.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+//----------------------------------------------------------------------------------------------------------------------
+// directory
+// Returns the entries for a directory, loading its manifest the first time.  Must be called with m_lock held.
+
+func Manifest::directory(const fs::path& dir) -> Directory&
+{
+    auto it = m_directories.find(dir);
+    if (it != m_directories.end())
+    {
+        return it->second;
+    }
+
+    Directory& d = m_directories[dir];
+    ifstream f(dir / kFileName);
+    string line;
+    while (getline(f, line))
+    {
+        if (line.empty() || line[0] == '#') continue;
+
+        istringstream ss(line);
+        Entry e;
+        string name;
+        if (ss >> hex >> e.stamp >> e.content >> e.output && getline(ss >> ws, name))
+        {
+            d.entries[name] = e;
+        }
+    }
+
+    return d;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// paletteHash
+// Palettes are shared by many outputs, so their content hashes are only worked out once.
+
+func Manifest::paletteHash(const string& palette) -> u64
+{
+    if (palette.empty()) return 0;
+
+    {
+        lock_guard<mutex> guard(m_lock);
+        auto it = m_paletteHashes.find(palette);
+        if (it != m_paletteHashes.end()) return it->second;
+    }
+
+    u64 hash = 0;
+    hashFile(palette, hash);
+
+    lock_guard<mutex> guard(m_lock);
+    m_paletteHashes[palette] = hash;
+    return hash;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// computeStamp
+
+func Manifest::computeStamp(BuildKey& key) -> u64
+{
+    if (!key.stamp)
+    {
+        key.stamp = Hasher()
+            .update(string(kNimVersion))
+            .update(key.options)
+            .update(stampFile(key.input))
+            .update(key.palette.empty() ? 0 : stampFile(key.palette))
+            .digest();
+    }
+
+    return *key.stamp;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// computeContent
+// Returns 0 if the input cannot be read, which never matches a recorded entry.
+
+func Manifest::computeContent(BuildKey& key) -> u64
+{
+    if (!key.content)
+    {
+        u64 inputHash;
+        key.content = hashFile(key.input, inputHash)
+            ? Hasher()
+                .update(string(kNimVersion))
+                .update(key.options)
+                .update(inputHash)
+                .update(paletteHash(key.palette))
+                .digest()
+            : 0;
+    }
+
+    return *key.content;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// outputStamp
+// Hashes the sizes and times of an output and of the page files next to it, numbered from 00 until one is missing.
+// Removing or rewriting any of them changes the hash.
+
+func Manifest::outputStamp(const fs::path& output) -> u64
+{
+    Hasher h;
+    h.update(stampFile(output));
+    for (int page = 0;; ++page)
+    {
+        u64 stamp = stampFile(pagePath(output, page));
+        if (!stamp) break;
+        h.update(stamp);
+    }
+
+    return h.digest();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// upToDate
+
+func Manifest::upToDate(const fs::path& output, BuildKey& key) -> bool
+{
+    error_code ec;
+    if (!fs::is_regular_file(output, ec))
+    {
+        return false;
+    }
+
+    fs::path dir = fs::absolute(output).parent_path();
+    string name = output.filename().string();
+    u64 stamp = computeStamp(key);
+
+    Entry entry;
+    {
+        lock_guard<mutex> guard(m_lock);
+        Directory& d = directory(dir);
+        auto it = d.entries.find(name);
+        if (it == d.entries.end()) return false;
+        entry = it->second;
+    }
+
+    if (entry.output != outputStamp(output)) return false;
+    if (entry.stamp == stamp) return true;
+    if (entry.content == 0 || entry.content != computeContent(key)) return false;
+
+    // Same content with a new time stamp; remember the stamp so next time is quick.
+    lock_guard<mutex> guard(m_lock);
+    Directory& d = directory(dir);
+    d.entries[name].stamp = stamp;
+    d.dirty = true;
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// record
+
+func Manifest::record(const fs::path& output, BuildKey& key) -> void
+{
+    fs::path dir = fs::absolute(output).parent_path();
+    Entry entry = { computeStamp(key), computeContent(key), outputStamp(output) };
+
+    lock_guard<mutex> guard(m_lock);
+    Directory& d = directory(dir);
+    d.entries[output.filename().string()] = entry;
+    d.dirty = true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// save
+
+func Manifest::save(ostream& err) -> bool
+{
+    lock_guard<mutex> guard(m_lock);
+    bool ok = true;
+
+    for (auto& [dir, d] : m_directories)
+    {
+        if (!d.dirty) continue;
+
+        ofstream f(dir / kFileName, ios::trunc);
+        if (!f)
+        {
+            err << "ERROR: Unable to write " << (dir / kFileName) << "." << endl;
+            ok = false;
+            continue;
+        }
+
+        f << "# nim " << kNimVersion << " build manifest: <stamp> <content> <output stamp> <output>" << endl;
+        for (const auto& [name, e] : d.entries)
+        {
+            f << hex << setw(16) << setfill('0') << e.stamp << ' '
+              << setw(16) << setfill('0') << e.content << ' '
+              << setw(16) << setfill('0') << e.output << ' ' << name << endl;
+        }
+        d.dirty = false;
+    }
+
+    return ok;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
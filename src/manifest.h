@@ -0,0 +1,83 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Incremental build manifest
+//----------------------------------------------------------------------------------------------------------------------
+//
+// Each output directory gets a '.nim-manifest' file recording, per output, two hashes of what it was built from and
+// one of what was written:
+//
+//      stamp       Sizes and modification times of the input and palette, the options and the tool version.
+//      content     Contents of the input and palette, the options and the tool version.
+//      output      Sizes and modification times of the output and each of its page files.
+//
+// An output is up to date if it and its page files are as recorded and either input hash matches.  The stamp makes
+// a no-op rebuild cheap; the content hash catches files that were touched or copied without actually changing.  The
+// output hash catches outputs rewritten by a conversion that did not update the manifest.
+//
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+#include <mutex>
+#include <ostream>
+
+//----------------------------------------------------------------------------------------------------------------------
+// BuildKey
+// Describes the inputs of one conversion.  The hashes are worked out by the manifest when first needed.
+
+struct BuildKey
+{
+    BuildKey(fs::path input, string palette, string options)
+        : input(move(input)), palette(move(palette)), options(move(options)) {}
+
+    fs::path input;
+    string palette;             // Empty for the default palette
+    string options;             // Everything else that affects the output
+
+    optional<u64> stamp;
+    optional<u64> content;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Manifest
+// Safe to use from several threads at once.
+
+class Manifest
+{
+public:
+    static constexpr const char* kFileName = ".nim-manifest";
+
+    func upToDate(const fs::path& output, BuildKey& key) -> bool;
+    func record(const fs::path& output, BuildKey& key) -> void;
+
+    // Writes the manifest of every directory whose entries changed.
+    func save(ostream& err) -> bool;
+
+private:
+    struct Entry
+    {
+        u64 stamp;
+        u64 content;
+        u64 output;
+    };
+
+    struct Directory
+    {
+        map<string, Entry> entries;
+        bool dirty = false;
+    };
+
+    func directory(const fs::path& dir) -> Directory&;
+    func computeStamp(BuildKey& key) -> u64;
+    func computeContent(BuildKey& key) -> u64;
+    func paletteHash(const string& palette) -> u64;
+    static func outputStamp(const fs::path& output) -> u64;
+
+private:
+    mutex m_lock;
+    map<fs::path, Directory> m_directories;
+    map<string, u64> m_paletteHashes;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,201 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Memory mapped files
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <mapping.h>
+
+#ifdef _WIN32
+#   include <Windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+// Constructors
+
+MappedFile::MappedFile()
+    : m_data(nullptr)
+    , m_size(0)
+#ifdef _WIN32
+    , m_file(INVALID_HANDLE_VALUE)
+    , m_mapping(nullptr)
+#endif
+{
+}
+
+MappedFile::MappedFile(MappedFile&& other)
+    : MappedFile()
+{
+    *this = move(other);
+}
+
+MappedFile& MappedFile::operator= (MappedFile&& other)
+{
+    if (this != &other)
+    {
+        close();
+        swap(m_data, other.m_data);
+        swap(m_size, other.m_size);
+#ifdef _WIN32
+        swap(m_file, other.m_file);
+        swap(m_mapping, other.m_mapping);
+#endif
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+//----------------------------------------------------------------------------------------------------------------------
+// openRead
+
+func MappedFile::openRead(const fs::path& path) -> MappedFile
+{
+    MappedFile m;
+
+    m.m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m.m_file == INVALID_HANDLE_VALUE) return m;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m.m_file, &size) || size.QuadPart == 0) return m;
+
+    m.m_mapping = CreateFileMappingW(m.m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m.m_mapping) return m;
+
+    m.m_data = (u8 *)MapViewOfFile(m.m_mapping, FILE_MAP_READ, 0, 0, 0);
+    m.m_size = m.m_data ? u64(size.QuadPart) : 0;
+    return m;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// create
+// Creating the mapping extends the file to its full size.
+
+func MappedFile::create(const fs::path& path, u64 size) -> MappedFile
+{
+    MappedFile m;
+    if (size == 0) return m;
+
+    m.m_file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m.m_file == INVALID_HANDLE_VALUE) return m;
+
+    m.m_mapping = CreateFileMappingW(m.m_file, nullptr, PAGE_READWRITE, DWORD(size >> 32), DWORD(size), nullptr);
+    if (!m.m_mapping) return m;
+
+    m.m_data = (u8 *)MapViewOfFile(m.m_mapping, FILE_MAP_WRITE, 0, 0, SIZE_T(size));
+    m.m_size = m.m_data ? size : 0;
+    return m;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// close
+
+func MappedFile::close() -> void
+{
+    if (m_data)
+    {
+        UnmapViewOfFile(m_data);
+        m_data = nullptr;
+    }
+    if (m_mapping)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+    m_size = 0;
+}
+
+#else
+
+//----------------------------------------------------------------------------------------------------------------------
+// openRead
+// The mapping keeps the file referenced, so the descriptor is closed straight away.  The kernel is told to read ahead
+// aggressively and drop pages behind the reader.
+
+func MappedFile::openRead(const fs::path& path) -> MappedFile
+{
+    MappedFile m;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return m;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            madvise(data, size_t(st.st_size), MADV_SEQUENTIAL);
+            m.m_data = (u8 *)data;
+            m.m_size = u64(st.st_size);
+        }
+    }
+
+    ::close(fd);
+    return m;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// create
+
+func MappedFile::create(const fs::path& path, u64 size) -> MappedFile
+{
+    MappedFile m;
+    if (size == 0) return m;
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return m;
+
+    // Reserve the blocks up front.  A file merely extended with ftruncate is sparse, and running out of space when its
+    // pages are first written raises SIGBUS instead of returning an error.
+    if (posix_fallocate(fd, 0, off_t(size)) == 0)
+    {
+        void* data = mmap(nullptr, size_t(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            m.m_data = (u8 *)data;
+            m.m_size = size;
+        }
+    }
+
+    ::close(fd);
+    if (!m.m_data) unlink(path.c_str());
+    return m;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// close
+
+func MappedFile::close() -> void
+{
+    if (m_data)
+    {
+        munmap(m_data, size_t(m_size));
+        m_data = nullptr;
+    }
+    m_size = 0;
+}
+
+#endif // _WIN32
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,47 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Memory mapped files
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// MappedFile
+// A whole file mapped into memory, either read-only or created at a fixed size for writing.  Unmapped when destroyed.
+// Files are mapped for reading with a sequential access hint, which suits the decoders and batch input.
+
+class MappedFile
+{
+public:
+    MappedFile();
+    MappedFile(MappedFile&& other);
+    MappedFile& operator= (MappedFile&& other);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator= (const MappedFile&) = delete;
+
+    // Maps an existing file for reading.  Check isOpen() for success.  Empty files cannot be mapped.
+    static func openRead(const fs::path& path) -> MappedFile;
+
+    // Creates (or truncates) a file of the given size and maps it for writing.
+    static func create(const fs::path& path, u64 size) -> MappedFile;
+
+    func isOpen() const -> bool { return m_data != nullptr; }
+    func data() const -> u8* { return m_data; }
+    func size() const -> u64 { return m_size; }
+
+    func close() -> void;
+
+private:
+    u8* m_data;
+    u64 m_size;
+#ifdef _WIN32
+    void* m_file;           // HANDLEs
+    void* m_mapping;
+#endif
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
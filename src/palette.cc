@@ -0,0 +1,189 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Palette management
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <palette.h>
+#include <iostream>
+
+//----------------------------------------------------------------------------------------------------------------------
+// Constructor
+// Generates the default RRRGGGBB palette.
+
+Palette::Palette()
+    : m_transparentColour(0xe3)
+{
+    for (int i = 0; i < 256; ++i)
+    {
+        u8 r = (i & 0xe0) >> 5;
+        u8 g = (i & 0x1c) >> 2;
+        u8 b = ((i & 0x03) << 1) + (((i & 0x02) >> 1) | (i & 0x01));
+
+        m_colours.push_back(Colour(r, g, b));
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Constructor
+// Uses the given hardware colours.
+
+Palette::Palette(vector<Colour> colours, u8 transparentColour)
+    : m_colours(move(colours))
+    , m_transparentColour(transparentColour)
+{
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Constructor
+// Loads a .nip or JASC .pal file.  On failure, the palette will have no colours.
+
+Palette::Palette(ifstream& f)
+    : m_transparentColour(0xe3)
+{
+    vector<Colour> colours;
+
+    u32 tag;
+    f.read((char *)&tag, 4);
+    if (tag == '0PIN')
+    {
+        // .NIP file
+        u8 numColours;
+        u8 flags;
+
+        f.read((char *)&numColours, 1);
+        f.read((char *)&flags, 1);
+
+        int actualNumColours = numColours ? numColours : 256;
+        for (int i = 0; i < actualNumColours; ++i)
+        {
+            u8 p1, p2;
+            f.read((char *)&p1, 1);
+            if (flags & 1)
+            {
+                f.read((char *)&p2, 1);
+            }
+            else
+            {
+                p2 = ((p1 & 2) >> 1) | (p1 & 1);
+            }
+
+            u8 r = ((p1 & 0xe0) >> 5);
+            u8 g = ((p1 & 0x1c) >> 2);
+            u8 b = ((p1 & 0x03) << 1) | (p2 & 1);
+
+            colours.push_back(Colour(r, g, b));
+        }
+
+        f.read((char *)&m_transparentColour, 1);
+    }
+    else
+    {
+        f.seekg(0, ios::beg);
+
+        string line;
+        f >> line;
+        if (line == "JASC-PAL")
+        {
+            f >> line;
+            if (line == "0100")
+            {
+                f >> line;
+                size_t num = size_t(stoi(line));
+
+                int i = 0;
+                while (!f.eof())
+                {
+                    int red, green, blue;
+                    f >> red >> green >> blue;
+
+                    if (red < 0 || red > 255 ||
+                        green < 0 || green > 255 ||
+                        blue < 0 || blue > 255)
+                    {
+                        cerr << "ERROR: Invalid .pal file" << endl;
+                        return;
+                    }
+
+                    colours.emplace_back(gfxReduce3(u8(red)), gfxReduce3(u8(green)), gfxReduce3(u8(blue)));
+
+                    if (++i == num) break;
+                }
+
+                if (num != colours.size())
+                {
+                    cerr << "ERROR: Invalid number of colours found in the palette." << endl;
+  
+                    //#todo: truncate or expand with black rather than error?
+                    return;
+                }
+            }
+        }
+    }
+
+
+    m_colours = move(colours);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// write
+// Writes the palette out as a .nip file.
+
+func Palette::write(ofstream& f, bool extended) const -> bool
+{
+    struct Header
+    {
+        char id[4];
+        u8 numColours;
+        u8 flags;
+    };
+
+    Header h;
+    h.id[0] = 'N';
+    h.id[1] = 'I';
+    h.id[2] = 'P';
+    h.id[3] = '0';
+    h.numColours = u8(m_colours.size() & 0xff);
+    h.flags = extended ? 1 : 0;
+
+    f.write((char *)&h, sizeof(h));
+
+    for (const auto& colour : m_colours)
+    {
+        u8 p1 = ((colour.m_red) << 5) | ((colour.m_green) << 2) | ((colour.m_blue >> 1));
+        u8 p2 = (colour.m_blue & 1);
+
+        f.write((char *)&p1, 1);
+        if (extended) f.write((char *)&p2, 1);
+    }
+
+    f.write((char *)&m_transparentColour, 1);
+
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// indexStr
+
+func indexStr(const string& str) -> u8
+{
+    if (str[0] == '$')
+    {
+        // hex string
+        u8 t = 0;
+        for (auto c : str)
+        {
+            if (c >= '0' && c <= '9') { t <<= 4; t += (c - '0'); }
+            if (c >= 'a' && c <= 'f') { t <<= 4; t += (c - 'a' + 10); }
+            if (c >= 'A' && c <= 'F') { t <<= 4; t += (c - 'A' + 10); }
+        }
+
+        return t;
+    }
+    else
+    {
+        return u8(stoi(str));
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,106 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Palette management
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+#include <array>
+#include <fstream>
+
+//----------------------------------------------------------------------------------------------------------------------
+// Colour component tables
+// Maps 3-bit and 2-bit hardware colour components to 8-bit values.
+
+inline constexpr int kColour_3bit[] = { 0, 36, 73, 109, 146, 182, 219, 255 };
+inline constexpr int kColour_2bit[] = { 0, 85, 170, 255 };
+
+//----------------------------------------------------------------------------------------------------------------------
+// Component reduction tables
+// Map 8-bit values to the nearest 3-bit or 2-bit hardware component, ties going to the lower component.  Generated at
+// compile time.
+
+template <int N>
+constexpr func makeReduceTable(const int (&levels)[N]) -> array<u8, 256>
+{
+    array<u8, 256> table = {};
+    for (int v = 0; v < 256; ++v)
+    {
+        auto dist = [&](int i) { return v < levels[i] ? levels[i] - v : v - levels[i]; };
+        int best = 0;
+        for (int i = 1; i < N; ++i)
+        {
+            if (dist(i) < dist(best)) best = i;
+        }
+        table[v] = u8(best);
+    }
+    return table;
+}
+
+inline constexpr array<u8, 256> kReduce3 = makeReduceTable(kColour_3bit);
+inline constexpr array<u8, 256> kReduce2 = makeReduceTable(kColour_2bit);
+
+inline constexpr func gfxReduce3(u8 v) -> u8 { return kReduce3[v]; }
+inline constexpr func gfxReduce2(u8 v) -> u8 { return kReduce2[v]; }
+
+//----------------------------------------------------------------------------------------------------------------------
+// Hardware colour table
+// Maps an 8-bit component to its 3-bit value when it is exactly one of kColour_3bit, and to kNotHardware otherwise.
+// Combining three lookups as (r << 6) | (g << 3) | b gives a 9-bit RRRGGGBBB colour below 512 only when every
+// component was exact.
+
+inline constexpr u16 kNotHardware = 0x1000;
+
+inline constexpr array<u16, 256> kHardware3 = [] {
+    array<u16, 256> table = {};
+    for (int v = 0; v < 256; ++v)
+    {
+        table[v] = kColour_3bit[kReduce3[v]] == v ? kReduce3[v] : kNotHardware;
+    }
+    return table;
+}();
+
+//----------------------------------------------------------------------------------------------------------------------
+// Colour
+// A hardware colour with 3-bit components.
+
+struct Colour
+{
+    Colour(u8 red, u8 green, u8 blue) : m_red(red), m_green(green), m_blue(blue) {}
+    Colour() : Colour(0, 0, 0) {}
+
+    u8 m_red;
+    u8 m_green;
+    u8 m_blue;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Palette
+
+class Palette
+{
+public:
+    Palette();
+    Palette(ifstream& f);
+    Palette(vector<Colour> colours, u8 transparentColour = 0xe3);
+
+    func numColours() const -> int { return int(m_colours.size()); }
+    func operator[] (int i) const -> const Colour& { return m_colours[i]; }
+    func getTransColour() const -> u8 { return m_transparentColour; }
+    func setTransparent(u8 index) -> void { m_transparentColour = index; }
+
+    func write(ofstream& f, bool extended) const -> bool;
+
+private:
+    vector<Colour> m_colours;
+    u8 m_transparentColour;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// indexStr
+// Parses a palette index written in decimal or as $<hex>.
+
+func indexStr(const string& str) -> u8;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,674 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Palette generation
+//----------------------------------------------------------------------------------------------------------------------
+//
+//      nim palette --from <inputs...> [--colours <n>] [--out <filename.nip>] [-9] [--transparent <index>]
+//
+// Builds a palette for a set of images.  Inputs are expanded as for batch.  Each image is reduced to a histogram over
+// the 512 hardware colours, on as many threads as --jobs allows, so even hundreds of frames only cost their decoding.
+// The palette is chosen from the combined histogram.
+//
+// One entry, index 0 unless --transparent says otherwise, is reserved for transparency and set to the Next's default
+// transparent colour ($E3).  The other n-1 entries are generated, or fewer if the images use fewer colours.
+//
+//      nim palette --from <sprites...> --banks <n> [--out <filename.nip>] [-9] [--transparent <index>]
+//
+// Builds a palette of up to n banks of 16 colours for 4-bit sprites, which pick a bank with their palette offset.
+// Sprites are grouped so that each bank suits its sprites as well as possible, and each sprite's bank is listed in
+// <filename>.banks for converting it with 'nim image -4 --bank <n>'.  Every bank has its own transparent entry.
+//
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <batch.h>
+#include <cmdline.h>
+#include <jobs.h>
+#include <palgen.h>
+#include <reader.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+// Pixels decoded per band when reading an image.
+static const i64 kBandPixels = 64 * 1024;
+
+// Upper limit on k-means iterations.  They normally settle well before this.
+static const int kMaxIterations = 32;
+
+// Colours generated for each bank of a 4-bit sprite palette.  The 16th is transparent.
+static const int kBankColours = 15;
+
+//----------------------------------------------------------------------------------------------------------------------
+// ColourHistogram
+//----------------------------------------------------------------------------------------------------------------------
+
+func ColourHistogram::merge(const ColourHistogram& other) -> void
+{
+    for (int i = 0; i < 512; ++i)
+    {
+        counts[i] += other.counts[i];
+    }
+    transparent += other.transparent;
+}
+
+static func hardwareColour(u32 pixel) -> int
+{
+    return (kReduce3[u8(pixel)] << 6) | (kReduce3[u8(pixel >> 8)] << 3) | kReduce3[u8(pixel >> 16)];
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// addImage
+// Indexed images count their indices and only reduce the colours they use.
+
+func addImage(ColourHistogram& hist, const fs::path& path, string& error) -> bool
+{
+    auto reader = openImage(path, error);
+    if (!reader)
+    {
+        return false;
+    }
+
+    int w = reader->width();
+    int h = reader->height();
+    int bandRows = reader->isBuffered() ? h : int(max(i64(1), kBandPixels / w));
+    const u32* colours = reader->colourTable();
+    array<u64, 256> indexCounts = {};
+
+    for (int row = 0; row < h; row += bandRows)
+    {
+        int numRows = min(bandRows, h - row);
+        size_t count = size_t(numRows) * w;
+
+        if (colours)
+        {
+            const u8* indices = reader->readIndices(numRows);
+            if (!indices) break;
+            for (size_t i = 0; i < count; ++i)
+            {
+                ++indexCounts[indices[i]];
+            }
+        }
+        else
+        {
+            const u32* pixels = reader->readRows(numRows);
+            if (!pixels) break;
+            for (size_t i = 0; i < count; ++i)
+            {
+                u32 pixel = pixels[i];
+                if ((pixel >> 24) != 255) ++hist.transparent;
+                else ++hist.counts[hardwareColour(pixel)];
+            }
+        }
+    }
+
+    if (!reader->error().empty())
+    {
+        error = reader->error();
+        return false;
+    }
+
+    if (colours)
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            if ((colours[i] >> 24) != 255) hist.transparent += indexCounts[i];
+            else hist.counts[hardwareColour(colours[i])] += indexCounts[i];
+        }
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Colour generation
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace {
+
+// A histogram entry in 8-bit components.
+struct Entry
+{
+    int c[3];
+    u64 count;
+};
+
+// A colour in 8-bit components, as the quantiser sees it.
+struct Rgb
+{
+    int c[3];
+
+    func operator== (const Rgb& other) const -> bool
+    {
+        return c[0] == other.c[0] && c[1] == other.c[1] && c[2] == other.c[2];
+    }
+};
+
+}
+
+static func colourDistance(const int* a, const int* b) -> int
+{
+    int dr = a[0] - b[0];
+    int dg = a[1] - b[1];
+    int db = a[2] - b[2];
+    return dr * dr + dg * dg + db * db;
+}
+
+// Nearest level to v, of the 3-bit components allowed for one channel.
+static func nearestLevel(double v, const vector<int>& levels) -> int
+{
+    int best = levels[0];
+    for (int l : levels)
+    {
+        if (abs(kColour_3bit[l] - v) < abs(kColour_3bit[best] - v)) best = l;
+    }
+    return best;
+}
+
+// The storable hardware colour nearest to a mean colour.  8-bit .nip files store blue as 2 bits, which read back as
+// 3-bit levels 0, 3, 5 and 7.
+static func snap(const double* mean, bool extended) -> Rgb
+{
+    static const vector<int> kAll = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    static const vector<int> kBlue8 = { 0, 3, 5, 7 };
+
+    Rgb rgb;
+    for (int c = 0; c < 3; ++c)
+    {
+        rgb.c[c] = kColour_3bit[nearestLevel(mean[c], (c == 2 && !extended) ? kBlue8 : kAll)];
+    }
+    return rgb;
+}
+
+// Weighted mean colour of a set of entries.
+static func meanColour(const vector<Entry>& entries, const vector<int>& members, double* mean) -> void
+{
+    double sum[3] = {};
+    double total = 0;
+    for (int i : members)
+    {
+        for (int c = 0; c < 3; ++c) sum[c] += double(entries[i].c[c]) * entries[i].count;
+        total += double(entries[i].count);
+    }
+    for (int c = 0; c < 3; ++c) mean[c] = sum[c] / total;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// medianCut
+// Repeatedly splits the box with the largest squared error at the weighted median of its widest channel.
+
+static func medianCut(const vector<Entry>& entries, int numBoxes) -> vector<vector<int>>
+{
+    struct Box
+    {
+        vector<int> members;
+        double error;
+        int channel;
+    };
+
+    auto measure = [&](Box& box) {
+        double mean[3];
+        meanColour(entries, box.members, mean);
+
+        double variance[3] = {};
+        for (int i : box.members)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                double d = entries[i].c[c] - mean[c];
+                variance[c] += d * d * double(entries[i].count);
+            }
+        }
+        box.error = box.members.size() > 1 ? variance[0] + variance[1] + variance[2] : 0.0;
+        box.channel = int(max_element(variance, variance + 3) - variance);
+    };
+
+    vector<Box> boxes(1);
+    for (int i = 0; i < int(entries.size()); ++i) boxes[0].members.push_back(i);
+    measure(boxes[0]);
+
+    while (int(boxes.size()) < numBoxes)
+    {
+        auto it = max_element(boxes.begin(), boxes.end(), [](const Box& a, const Box& b) { return a.error < b.error; });
+        if (it->error <= 0.0) break;
+
+        Box& box = *it;
+        int channel = box.channel;
+        stable_sort(box.members.begin(), box.members.end(), [&](int a, int b) {
+            return entries[a].c[channel] < entries[b].c[channel];
+        });
+
+        u64 total = 0;
+        for (int i : box.members) total += entries[i].count;
+
+        // Split after the entry that takes the running count past half, leaving at least one entry on each side.
+        size_t split = 1;
+        u64 running = entries[box.members[0]].count;
+        while (split < box.members.size() - 1 && running * 2 < total)
+        {
+            running += entries[box.members[split++]].count;
+        }
+
+        Box upper;
+        upper.members.assign(box.members.begin() + split, box.members.end());
+        box.members.resize(split);
+        measure(box);
+        measure(upper);
+        boxes.push_back(move(upper));
+    }
+
+    vector<vector<int>> result;
+    for (auto& box : boxes) result.push_back(move(box.members));
+    return result;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// generateColours
+
+func generateColours(const ColourHistogram& hist, int numColours, bool extended) -> vector<Colour>
+{
+    vector<Entry> entries;
+    for (int i = 0; i < 512; ++i)
+    {
+        if (hist.counts[i])
+        {
+            entries.push_back({ { kColour_3bit[i >> 6], kColour_3bit[(i >> 3) & 7], kColour_3bit[i & 7] },
+                                hist.counts[i] });
+        }
+    }
+
+    vector<Rgb> palette;
+    if (!entries.empty() && numColours > 0)
+    {
+        // Starting colours from median cut.
+        for (const auto& members : medianCut(entries, numColours))
+        {
+            double mean[3];
+            meanColour(entries, members, mean);
+            palette.push_back(snap(mean, extended));
+        }
+
+        // k-means: move each colour to the (storable) mean of the entries nearest to it until nothing changes.
+        for (int iteration = 0; iteration < kMaxIterations; ++iteration)
+        {
+            vector<vector<int>> clusters(palette.size());
+            for (int i = 0; i < int(entries.size()); ++i)
+            {
+                int best = 0;
+                for (int p = 1; p < int(palette.size()); ++p)
+                {
+                    if (colourDistance(entries[i].c, palette[p].c) < colourDistance(entries[i].c, palette[best].c))
+                    {
+                        best = p;
+                    }
+                }
+                clusters[best].push_back(i);
+            }
+
+            bool changed = false;
+            for (size_t p = 0; p < palette.size(); ++p)
+            {
+                if (clusters[p].empty()) continue;
+
+                double mean[3];
+                meanColour(entries, clusters[p], mean);
+                Rgb rgb = snap(mean, extended);
+                if (!(rgb == palette[p]))
+                {
+                    palette[p] = rgb;
+                    changed = true;
+                }
+            }
+            if (!changed) break;
+        }
+    }
+
+    // Snapping can make colours coincide.
+    vector<int> hardware;
+    for (const auto& rgb : palette)
+    {
+        hardware.push_back((kReduce3[rgb.c[0]] << 6) | (kReduce3[rgb.c[1]] << 3) | kReduce3[rgb.c[2]]);
+    }
+    sort(hardware.begin(), hardware.end());
+    hardware.erase(unique(hardware.begin(), hardware.end()), hardware.end());
+
+    vector<Colour> colours;
+    for (int hw : hardware)
+    {
+        colours.emplace_back(u8(hw >> 6), u8((hw >> 3) & 7), u8(hw & 7));
+    }
+    return colours;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Palette banks
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace {
+
+// The hardware colours a sprite uses, with their pixel counts.
+struct SpriteColours
+{
+    vector<u16> colours;
+    vector<u64> counts;
+};
+
+// Squared distance from each hardware colour to the nearest colour of a bank.
+using BankCosts = array<u32, 512>;
+
+}
+
+static func spriteColours(const ColourHistogram& hist) -> SpriteColours
+{
+    SpriteColours sprite;
+    for (int i = 0; i < 512; ++i)
+    {
+        if (hist.counts[i])
+        {
+            sprite.colours.push_back(u16(i));
+            sprite.counts.push_back(hist.counts[i]);
+        }
+    }
+    return sprite;
+}
+
+static func bankCosts(const vector<Colour>& bank) -> BankCosts
+{
+    BankCosts costs;
+    for (int i = 0; i < 512; ++i)
+    {
+        int c[3] = { kColour_3bit[i >> 6], kColour_3bit[(i >> 3) & 7], kColour_3bit[i & 7] };
+        u32 best = ~0u;
+        for (const auto& colour : bank)
+        {
+            int b[3] = { kColour_3bit[colour.m_red], kColour_3bit[colour.m_green], kColour_3bit[colour.m_blue] };
+            best = min(best, u32(colourDistance(c, b)));
+        }
+        costs[i] = best;
+    }
+    return costs;
+}
+
+static func spriteError(const SpriteColours& sprite, const BankCosts& costs) -> u64
+{
+    u64 error = 0;
+    for (size_t i = 0; i < sprite.colours.size(); ++i)
+    {
+        error += sprite.counts[i] * costs[sprite.colours[i]];
+    }
+    return error;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// generateBanks
+
+func generateBanks(const vector<ColourHistogram>& sprites, int numBanks, bool extended, int numJobs,
+                   vector<int>& bankOf) -> vector<vector<Colour>>
+{
+    int numSprites = int(sprites.size());
+    vector<SpriteColours> colours(numSprites);
+    parallelFor(numSprites, numJobs, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) colours[i] = spriteColours(sprites[i]);
+    });
+
+    vector<vector<Colour>> banks;
+    vector<BankCosts> costs;
+    vector<u64> errors(numSprites, ~u64(0));
+    bankOf.assign(numSprites, 0);
+
+    // Adds a bank and gives it every sprite it suits better than the banks so far.
+    auto addBank = [&](vector<Colour> bank) {
+        int index = int(banks.size());
+        costs.push_back(bankCosts(bank));
+        banks.push_back(move(bank));
+        parallelFor(numSprites, numJobs, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i)
+            {
+                u64 error = spriteError(colours[i], costs[index]);
+                if (error < errors[i])
+                {
+                    errors[i] = error;
+                    bankOf[i] = index;
+                }
+            }
+        });
+    };
+
+    // Seed the banks farthest first: the sprite with the most colours, then repeatedly the sprite worst served by the
+    // banks so far, until every sprite is served exactly or the banks run out.
+    int seed = 0;
+    for (int i = 1; i < numSprites; ++i)
+    {
+        if (colours[i].colours.size() > colours[seed].colours.size()) seed = i;
+    }
+    if (numSprites) addBank(generateColours(sprites[seed], kBankColours, extended));
+    while (int(banks.size()) < numBanks)
+    {
+        seed = int(max_element(errors.begin(), errors.end()) - errors.begin());
+        if (errors[seed] == 0) break;
+        addBank(generateColours(sprites[seed], kBankColours, extended));
+    }
+
+    // Then alternate between fitting each bank to its sprites and moving sprites to the bank that suits them best.
+    for (int iteration = 0; iteration < kMaxIterations; ++iteration)
+    {
+        parallelFor(int(banks.size()), numJobs, [&](int begin, int end) {
+            for (int b = begin; b < end; ++b)
+            {
+                ColourHistogram hist;
+                for (int i = 0; i < numSprites; ++i)
+                {
+                    if (bankOf[i] == b) hist.merge(sprites[i]);
+                }
+                if (any_of(hist.counts.begin(), hist.counts.end(), [](u64 n) { return n != 0; }))
+                {
+                    banks[b] = generateColours(hist, kBankColours, extended);
+                    costs[b] = bankCosts(banks[b]);
+                }
+            }
+        });
+
+        atomic<bool> changed(false);
+        parallelFor(numSprites, numJobs, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i)
+            {
+                int best = 0;
+                u64 bestError = ~u64(0);
+                for (int b = 0; b < int(banks.size()); ++b)
+                {
+                    u64 error = spriteError(colours[i], costs[b]);
+                    if (error < bestError)
+                    {
+                        best = b;
+                        bestError = error;
+                    }
+                }
+                if (best != bankOf[i])
+                {
+                    bankOf[i] = best;
+                    changed = true;
+                }
+            }
+        });
+        if (!changed) break;
+    }
+
+    return banks;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// palette_from_handler
+
+func palette_from_handler(const CmdLine& cmdLine) -> int
+{
+    if (cmdLine.numParams() == 0)
+    {
+        cerr << "ERROR: Invalid parameters." << endl;
+        cerr << "Syntax: " << endl
+            << "    nim palette --from <options> <inputs...>  - Generate a .nip file from images." << endl
+            << endl
+            << "Inputs are image files, directories, wildcard patterns or @<manifest> files." << endl
+            << endl
+            << "Options:" << endl
+            << "    --colours <n>               - Palette size, including the transparent entry (default 256)." << endl
+            << "    --banks <n>                 - Instead generate up to n banks of 16 colours for 4-bit" << endl
+            << "                                  sprites, listing each sprite's bank in <filename>.banks." << endl
+            << "    --out <filename.nip>        - Output file (default palette.nip)." << endl
+            << "    --transparent <index>       - Index of the transparent entry (default 0)." << endl
+            << "    --jobs <n>                  - Read images on n threads (0 = one per core, default)." << endl
+            << "    -9                          - Use 9-bit colours." << endl
+            << "    -r                          - Include subdirectories of directory inputs." << endl;
+        return 1;
+    }
+
+    auto coloursStr = cmdLine.longFlag("colours");
+    int numColours = coloursStr.empty() ? 256 : stoi(coloursStr);
+    if (numColours < 2 || numColours > 256)
+    {
+        cerr << "ERROR: The number of colours must be between 2 and 256." << endl;
+        return 1;
+    }
+
+    auto banksStr = cmdLine.longFlag("banks");
+    int maxBanks = banksStr.empty() ? 0 : stoi(banksStr);
+    if (!banksStr.empty() && (maxBanks < 1 || maxBanks > 16))
+    {
+        cerr << "ERROR: The number of banks must be between 1 and 16." << endl;
+        return 1;
+    }
+
+    auto transparentStr = cmdLine.longFlag("transparent");
+    int transparent = transparentStr.empty() ? 0 : indexStr(transparentStr);
+    bool extended = cmdLine.flag('9');
+    fs::path outPath = cmdLine.longFlag("out");
+    if (outPath.empty()) outPath = "palette.nip";
+
+    vector<string> inputs;
+    for (i64 i = 0; i < cmdLine.numParams(); ++i)
+    {
+        inputs.push_back(cmdLine.param(i));
+    }
+
+    vector<fs::path> files;
+    if (!collectImages(inputs, cmdLine.flag('r'), files))
+    {
+        return 1;
+    }
+    if (files.empty())
+    {
+        cerr << "ERROR: No images found." << endl;
+        return 1;
+    }
+
+    //
+    // Histogram every image
+    //
+
+    vector<ColourHistogram> hists(files.size());
+    mutex errorLock;
+    int numFailed = 0;
+    {
+        ThreadPool pool(numJobs(cmdLine, 0));
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            pool.submit([&, i] {
+                string error;
+                if (!addImage(hists[i], files[i], error))
+                {
+                    lock_guard<mutex> guard(errorLock);
+                    cerr << "ERROR: Could not load image " << files[i] << " (" << error << ")." << endl;
+                    ++numFailed;
+                }
+            });
+        }
+        pool.wait();
+        if (pool.numFailed())
+        {
+            cerr << "ERROR: " << pool.numFailed() << (pool.numFailed() == 1 ? " image" : " images")
+                << " failed with an unexpected error." << endl;
+            numFailed += pool.numFailed();
+        }
+    }
+    if (numFailed)
+    {
+        return 1;
+    }
+
+    ColourHistogram hist;
+    for (const auto& h : hists) hist.merge(h);
+    int numUsed = int(count_if(hist.counts.begin(), hist.counts.end(), [](u64 n) { return n != 0; }));
+
+    //
+    // Generate the palette around the transparent entry, or the banks around theirs
+    //
+
+    vector<Colour> colours;
+    vector<int> bankOf;
+    int numBanks = 0;
+    if (!banksStr.empty())
+    {
+        if (transparent > kBankColours)
+        {
+            cerr << "ERROR: The transparent index must be less than 16 for palette banks." << endl;
+            return 1;
+        }
+
+        for (auto& bank : generateBanks(hists, maxBanks, extended, numJobs(cmdLine, 0), bankOf))
+        {
+            bank.resize(kBankColours);
+            bank.insert(bank.begin() + transparent, Colour(7, 0, 7));
+            colours.insert(colours.end(), bank.begin(), bank.end());
+            ++numBanks;
+        }
+    }
+    else
+    {
+        colours = generateColours(hist, numColours - 1, extended);
+        if (transparent > int(colours.size()))
+        {
+            cerr << "ERROR: The transparent index must be less than the number of colours (" << colours.size() + 1
+                << ")." << endl;
+            return 1;
+        }
+        colours.insert(colours.begin() + transparent, Colour(7, 0, 7));
+    }
+
+    Palette p(move(colours), u8(transparent));
+    ofstream f(outPath, ios::binary | ios::trunc);
+    if (!f.is_open())
+    {
+        cerr << "ERROR: Unable to create file " << outPath << endl;
+        return 1;
+    }
+    p.write(f, extended);
+
+    if (numBanks)
+    {
+        // Each line gives a sprite's bank, for 'nim image -4 --bank <n>' and the sprite's palette offset.
+        fs::path banksPath = outPath;
+        banksPath.replace_extension(".banks");
+        ofstream banksFile(banksPath, ios::trunc);
+        if (!banksFile.is_open())
+        {
+            cerr << "ERROR: Unable to create file " << banksPath << endl;
+            return 1;
+        }
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            banksFile << bankOf[i] << " " << files[i].generic_string() << "\n";
+        }
+
+        cout << "Generated " << numBanks << (numBanks == 1 ? " bank" : " banks") << " for " << files.size()
+            << (files.size() == 1 ? " sprite" : " sprites") << " using " << numUsed << " hardware colours." << endl;
+    }
+    else
+    {
+        cout << "Generated " << p.numColours() << " colours from " << files.size()
+            << (files.size() == 1 ? " image" : " images") << " using " << numUsed << " hardware colours." << endl;
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
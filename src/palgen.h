@@ -0,0 +1,53 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Palette generation
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+#include <palette.h>
+
+class CmdLine;
+
+//----------------------------------------------------------------------------------------------------------------------
+// ColourHistogram
+// Pixel counts for each of the 512 hardware colours, indexed by RRRGGGBBB.  Every opaque pixel counts towards the
+// hardware colour nearest to it, component by component.
+
+struct ColourHistogram
+{
+    array<u64, 512> counts = {};
+    u64 transparent = 0;        // Non-opaque pixels
+
+    func merge(const ColourHistogram& other) -> void;
+};
+
+// Adds an image's pixels to a histogram.  Returns false if the image can't be loaded, with the reason in error.
+func addImage(ColourHistogram& hist, const fs::path& path, string& error) -> bool;
+
+//----------------------------------------------------------------------------------------------------------------------
+// generateColours
+// Chooses up to numColours hardware colours representing a histogram: median cut to get a spread of starting colours,
+// then k-means to settle them.  Without extended (9-bit) colours, only the blue levels an 8-bit .nip can store are
+// used.  Colours are returned in RRRGGGBBB order.
+
+func generateColours(const ColourHistogram& hist, int numColours, bool extended) -> vector<Colour>;
+
+//----------------------------------------------------------------------------------------------------------------------
+// generateBanks
+// Groups sprites into at most numBanks banks of 15 colours each (the 16th entry of a bank is left for transparency),
+// minimising the squared error of each sprite against its bank.  Banks are seeded farthest first and refined by
+// alternately regenerating each bank from its sprites and moving each sprite to its best bank, on numJobs threads.
+// Sets bankOf[i] to the bank of sprites[i].  Returns fewer banks if fewer reproduce every sprite exactly.
+
+func generateBanks(const vector<ColourHistogram>& sprites, int numBanks, bool extended, int numJobs,
+                   vector<int>& bankOf) -> vector<vector<Colour>>;
+
+//----------------------------------------------------------------------------------------------------------------------
+// palette_from_handler
+// 'nim palette --from <images...>'
+
+func palette_from_handler(const CmdLine& cmdLine) -> int;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,78 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Platform layer
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <platform.h>
+
+#ifdef _WIN32
+#   include <Windows.h>
+#   include <Psapi.h>
+#else
+#   include <pthread.h>
+#   include <sched.h>
+#   include <sys/resource.h>
+#   include <unistd.h>
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+// executableDir
+
+func executableDir() -> string
+{
+#ifdef _WIN32
+    vector<char> buf(MAX_PATH);
+    for (;;)
+    {
+        DWORD len = GetModuleFileNameA(nullptr, buf.data(), DWORD(buf.size()));
+        if (len < buf.size())
+        {
+            return fs::path(string(buf.data(), len)).parent_path().string();
+        }
+        buf.resize(3 * buf.size() / 2);
+    }
+#else
+    error_code ec;
+    fs::path exe = fs::read_symlink("/proc/self/exe", ec);
+    return ec ? string() : exe.parent_path().string();
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// peakMemory
+
+func peakMemory() -> u64
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    pmc.cb = sizeof(pmc);
+    return GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)) ? u64(pmc.PeakWorkingSetSize) : 0;
+#else
+    rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? u64(usage.ru_maxrss) * 1024 : 0;     // ru_maxrss is in KB
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// pinThread
+
+func pinThread(int cpu) -> void
+{
+#ifdef _WIN32
+    if (cpu < 64)
+    {
+        SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+    }
+#elif defined(__linux__)
+    if (cpu < CPU_SETSIZE)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,31 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Platform layer
+// The few operating system services nim needs that the standard library doesn't cover.  Implemented for Windows and
+// Linux.  File mapping lives in mapping.h.
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// executableDir
+// Returns the directory containing the running executable.
+
+func executableDir() -> string;
+
+//----------------------------------------------------------------------------------------------------------------------
+// peakMemory
+// Returns the peak resident memory of the process in bytes, or 0 if it is not known.
+
+func peakMemory() -> u64;
+
+//----------------------------------------------------------------------------------------------------------------------
+// pinThread
+// Binds the calling thread to one hardware thread.  Best effort: failures (e.g. the CPU is outside the process's
+// allowed set) are ignored.
+
+func pinThread(int cpu) -> void;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
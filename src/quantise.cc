@@ -0,0 +1,685 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Colour quantisation
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <quantise.h>
+#include <climits>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#   define NIM_X86 1
+#   include <immintrin.h>
+#   if defined(_MSC_VER)
+#       include <intrin.h>
+#       define NIM_TARGET_AVX2
+#   else
+#       define NIM_TARGET_AVX2 __attribute__((target("avx2")))
+#   endif
+#endif
+
+#if defined(_MSC_VER)
+#   define NIM_NOINLINE __declspec(noinline)
+#else
+#   define NIM_NOINLINE __attribute__((noinline))
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+// nearestColour
+
+func nearestColour(const Palette& p, u8 r, u8 g, u8 b) -> u8
+{
+    int d = 256 * 256 * 256;
+    u8 x = 0;
+
+    for (int i = 0; i < p.numColours(); ++i)
+    {
+        if (i == p.getTransColour()) continue;
+
+        int dx = kColour_3bit[p[i].m_red] - int(r);
+        int dy = kColour_3bit[p[i].m_green] - int(g);
+        int dz = kColour_3bit[p[i].m_blue] - int(b);
+        int dist = dx * dx + dy * dy + dz * dz;
+
+        if (dist < d)
+        {
+            d = dist;
+            x = u8(i);
+        }
+    }
+
+    return x;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// PaletteSoA
+//----------------------------------------------------------------------------------------------------------------------
+
+// Component value for masked entries.  Far enough from 0-255 that its distance always loses, small enough that three
+// squared differences still fit in 32 bits.
+static const i16 kMaskedComponent = 1024;
+
+//----------------------------------------------------------------------------------------------------------------------
+// pickNearest
+// Horizontal argmin over per-lane results.  Each lane holds its lowest index among equal distances, so picking the
+// lowest index among the minimum distances matches a sequential search.
+
+static func pickNearest(const i32* dist, const i32* idx, int numLanes) -> u8
+{
+    i32 d = dist[0];
+    i32 x = idx[0];
+    for (int i = 1; i < numLanes; ++i)
+    {
+        if (dist[i] < d || (dist[i] == d && idx[i] < x))
+        {
+            d = dist[i];
+            x = idx[i];
+        }
+    }
+
+    return u8(x);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// nearestScalar
+
+static func nearestScalar(const PaletteSoA& pal, u8 r, u8 g, u8 b) -> u8
+{
+    const i16* red = pal.red();
+    const i16* green = pal.green();
+    const i16* blue = pal.blue();
+
+    int d = INT_MAX;
+    u8 x = 0;
+    for (int i = 0; i < pal.size(); ++i)
+    {
+        int dx = red[i] - int(r);
+        int dy = green[i] - int(g);
+        int dz = blue[i] - int(b);
+        int dist = dx * dx + dy * dy + dz * dz;
+
+        if (dist < d)
+        {
+            d = dist;
+            x = u8(i);
+        }
+    }
+
+    return x;
+}
+
+#if NIM_X86
+
+//----------------------------------------------------------------------------------------------------------------------
+// nearestSse2
+// 8 entries per iteration.  Differences are interleaved as (dr, dg) and (db, 0) 16-bit pairs so that madd produces
+// 32-bit partial squared distances.
+
+static func nearestSse2(const PaletteSoA& pal, u8 r, u8 g, u8 b) -> u8
+{
+    const __m128i pr = _mm_set1_epi16(r);
+    const __m128i pg = _mm_set1_epi16(g);
+    const __m128i pb = _mm_set1_epi16(b);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i step = _mm_set1_epi32(8);
+
+    __m128i idxLo = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i idxHi = _mm_setr_epi32(4, 5, 6, 7);
+    __m128i bestLo = _mm_set1_epi32(INT_MAX);
+    __m128i bestHi = bestLo;
+    __m128i bestIdxLo = zero;
+    __m128i bestIdxHi = zero;
+
+    for (int i = 0; i < pal.size(); i += 8)
+    {
+        __m128i dr = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(pal.red() + i)), pr);
+        __m128i dg = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(pal.green() + i)), pg);
+        __m128i db = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(pal.blue() + i)), pb);
+
+        __m128i rgLo = _mm_unpacklo_epi16(dr, dg);
+        __m128i rgHi = _mm_unpackhi_epi16(dr, dg);
+        __m128i bLo = _mm_unpacklo_epi16(db, zero);
+        __m128i bHi = _mm_unpackhi_epi16(db, zero);
+        __m128i distLo = _mm_add_epi32(_mm_madd_epi16(rgLo, rgLo), _mm_madd_epi16(bLo, bLo));
+        __m128i distHi = _mm_add_epi32(_mm_madd_epi16(rgHi, rgHi), _mm_madd_epi16(bHi, bHi));
+
+        __m128i ltLo = _mm_cmplt_epi32(distLo, bestLo);
+        __m128i ltHi = _mm_cmplt_epi32(distHi, bestHi);
+        bestLo = _mm_or_si128(_mm_and_si128(ltLo, distLo), _mm_andnot_si128(ltLo, bestLo));
+        bestHi = _mm_or_si128(_mm_and_si128(ltHi, distHi), _mm_andnot_si128(ltHi, bestHi));
+        bestIdxLo = _mm_or_si128(_mm_and_si128(ltLo, idxLo), _mm_andnot_si128(ltLo, bestIdxLo));
+        bestIdxHi = _mm_or_si128(_mm_and_si128(ltHi, idxHi), _mm_andnot_si128(ltHi, bestIdxHi));
+
+        idxLo = _mm_add_epi32(idxLo, step);
+        idxHi = _mm_add_epi32(idxHi, step);
+    }
+
+    alignas(16) i32 dist[8];
+    alignas(16) i32 idx[8];
+    _mm_store_si128((__m128i*)dist, bestLo);
+    _mm_store_si128((__m128i*)(dist + 4), bestHi);
+    _mm_store_si128((__m128i*)idx, bestIdxLo);
+    _mm_store_si128((__m128i*)(idx + 4), bestIdxHi);
+
+    return pickNearest(dist, idx, 8);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// nearestAvx2
+// As nearestSse2 but 16 entries per iteration.  The 256-bit unpacks work within 128-bit lanes, so the low half holds
+// entries 0-3 and 8-11 and the high half entries 4-7 and 12-15.
+
+NIM_TARGET_AVX2 static func nearestAvx2(const PaletteSoA& pal, u8 r, u8 g, u8 b) -> u8
+{
+    const __m256i pr = _mm256_set1_epi16(r);
+    const __m256i pg = _mm256_set1_epi16(g);
+    const __m256i pb = _mm256_set1_epi16(b);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i step = _mm256_set1_epi32(16);
+
+    __m256i idxLo = _mm256_setr_epi32(0, 1, 2, 3, 8, 9, 10, 11);
+    __m256i idxHi = _mm256_setr_epi32(4, 5, 6, 7, 12, 13, 14, 15);
+    __m256i bestLo = _mm256_set1_epi32(INT_MAX);
+    __m256i bestHi = bestLo;
+    __m256i bestIdxLo = zero;
+    __m256i bestIdxHi = zero;
+
+    for (int i = 0; i < pal.size(); i += 16)
+    {
+        __m256i dr = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(pal.red() + i)), pr);
+        __m256i dg = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(pal.green() + i)), pg);
+        __m256i db = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(pal.blue() + i)), pb);
+
+        __m256i rgLo = _mm256_unpacklo_epi16(dr, dg);
+        __m256i rgHi = _mm256_unpackhi_epi16(dr, dg);
+        __m256i bLo = _mm256_unpacklo_epi16(db, zero);
+        __m256i bHi = _mm256_unpackhi_epi16(db, zero);
+        __m256i distLo = _mm256_add_epi32(_mm256_madd_epi16(rgLo, rgLo), _mm256_madd_epi16(bLo, bLo));
+        __m256i distHi = _mm256_add_epi32(_mm256_madd_epi16(rgHi, rgHi), _mm256_madd_epi16(bHi, bHi));
+
+        __m256i ltLo = _mm256_cmpgt_epi32(bestLo, distLo);
+        __m256i ltHi = _mm256_cmpgt_epi32(bestHi, distHi);
+        bestLo = _mm256_blendv_epi8(bestLo, distLo, ltLo);
+        bestHi = _mm256_blendv_epi8(bestHi, distHi, ltHi);
+        bestIdxLo = _mm256_blendv_epi8(bestIdxLo, idxLo, ltLo);
+        bestIdxHi = _mm256_blendv_epi8(bestIdxHi, idxHi, ltHi);
+
+        idxLo = _mm256_add_epi32(idxLo, step);
+        idxHi = _mm256_add_epi32(idxHi, step);
+    }
+
+    alignas(32) i32 dist[16];
+    alignas(32) i32 idx[16];
+    _mm256_store_si256((__m256i*)dist, bestLo);
+    _mm256_store_si256((__m256i*)(dist + 8), bestHi);
+    _mm256_store_si256((__m256i*)idx, bestIdxLo);
+    _mm256_store_si256((__m256i*)(idx + 8), bestIdxHi);
+
+    return pickNearest(dist, idx, 16);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// cpuHasAvx2
+// AVX2 needs both CPU support and the OS saving the YMM registers on context switches.
+
+static func cpuHasAvx2() -> bool
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // NIM_X86
+
+//----------------------------------------------------------------------------------------------------------------------
+// selectKernel
+// Chooses the fastest kernel for this CPU.  Setting the environment variable NIM_SIMD to "avx2", "sse2" or "scalar"
+// restricts the choice, which is useful for comparing kernels.
+
+static func selectKernel() -> PaletteSoA::Kernel
+{
+    const char* env = getenv("NIM_SIMD");
+    string limit = env ? env : "";
+
+#if NIM_X86
+    if ((limit.empty() || limit == "avx2") && cpuHasAvx2()) return nearestAvx2;
+    if (limit != "scalar") return nearestSse2;
+#endif
+
+    return nearestScalar;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Constructor
+
+PaletteSoA::PaletteSoA(const Palette& p)
+{
+    static const Kernel kernel = selectKernel();
+
+    int padded = (p.numColours() + 15) & ~15;
+    m_red.assign(padded, kMaskedComponent);
+    m_green.assign(padded, kMaskedComponent);
+    m_blue.assign(padded, kMaskedComponent);
+
+    for (int i = 0; i < p.numColours(); ++i)
+    {
+        if (i == p.getTransColour()) continue;
+
+        m_red[i] = i16(kColour_3bit[p[i].m_red]);
+        m_green[i] = i16(kColour_3bit[p[i].m_green]);
+        m_blue[i] = i16(kColour_3bit[p[i].m_blue]);
+    }
+
+    m_kernel = kernel;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// ColourCube
+//----------------------------------------------------------------------------------------------------------------------
+
+//----------------------------------------------------------------------------------------------------------------------
+// Constructor
+// For every cell, the entry with the smallest worst-case distance bounds the search: any entry whose best-case
+// distance to the cell exceeds that bound can never be nearest to a colour inside the cell.
+
+ColourCube::ColourCube(const Palette& p)
+    : m_cells(32 * 32 * 32)
+{
+    int numColours = p.numColours();
+    m_red.resize(numColours);
+    m_green.resize(numColours);
+    m_blue.resize(numColours);
+
+    for (int i = 0; i < numColours; ++i)
+    {
+        m_red[i] = kColour_3bit[p[i].m_red];
+        m_green[i] = kColour_3bit[p[i].m_green];
+        m_blue[i] = kColour_3bit[p[i].m_blue];
+    }
+
+    // Per axis: minimum and maximum squared distance from each cell span to each 3-bit level.
+    int minAxis[32][8];
+    int maxAxis[32][8];
+    for (int c = 0; c < 32; ++c)
+    {
+        int lo = c * 8;
+        int hi = lo + 7;
+        for (int l = 0; l < 8; ++l)
+        {
+            int v = kColour_3bit[l];
+            int dMin = v < lo ? lo - v : (v > hi ? v - hi : 0);
+            int dMax = max(abs(v - lo), abs(v - hi));
+            minAxis[c][l] = dMin * dMin;
+            maxAxis[c][l] = dMax * dMax;
+        }
+    }
+
+    vector<int> minDist(numColours);
+    vector<u8> candidates;
+    candidates.reserve(numColours);
+
+    for (int cr = 0; cr < 32; ++cr)
+    {
+        for (int cg = 0; cg < 32; ++cg)
+        {
+            for (int cb = 0; cb < 32; ++cb)
+            {
+                int bound = INT_MAX;
+                int best = 0;
+
+                for (int i = 0; i < numColours; ++i)
+                {
+                    if (i == p.getTransColour()) continue;
+
+                    const Colour& c = p[i];
+                    minDist[i] = minAxis[cr][c.m_red] + minAxis[cg][c.m_green] + minAxis[cb][c.m_blue];
+                    int maxDist = maxAxis[cr][c.m_red] + maxAxis[cg][c.m_green] + maxAxis[cb][c.m_blue];
+                    if (maxDist < bound)
+                    {
+                        bound = maxDist;
+                        best = i;
+                    }
+                }
+
+                candidates.clear();
+                for (int i = 0; i < numColours; ++i)
+                {
+                    if (i == p.getTransColour()) continue;
+                    if (minDist[i] <= bound) candidates.push_back(u8(i));
+                }
+
+                u32& cell = m_cells[(cr << 10) | (cg << 5) | cb];
+                if (candidates.size() <= 1)
+                {
+                    cell = u32(best);
+                }
+                else
+                {
+                    cell = kAmbiguous | (u32(candidates.size() - 1) << 23) | u32(m_candidates.size());
+                    m_candidates.insert(m_candidates.end(), candidates.begin(), candidates.end());
+                }
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// refine
+// Exact search over the candidates of an ambiguous cell.
+
+func ColourCube::refine(u32 cell, u8 r, u8 g, u8 b) const -> u8
+{
+    const u8* scan = m_candidates.data() + (cell & 0x7fffff);
+    const u8* end = scan + ((cell >> 23) & 0xff) + 1;
+
+    int d = INT_MAX;
+    u8 x = 0;
+    for (; scan != end; ++scan)
+    {
+        int i = *scan;
+        int dx = m_red[i] - int(r);
+        int dy = m_green[i] - int(g);
+        int dz = m_blue[i] - int(b);
+        int dist = dx * dx + dy * dy + dz * dz;
+
+        if (dist < d)
+        {
+            d = dist;
+            x = u8(i);
+        }
+    }
+
+    return x;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// ColourMemo
+//----------------------------------------------------------------------------------------------------------------------
+
+ColourMemo::ColourMemo()
+    : m_owner(0)
+    , m_hits(0)
+    , m_misses(0)
+    , m_windowStart(0)
+    , m_windowMisses(0)
+    , m_skip(0)
+    , m_skipLength(kMinSkip)
+{
+    resize(kMinSlots);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// reset
+
+func ColourMemo::reset(u64 owner) -> void
+{
+    m_owner = owner;
+    m_windowStart = m_hits + m_misses;
+    m_windowMisses = 0;
+    m_skip = 0;
+    m_skipLength = kMinSkip;
+    resize(kMinSlots);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// endWindow
+// Called when a window reaches its miss limit.  If that took fewer than kWindow lookups, the hit rate is too low and
+// the memo is skipped for a while.  Its contents are kept for when it is tried again.
+
+func ColourMemo::endWindow() -> void
+{
+    u64 lookups = m_hits + m_misses;
+    if (lookups - m_windowStart < kWindow)
+    {
+        m_skip = m_skipLength;
+        m_skipLength = min(m_skipLength * 2, kMaxSkip);
+    }
+    else
+    {
+        m_skipLength = kMinSkip;
+    }
+
+    m_windowStart = lookups;
+    m_windowMisses = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// resize
+// Empties the table and gives it numSlots slots (a power of two).
+
+func ColourMemo::resize(u32 numSlots) -> void
+{
+    m_keys.assign(numSlots, 0);
+    m_values.assign(numSlots, 0);
+    m_mask = numSlots - 1;
+    m_shift = 32;
+    for (u32 n = numSlots; n > 1; n >>= 1) --m_shift;
+    m_count = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// insert
+// Keeps the table at most half full so probes stay short.
+
+func ColourMemo::insert(u32 pixel, u8 index) -> void
+{
+    if (2 * (m_count + 1) > m_keys.size())
+    {
+        u32 numSlots = u32(m_keys.size());
+        if (numSlots < kMaxSlots)
+        {
+            vector<u32> keys = move(m_keys);
+            vector<u8> values = move(m_values);
+            resize(numSlots * 2);
+            for (u32 i = 0; i < numSlots; ++i)
+            {
+                if (keys[i]) insert(keys[i], values[i]);
+            }
+        }
+        else
+        {
+            resize(numSlots);
+        }
+    }
+
+    u32 i = hash(pixel);
+    while (m_keys[i] != 0) i = (i + 1) & m_mask;
+    m_keys[i] = pixel;
+    m_values[i] = index;
+    ++m_count;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Quantiser
+//----------------------------------------------------------------------------------------------------------------------
+
+// Memos live with the thread, and are reset when it starts converting with a different quantiser.
+static thread_local ColourMemo tl_memo;
+
+static atomic<u64> g_nextQuantiserId(1);
+
+Quantiser::Quantiser(const Palette& p)
+    : m_palette(p)
+    , m_soa(p)
+    , m_cubePtr(nullptr)
+    , m_id(g_nextQuantiserId++)
+{
+    for (int i = 0; i < 512; ++i)
+    {
+        m_hardware[i] = m_soa.nearest(u8(kColour_3bit[i >> 6]), u8(kColour_3bit[(i >> 3) & 7]), u8(kColour_3bit[i & 7]));
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// buildCube
+// Builds the lookup cube on first call.  Conversions already running on other threads keep using the SIMD search until
+// their next call to convertRows().
+
+func Quantiser::buildCube() -> void
+{
+    call_once(m_cubeOnce, [this] {
+        m_cube = make_unique<ColourCube>(m_palette);
+        m_cubePtr.store(m_cube.get(), memory_order_release);
+    });
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// search
+// The slow path of index(), kept out of line so the inlined table lookups stay compact: refines an ambiguous cube
+// cell, or searches the whole palette without a cube, going through the memo when it is earning its keep.
+
+NIM_NOINLINE func Quantiser::search(u32 pixel, u32 cell, const ColourCube* cube, ColourMemo* memo) const -> u8
+{
+    u8 r = u8(pixel);
+    u8 g = u8(pixel >> 8);
+    u8 b = u8(pixel >> 16);
+
+    u8 index;
+    if (memo && memo->enabled())
+    {
+        if (!memo->find(pixel, index))
+        {
+            index = cube ? cube->refine(cell, r, g, b) : m_soa.nearest(r, g, b);
+            memo->insert(pixel, index);
+        }
+    }
+    else
+    {
+        index = cube ? cube->refine(cell, r, g, b) : m_soa.nearest(r, g, b);
+    }
+    return index;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// convertRows
+
+func Quantiser::convertRows(const u32* src, int width, int numRows, u8* dst, bool bit4,
+                            LookupCounts* counts) const -> void
+{
+    const ColourCube* cube = m_cubePtr.load(memory_order_acquire);
+
+    ColourMemo* memo = &tl_memo;
+    if (memo->owner() != m_id)
+    {
+        memo->reset(m_id);
+    }
+    u64 hits = memo->hits();
+    u64 misses = memo->misses();
+
+    for (int row = 0; row < numRows; ++row)
+    {
+        if (bit4)
+        {
+            for (int col = 0; col < width; col += 2)
+            {
+                *dst++ = u8((index(src[0], cube, memo) << 4) + index(src[1], cube, memo));
+                src += 2;
+            }
+        }
+        else
+        {
+            for (int col = 0; col < width; ++col)
+            {
+                *dst++ = index(*src++, cube, memo);
+            }
+        }
+    }
+
+    if (counts)
+    {
+        counts->memoHits += memo->hits() - hits;
+        counts->memoMisses += memo->misses() - misses;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// remapTable
+
+func Quantiser::remapTable(const u32* colours) const -> array<u8, 256>
+{
+    const ColourCube* cube = m_cubePtr.load(memory_order_acquire);
+
+    array<u8, 256> table;
+    for (int i = 0; i < 256; ++i)
+    {
+        table[i] = index(colours[i], cube, nullptr);
+    }
+    return table;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// remapRows
+// One table read per pixel, with no branches, so this runs at memory speed.
+
+func Quantiser::remapRows(const u8* src, const array<u8, 256>& table, int width, int numRows, u8* dst,
+                          bool bit4) -> void
+{
+    size_t count = size_t(width) * numRows;
+
+    if (bit4)
+    {
+        for (size_t i = 0; i < count; i += 2)
+        {
+            *dst++ = u8((table[src[i]] << 4) + table[src[i + 1]]);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            dst[i] = table[src[i]];
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// countLookups
+
+func Quantiser::countLookups(const u32* src, size_t count, LookupCounts& counts) const -> void
+{
+    const ColourCube* cube = m_cubePtr.load(memory_order_acquire);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        u32 pixel = src[i];
+        u8 r = u8(pixel);
+        u8 g = u8(pixel >> 8);
+        u8 b = u8(pixel >> 16);
+
+        if ((pixel >> 24) != 255)
+        {
+            ++counts.transparent;
+        }
+        else if (((kHardware3[r] << 6) | (kHardware3[g] << 3) | kHardware3[b]) < 512)
+        {
+            ++counts.hardware;
+        }
+        else if (!cube)
+        {
+            ++counts.searches;
+        }
+        else if (ColourCube::isAmbiguous(cube->cell(r, g, b)))
+        {
+            ++counts.cubeRefines;
+        }
+        else
+        {
+            ++counts.cubeHits;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,265 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Colour quantisation
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+#include <palette.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+//----------------------------------------------------------------------------------------------------------------------
+// nearestColour
+// Brute force search for the palette index nearest to an RGB colour, skipping the transparent index.  Ties resolve to
+// the lowest index.
+
+func nearestColour(const Palette& p, u8 r, u8 g, u8 b) -> u8;
+
+//----------------------------------------------------------------------------------------------------------------------
+// PaletteSoA
+// The palette expanded to 8-bit components in separate red, green and blue arrays, padded to a multiple of 16 entries.
+// The transparent index and the padding hold an out of range value so they can never be nearest.  nearest() uses an
+// AVX2 or SSE2 kernel when the CPU supports it, otherwise a scalar loop.  Results always match nearestColour().
+
+class PaletteSoA
+{
+public:
+    PaletteSoA(const Palette& p);
+
+    func nearest(u8 r, u8 g, u8 b) const -> u8 { return m_kernel(*this, r, g, b); }
+
+    func size() const -> int { return int(m_red.size()); }
+    func red() const -> const i16* { return m_red.data(); }
+    func green() const -> const i16* { return m_green.data(); }
+    func blue() const -> const i16* { return m_blue.data(); }
+
+    using Kernel = u8(*)(const PaletteSoA&, u8, u8, u8);
+
+private:
+    vector<i16> m_red;
+    vector<i16> m_green;
+    vector<i16> m_blue;
+    Kernel m_kernel;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// ColourCube
+// A 32x32x32 lookup cube mapping RGB colours to their nearest palette index, built once per palette.  Each cell covers
+// 8x8x8 source colours.  Cells where a single palette entry is nearest to every colour inside it store that index
+// directly.  Ambiguous cells store a short list of candidate entries that is searched exactly, so results always match
+// nearestColour().
+
+class ColourCube
+{
+public:
+    ColourCube(const Palette& p);
+
+    func lookup(u8 r, u8 g, u8 b) const -> u8
+    {
+        u32 c = cell(r, g, b);
+        return isAmbiguous(c) ? refine(c, r, g, b) : u8(c);
+    }
+
+    // The cell covering a colour.  Unambiguous cells are the palette index itself; ambiguous ones need refine().
+    func cell(u8 r, u8 g, u8 b) const -> u32 { return m_cells[((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3)]; }
+    static func isAmbiguous(u32 cell) -> bool { return (cell & kAmbiguous) != 0; }
+    func refine(u32 cell, u8 r, u8 g, u8 b) const -> u8;
+
+private:
+    static constexpr u32 kAmbiguous = 0x80000000;
+
+private:
+    vector<u32> m_cells;            // Index, or kAmbiguous | (count - 1) << 23 | offset into m_candidates
+    vector<u8> m_candidates;        // Candidate palette indices for ambiguous cells, in ascending order
+    vector<int> m_red;              // Palette expanded to 8-bit components
+    vector<int> m_green;
+    vector<int> m_blue;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// LookupCounts
+// How a run of pixels' palette lookups were resolved.
+
+struct LookupCounts
+{
+    u64 transparent = 0;        // Non-opaque pixels, mapped straight to the transparent index
+    u64 hardware = 0;           // Exact hardware colours, resolved by the 512-entry table
+    u64 cubeHits = 0;           // Resolved by a single lookup cube read
+    u64 cubeRefines = 0;        // Resolved by searching an ambiguous cube cell's candidates
+    u64 searches = 0;           // Resolved by a SIMD search of the whole palette
+    u64 remapped = 0;           // Indexed image pixels, mapped through a table built from the image's own colours
+    u64 dithered = 0;           // Pixels converted with dithering, which are not classified
+    u64 memoHits = 0;           // Refines and searches skipped because the pixel was in the ColourMemo
+    u64 memoMisses = 0;
+
+    func merge(const LookupCounts& other) -> void
+    {
+        transparent += other.transparent;
+        hardware += other.hardware;
+        cubeHits += other.cubeHits;
+        cubeRefines += other.cubeRefines;
+        searches += other.searches;
+        remapped += other.remapped;
+        dithered += other.dithered;
+        memoHits += other.memoHits;
+        memoMisses += other.memoMisses;
+    }
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// ColourMemo
+// A small open-addressing hash table remembering the palette index found for recently searched pixels, so images with
+// few distinct colours skip most searches.  Keys are opaque RGBA pixels, so 0 marks an empty slot.  The table starts
+// small and doubles while new colours keep arriving, up to kMaxSlots, after which it is cleared when it fills.  When
+// too few lookups hit (photographs, noise), the memo switches itself off for a while, and for longer each time, as
+// misses cost more than the search they fail to save.  Each thread has its own.
+
+class ColourMemo
+{
+public:
+    ColourMemo();
+
+    // Empties the table and makes it belong to the given quantiser.
+    func reset(u64 owner) -> void;
+    func owner() const -> u64 { return m_owner; }
+
+    // True if the memo should be consulted for the next pixel.
+    func enabled() -> bool
+    {
+        if (m_skip == 0) return true;
+        --m_skip;
+        return false;
+    }
+
+    func find(u32 pixel, u8& index) -> bool
+    {
+        for (u32 i = hash(pixel);; i = (i + 1) & m_mask)
+        {
+            if (m_keys[i] == pixel)
+            {
+                index = m_values[i];
+                ++m_hits;
+                return true;
+            }
+            if (m_keys[i] == 0)
+            {
+                ++m_misses;
+                if (++m_windowMisses == kMaxWindowMisses) endWindow();
+                return false;
+            }
+        }
+    }
+
+    func insert(u32 pixel, u8 index) -> void;
+
+    func hits() const -> u64 { return m_hits; }
+    func misses() const -> u64 { return m_misses; }
+
+private:
+    static constexpr u32 kMinSlots = 256;
+    static constexpr u32 kMaxSlots = 16384;
+    static constexpr u32 kWindow = 4096;            // Lookups between checks of the hit rate
+    static constexpr u32 kMaxWindowMisses = kWindow / 8;
+    static constexpr u32 kMinSkip = 16 * kWindow;   // Pixels to go without the memo after a poor window, doubling
+    static constexpr u32 kMaxSkip = 1 << 24;        // for each poor window in a row
+
+    func hash(u32 pixel) const -> u32 { return (pixel * 0x9e3779b1u) >> m_shift; }
+    func resize(u32 numSlots) -> void;
+    func endWindow() -> void;
+
+private:
+    vector<u32> m_keys;
+    vector<u8> m_values;
+    u32 m_mask;
+    int m_shift;
+    u32 m_count;
+    u64 m_owner;
+    u64 m_hits;
+    u64 m_misses;
+    u64 m_windowStart;              // m_hits + m_misses when the current window began
+    u32 m_windowMisses;
+    u32 m_skip;                     // Pixels left before the memo is used again
+    u32 m_skipLength;               // Length of the next skip
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// Quantiser
+// Converts rows of RGBA pixels (as loaded by stb_image) to palette indices.  Non-opaque pixels map to the transparent
+// index.  Pixels that are already hardware colours (every component one of kColour_3bit) map through a 512-entry
+// table built with the palette.  Other colours use the SIMD kernels until buildCube() is called, after which the
+// lookup cube is used.  Colours needing a search or an ambiguous cube cell go through the calling thread's ColourMemo
+// first.  Indexed images skip all of this: each of their colours is looked up once and the indices are remapped.  A
+// Quantiser can be shared between threads, and buildCube() may be called from any of them.
+
+class Quantiser
+{
+public:
+    Quantiser(const Palette& p);
+
+    func palette() const -> const Palette& { return m_palette; }
+    func buildCube() -> void;
+
+    func index(u32 pixel) const -> u8 { return index(pixel, m_cubePtr.load(memory_order_acquire), nullptr); }
+
+    // Convert numRows rows of width pixels.  In 4-bit mode, width must be even and each row packs two pixels per byte,
+    // high nibble first.  If counts is given, the memo hits and misses are added to it.
+    func convertRows(const u32* src, int width, int numRows, u8* dst, bool bit4,
+                     LookupCounts* counts = nullptr) const -> void;
+
+    // Maps each of an indexed image's 256 colours (see ImageReader::colourTable()) to a palette index.
+    func remapTable(const u32* colours) const -> array<u8, 256>;
+
+    // Convert numRows rows of width source indices through a table from remapTable(), packing as convertRows() does.
+    static func remapRows(const u8* src, const array<u8, 256>& table, int width, int numRows, u8* dst,
+                          bool bit4) -> void;
+
+    // Classifies how index() would resolve each of count pixels, without converting them.
+    func countLookups(const u32* src, size_t count, LookupCounts& counts) const -> void;
+
+private:
+    // Returns the palette index for a single RGBA pixel.  The common cases are table lookups, inlined into the
+    // conversion loops.
+    func index(u32 pixel, const ColourCube* cube, ColourMemo* memo) const -> u8
+    {
+        u8 a = (pixel & 0xff000000) >> 24;
+        u8 b = (pixel & 0x00ff0000) >> 16;
+        u8 g = (pixel & 0x0000ff00) >> 8;
+        u8 r = (pixel & 0x000000ff);
+
+        if (a != 255)
+        {
+            return m_palette.getTransColour();
+        }
+
+        u32 hw = (kHardware3[r] << 6) | (kHardware3[g] << 3) | kHardware3[b];
+        if (hw < 512)
+        {
+            return m_hardware[hw];
+        }
+
+        u32 cell = 0;
+        if (cube)
+        {
+            cell = cube->cell(r, g, b);
+            if (!ColourCube::isAmbiguous(cell)) return u8(cell);
+        }
+
+        return search(pixel, cell, cube, memo);
+    }
+
+    func search(u32 pixel, u32 cell, const ColourCube* cube, ColourMemo* memo) const -> u8;
+
+private:
+    const Palette& m_palette;
+    PaletteSoA m_soa;
+    array<u8, 512> m_hardware;      // Nearest index for each RRRGGGBBB hardware colour
+    unique_ptr<ColourCube> m_cube;
+    atomic<const ColourCube*> m_cubePtr;
+    once_flag m_cubeOnce;
+    u64 m_id;                       // Unique for the life of the process, to tag ColourMemos
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,1663 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Image decoding
+//----------------------------------------------------------------------------------------------------------------------
+//
+// The streaming decoders cover the common cases of each format and produce exactly what stb_image would.  GIFs are
+// decoded in full but keep their indices, so they can be remapped rather than searched.  Anything else (interlaced or
+// 16-bit PNGs, RLE or 16/32-bit BMPs, bottom-up RLE TGAs, other formats) falls back to a full decode with stb_image.
+//
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <inflate.h>
+#include <reader.h>
+#include <scratch.h>
+#include <climits>
+#include <cstring>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// InputFile
+//----------------------------------------------------------------------------------------------------------------------
+
+InputFile::InputFile(const fs::path& path)
+    : m_map(MappedFile::openRead(path))
+    , m_pos(0)
+    , m_failed(false)
+{
+}
+
+func InputFile::view(size_t size) -> const u8*
+{
+    if (size > size_t(m_map.size() - m_pos))
+    {
+        m_pos = m_map.size();
+        m_failed = true;
+        return nullptr;
+    }
+
+    const u8* p = m_map.data() + m_pos;
+    m_pos += size;
+    return p;
+}
+
+func InputFile::read(void* dst, size_t size) -> size_t
+{
+    size_t n = min(size, size_t(m_map.size() - m_pos));
+    memcpy(dst, m_map.data() + m_pos, n);
+    m_pos += n;
+    if (n != size) m_failed = true;
+    return n;
+}
+
+func InputFile::seek(u64 pos) -> bool
+{
+    if (pos > m_map.size())
+    {
+        m_failed = true;
+        return false;
+    }
+    m_pos = pos;
+    return true;
+}
+
+func InputFile::skip(u64 n) -> bool
+{
+    return seek(m_pos + n);
+}
+
+func InputFile::byte() -> u8
+{
+    u8 b = 0;
+    read(&b, 1);
+    return b;
+}
+
+func InputFile::u16le() -> u16
+{
+    u8 b[2] = {};
+    read(b, 2);
+    return u16(b[0] | (b[1] << 8));
+}
+
+func InputFile::u32le() -> u32
+{
+    u8 b[4] = {};
+    read(b, 4);
+    return u32(b[0]) | (u32(b[1]) << 8) | (u32(b[2]) << 16) | (u32(b[3]) << 24);
+}
+
+func InputFile::u32be() -> u32
+{
+    u8 b[4] = {};
+    read(b, 4);
+    return (u32(b[0]) << 24) | (u32(b[1]) << 16) | (u32(b[2]) << 8) | u32(b[3]);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Pixel packing
+// stb_image returns bytes R, G, B, A in memory, i.e. little endian ABGR words.
+
+static func rgba(u8 r, u8 g, u8 b, u8 a) -> u32
+{
+    return u32(r) | (u32(g) << 8) | (u32(b) << 16) | (u32(a) << 24);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// StbReader
+// Decodes the whole image from the mapped file with stb_image and hands it out a band at a time.
+
+class StbReader : public ImageReader
+{
+public:
+    StbReader(const fs::path& path)
+        : m_pixels(nullptr, stbi_image_free)
+        , m_row(0)
+    {
+        InputFile file(path);
+        if (!file.isOpen() || file.size() > u64(INT_MAX))
+        {
+            m_error = "can't open file";
+            return;
+        }
+
+        int bpp;
+        m_pixels.reset((u32 *)stbi_load_from_memory(file.data(), int(file.size()), &m_width, &m_height, &bpp, 4));
+        if (!m_pixels)
+        {
+            m_error = stbi_failure_reason();
+        }
+    }
+
+    func isBuffered() const -> bool override { return true; }
+
+    func readRows(int numRows) -> const u32* override
+    {
+        const u32* rows = m_pixels.get() + size_t(m_row) * m_width;
+        m_row += numRows;
+        return rows;
+    }
+
+private:
+    unique_ptr<u32, void(*)(void*)> m_pixels;
+    int m_row;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// StreamReader
+// Common state for the streaming decoders.
+
+class StreamReader : public ImageReader
+{
+public:
+    StreamReader(const fs::path& path)
+        : m_file(path)
+        , m_row(0)
+    {
+    }
+
+protected:
+    // Makes room for numRows rows of output pixels.
+    func band(int numRows) -> u32*
+    {
+        return m_band.get<u32>(size_t(numRows) * m_width);
+    }
+
+    // Makes room for numRows rows of output indices.
+    func indexBand(int numRows) -> u8*
+    {
+        return m_band.get<u8>(size_t(numRows) * m_width);
+    }
+
+    func fail(const char* reason) -> const u32*
+    {
+        m_error = reason;
+        return nullptr;
+    }
+
+protected:
+    InputFile m_file;
+    ScratchBuffer m_band;
+    int m_row;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// BmpReader
+// Uncompressed 4, 8 and 24-bit BMPs.  Rows are stored bottom-up unless the height is negative, so bands are read
+// backwards through the file.
+
+class BmpReader : public StreamReader
+{
+public:
+    static func open(const fs::path& path) -> unique_ptr<ImageReader>
+    {
+        auto reader = make_unique<BmpReader>(path);
+        return reader->parseHeader() ? move(reader) : nullptr;
+    }
+
+    BmpReader(const fs::path& path) : StreamReader(path) {}
+
+    func readRows(int numRows) -> const u32* override
+    {
+        u32* out = band(numRows);
+        const u8* raw = rawRows(numRows);
+        if (!raw)
+        {
+            return fail("Corrupt BMP");
+        }
+
+        for (int r = 0; r < numRows; ++r)
+        {
+            const u8* src = rawRow(raw, numRows, r);
+            u32* dst = out + size_t(r) * m_width;
+
+            switch (m_bpp)
+            {
+            case 24:
+                for (int x = 0; x < m_width; ++x, src += 3)
+                {
+                    dst[x] = rgba(src[2], src[1], src[0], 255);
+                }
+                break;
+
+            case 8:
+                for (int x = 0; x < m_width; ++x)
+                {
+                    dst[x] = m_palette[src[x]];
+                }
+                break;
+
+            case 4:
+                for (int x = 0; x < m_width; ++x)
+                {
+                    u8 v = src[x >> 1];
+                    dst[x] = m_palette[(x & 1) ? (v & 15) : (v >> 4)];
+                }
+                break;
+            }
+        }
+
+        m_row += numRows;
+        return out;
+    }
+
+    func colourTable() const -> const u32* override
+    {
+        return m_bpp == 24 ? nullptr : m_palette.data();
+    }
+
+    func readIndices(int numRows) -> const u8* override
+    {
+        u8* out = indexBand(numRows);
+        const u8* raw = rawRows(numRows);
+        if (!raw)
+        {
+            m_error = "Corrupt BMP";
+            return nullptr;
+        }
+
+        for (int r = 0; r < numRows; ++r)
+        {
+            const u8* src = rawRow(raw, numRows, r);
+            u8* dst = out + size_t(r) * m_width;
+
+            if (m_bpp == 8)
+            {
+                memcpy(dst, src, m_width);
+            }
+            else
+            {
+                for (int x = 0; x < m_width; ++x)
+                {
+                    u8 v = src[x >> 1];
+                    dst[x] = (x & 1) ? (v & 15) : (v >> 4);
+                }
+            }
+        }
+
+        m_row += numRows;
+        return out;
+    }
+
+private:
+    // The file data for the next numRows rows, which are one contiguous block either way up.
+    func rawRows(int numRows) -> const u8*
+    {
+        int firstFileRow = m_bottomUp ? m_height - m_row - numRows : m_row;
+        return m_file.seek(m_offset + u64(firstFileRow) * m_stride) ? m_file.view(size_t(numRows) * m_stride) : nullptr;
+    }
+
+    func rawRow(const u8* raw, int numRows, int r) const -> const u8*
+    {
+        return raw + size_t(m_bottomUp ? numRows - 1 - r : r) * m_stride;
+    }
+
+    func parseHeader() -> bool
+    {
+        if (!m_file.isOpen() || m_file.byte() != 'B' || m_file.byte() != 'M') return false;
+        m_file.skip(8);
+        m_offset = m_file.u32le();
+        u32 headerSize = m_file.u32le();
+        if (headerSize != 40 && headerSize != 108 && headerSize != 124) return false;
+
+        i32 width = i32(m_file.u32le());
+        i32 height = i32(m_file.u32le());
+        u16 planes = m_file.u16le();
+        m_bpp = m_file.u16le();
+        u32 compression = m_file.u32le();
+        if (m_file.failed() || planes != 1 || compression != 0 || width <= 0 || height == 0) return false;
+        if (m_bpp != 4 && m_bpp != 8 && m_bpp != 24) return false;
+
+        m_width = width;
+        m_height = abs(height);
+        m_bottomUp = height > 0;
+
+        int rowBytes = m_bpp == 24 ? m_width * 3 : (m_bpp == 8 ? m_width : (m_width + 1) >> 1);
+        m_stride = (rowBytes + 3) & ~3;
+        if (m_offset + u64(m_stride) * m_height > m_file.size()) return false;
+
+        if (m_bpp < 16)
+        {
+            int numColours = int(m_offset - 14 - headerSize) >> 2;
+            if (numColours <= 0 || numColours > 256) return false;
+
+            m_palette.assign(256, rgba(0, 0, 0, 255));
+            m_file.seek(14 + headerSize);
+            for (int i = 0; i < numColours; ++i)
+            {
+                u8 bgrx[4];
+                m_file.read(bgrx, 4);
+                m_palette[i] = rgba(bgrx[2], bgrx[1], bgrx[0], 255);
+            }
+        }
+
+        return !m_file.failed();
+    }
+
+private:
+    u32 m_offset = 0;
+    int m_bpp = 0;
+    int m_stride = 0;
+    bool m_bottomUp = true;
+    vector<u32> m_palette;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// TgaReader
+// Uncompressed 8-bit grey, 24-bit and 32-bit TGAs in either orientation, and RLE ones stored top-down.
+
+class TgaReader : public StreamReader
+{
+public:
+    static func open(const fs::path& path) -> unique_ptr<ImageReader>
+    {
+        auto reader = make_unique<TgaReader>(path);
+        return reader->parseHeader() ? move(reader) : nullptr;
+    }
+
+    TgaReader(const fs::path& path) : StreamReader(path) {}
+
+    func readRows(int numRows) -> const u32* override
+    {
+        u32* out = band(numRows);
+        size_t rowBytes = size_t(m_width) * m_comp;
+
+        if (!m_rle)
+        {
+            int firstFileRow = m_bottomUp ? m_height - m_row - numRows : m_row;
+            const u8* raw = m_file.seek(m_offset + u64(firstFileRow) * rowBytes)
+                ? m_file.view(numRows * rowBytes)
+                : nullptr;
+            if (!raw)
+            {
+                return fail("Corrupt TGA");
+            }
+
+            for (int r = 0; r < numRows; ++r)
+            {
+                const u8* src = raw + (m_bottomUp ? numRows - 1 - r : r) * rowBytes;
+                u32* dst = out + size_t(r) * m_width;
+                for (int x = 0; x < m_width; ++x, src += m_comp)
+                {
+                    dst[x] = pixel(src);
+                }
+            }
+        }
+        else
+        {
+            // Packets can span rows, so the packet state carries over between bands.
+            for (size_t i = 0; i < size_t(numRows) * m_width; ++i)
+            {
+                if (m_rleCount == 0)
+                {
+                    u8 cmd = m_file.byte();
+                    m_rleCount = 1 + (cmd & 127);
+                    m_rleRepeat = (cmd >> 7) != 0;
+                    m_file.read(m_rlePixel, m_comp);
+                }
+                else if (!m_rleRepeat)
+                {
+                    m_file.read(m_rlePixel, m_comp);
+                }
+
+                out[i] = pixel(m_rlePixel);
+                --m_rleCount;
+            }
+
+            if (m_file.failed()) return fail("Corrupt TGA");
+        }
+
+        m_row += numRows;
+        return out;
+    }
+
+private:
+    func pixel(const u8* src) const -> u32
+    {
+        switch (m_comp)
+        {
+        case 1: return rgba(src[0], src[0], src[0], 255);
+        case 3: return rgba(src[2], src[1], src[0], 255);
+        default: return rgba(src[2], src[1], src[0], src[3]);
+        }
+    }
+
+    func parseHeader() -> bool
+    {
+        if (!m_file.isOpen()) return false;
+
+        u8 idLength = m_file.byte();
+        u8 colourMapType = m_file.byte();
+        u8 imageType = m_file.byte();
+        m_file.skip(9);
+        m_width = m_file.u16le();
+        m_height = m_file.u16le();
+        u8 bpp = m_file.byte();
+        u8 descriptor = m_file.byte();
+        if (m_file.failed() || colourMapType != 0 || m_width == 0 || m_height == 0) return false;
+
+        m_rle = imageType >= 8;
+        imageType &= 7;
+        if (imageType == 2 && (bpp == 24 || bpp == 32))
+        {
+            m_comp = bpp / 8;
+        }
+        else if (imageType == 3 && bpp == 8)
+        {
+            m_comp = 1;
+        }
+        else
+        {
+            return false;
+        }
+
+        m_bottomUp = ((descriptor >> 5) & 1) == 0;
+        if (m_rle && m_bottomUp) return false;
+
+        m_offset = 18 + idLength;
+        if (!m_rle && m_offset + u64(m_width) * m_height * m_comp > m_file.size()) return false;
+
+        return m_file.seek(m_offset);
+    }
+
+private:
+    u64 m_offset = 0;
+    int m_comp = 0;
+    bool m_rle = false;
+    bool m_bottomUp = true;
+
+    int m_rleCount = 0;
+    bool m_rleRepeat = false;
+    u8 m_rlePixel[4] = {};
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// ApngFrame
+// A frame of an animated PNG: its area of the canvas, what happens to the area afterwards, and its compressed data.
+
+struct ApngFrame
+{
+    int x;
+    int y;
+    int width;
+    int height;
+    u8 dispose;                 // 0 = leave, 1 = clear to transparent black, 2 = restore the canvas from before
+    u8 blend;                   // 0 = replace the area, 1 = draw over it
+    vector<pair<const u8*, size_t>> data;   // The zlib stream, in the pieces its chunks hold
+};
+
+static func be32(const u8* p) -> u32
+{
+    return (u32(p[0]) << 24) | (u32(p[1]) << 16) | (u32(p[2]) << 8) | p[3];
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// PngReader
+// Non-interlaced PNGs of up to 8 bits per channel.  The IDAT chunks are inflated in place as rows are needed, so only
+// the previous row and the inflate window are kept besides the output band.
+
+class PngReader : public StreamReader
+{
+public:
+    static func open(const fs::path& path) -> unique_ptr<ImageReader>
+    {
+        auto reader = make_unique<PngReader>(path);
+        return reader->parseHeader() ? move(reader) : nullptr;
+    }
+
+    // Opens an APNG and finds its frames.  Returns nullptr for other files, including APNGs with only one frame.
+    static func openAnimation(const fs::path& path, vector<ApngFrame>& frames) -> unique_ptr<PngReader>
+    {
+        auto reader = make_unique<PngReader>(path);
+        return reader->parseHeader() && reader->indexFrames(frames) ? move(reader) : nullptr;
+    }
+
+    PngReader(const fs::path& path)
+        : StreamReader(path)
+    {
+        m_inflater.emplace([this](const u8*& data) { return readIdat(data); });
+    }
+
+    // Switches to decoding an APNG frame, whose rows the following readRows() calls return.  The reader's size becomes
+    // the frame's.
+    func startFrame(const ApngFrame& frame) -> void
+    {
+        m_width = frame.width;
+        m_height = frame.height;
+        m_row = 0;
+        m_frameData = &frame.data;
+        m_nextData = 0;
+
+        m_lineSize = 1 + (size_t(m_width) * m_channels * m_depth + 7) / 8;
+        m_line = m_lineBuffer.get<u8>(m_lineSize);
+        m_prior = m_priorBuffer.get<u8>(m_lineSize);
+        memset(m_prior, 0, m_lineSize);
+        m_inflater.emplace([this](const u8*& data) { return readIdat(data); });
+    }
+
+    func readRows(int numRows) -> const u32* override
+    {
+        u32* out = band(numRows);
+
+        for (int r = 0; r < numRows; ++r)
+        {
+            if (!nextLine())
+            {
+                return fail("Corrupt PNG");
+            }
+            expand(out + size_t(r) * m_width);
+            swap(m_line, m_prior);
+        }
+
+        m_row += numRows;
+        return out;
+    }
+
+    func colourTable() const -> const u32* override
+    {
+        return m_colour == 3 ? m_palette.data() : m_colour == 0 ? m_greys.data() : nullptr;
+    }
+
+    func readIndices(int numRows) -> const u8* override
+    {
+        u8* out = indexBand(numRows);
+
+        for (int r = 0; r < numRows; ++r)
+        {
+            if (!nextLine())
+            {
+                m_error = "Corrupt PNG";
+                return nullptr;
+            }
+            unpack(out + size_t(r) * m_width);
+            swap(m_line, m_prior);
+        }
+
+        m_row += numRows;
+        return out;
+    }
+
+private:
+    func parseHeader() -> bool
+    {
+        static const u8 kSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+        u8 sig[8];
+        if (!m_file.isOpen() || m_file.read(sig, 8) != 8 || memcmp(sig, kSignature, 8) != 0) return false;
+
+        m_palette.assign(256, rgba(0, 0, 0, 255));
+        bool first = true;
+
+        for (;;)
+        {
+            u32 length = m_file.u32be();
+            u32 type = m_file.u32be();
+            if (m_file.failed()) return false;
+
+            switch (type)
+            {
+            case 'IHDR':
+                {
+                    if (!first || length != 13) return false;
+                    first = false;
+
+                    m_width = int(m_file.u32be());
+                    m_height = int(m_file.u32be());
+                    m_depth = m_file.byte();
+                    m_colour = m_file.byte();
+                    u8 compression = m_file.byte();
+                    u8 filter = m_file.byte();
+                    u8 interlace = m_file.byte();
+
+                    if (m_width <= 0 || m_height <= 0 || m_width > (1 << 24) || m_height > (1 << 24)) return false;
+                    if (compression || filter || interlace) return false;
+                    if (m_colour == 3 || m_colour == 0)
+                    {
+                        if (m_depth != 1 && m_depth != 2 && m_depth != 4 && m_depth != 8) return false;
+                    }
+                    else if (m_colour == 2 || m_colour == 4 || m_colour == 6)
+                    {
+                        if (m_depth != 8) return false;
+                    }
+                    else
+                    {
+                        return false;
+                    }
+
+                    static const int kChannels[] = { 1, 0, 3, 1, 2, 0, 4 };
+                    m_channels = kChannels[m_colour];
+                    int bitsPerPixel = m_channels * m_depth;
+                    m_filterBytes = max(1, bitsPerPixel / 8);
+                    m_lineSize = 1 + (size_t(m_width) * bitsPerPixel + 7) / 8;
+                    m_line = m_lineBuffer.get<u8>(m_lineSize);
+                    m_prior = m_priorBuffer.get<u8>(m_lineSize);
+                    memset(m_prior, 0, m_lineSize);
+                }
+                break;
+
+            case 'PLTE':
+                {
+                    if (first || length > 256 * 3 || length % 3) return false;
+                    m_paletteSize = length / 3;
+                    for (u32 i = 0; i < m_paletteSize; ++i)
+                    {
+                        u8 rgb[3];
+                        m_file.read(rgb, 3);
+                        m_palette[i] = rgba(rgb[0], rgb[1], rgb[2], 255);
+                    }
+                }
+                break;
+
+            case 'tRNS':
+                if (first) return false;
+                if (m_colour == 3)
+                {
+                    if (m_paletteSize == 0 || length > m_paletteSize) return false;
+                    for (u32 i = 0; i < length; ++i)
+                    {
+                        m_palette[i] = (m_palette[i] & 0x00ffffff) | (u32(m_file.byte()) << 24);
+                    }
+                }
+                else
+                {
+                    if (!(m_channels & 1) || length != u32(m_channels) * 2) return false;
+
+                    // Key colours are scaled like grey values, matching stb_image.
+                    for (int i = 0; i < m_channels; ++i)
+                    {
+                        u8 hi = m_file.byte();
+                        u8 lo = m_file.byte();
+                        (void)hi;
+                        m_key[i] = u8(lo * kScale[m_depth]);
+                    }
+                    m_hasKey = true;
+                }
+                break;
+
+            case 'IDAT':
+                if (first || (m_colour == 3 && m_paletteSize == 0)) return false;
+                m_idatLeft = length;
+                if (m_colour == 0) buildGreys();
+                return true;
+
+            case 'CgBI':
+            case 'IEND':
+                return false;
+
+            default:
+                if (first) return false;
+                m_file.skip(length);
+                break;
+            }
+
+            // Skip CRC
+            m_file.skip(4);
+            if (m_file.failed()) return false;
+        }
+    }
+
+    // Walks the chunks of the mapped file for an APNG's frame controls and data.  The default image is the first frame
+    // if a frame control comes before it, and is otherwise skipped.  Returns false if the file isn't animated, has
+    // only one frame, or has frames that don't fit the canvas or have no data.
+    func indexFrames(vector<ApngFrame>& frames) const -> bool
+    {
+        const u8* data = m_file.data();
+        u64 size = m_file.size();
+        bool animated = false;
+
+        for (u64 pos = 8; pos + 12 <= size;)
+        {
+            u32 length = be32(data + pos);
+            u32 type = be32(data + pos + 4);
+            const u8* body = data + pos + 8;
+            if (length > size - pos - 12) return false;
+
+            switch (type)
+            {
+            case 'acTL':
+                animated = true;
+                break;
+
+            case 'fcTL':
+                {
+                    if (length != 26) return false;
+                    ApngFrame frame;
+                    frame.width = int(be32(body + 4));
+                    frame.height = int(be32(body + 8));
+                    frame.x = int(be32(body + 12));
+                    frame.y = int(be32(body + 16));
+                    frame.dispose = body[24];
+                    frame.blend = body[25];
+                    if (frame.width <= 0 || frame.height <= 0 || frame.x < 0 || frame.y < 0 ||
+                        i64(frame.x) + frame.width > m_width || i64(frame.y) + frame.height > m_height ||
+                        frame.dispose > 2 || frame.blend > 1)
+                    {
+                        return false;
+                    }
+                    frames.push_back(move(frame));
+                }
+                break;
+
+            case 'IDAT':
+                // Animation control must come before the image data.
+                if (!animated) return false;
+                if (frames.size() == 1) frames.back().data.push_back({ body, length });
+                break;
+
+            case 'fdAT':
+                if (frames.empty() || length < 4) return false;
+                frames.back().data.push_back({ body + 4, length - 4 });
+                break;
+
+            case 'IEND':
+                pos = size;
+                continue;
+            }
+
+            pos += 12 + u64(length);
+        }
+
+        for (const auto& frame : frames)
+        {
+            if (frame.data.empty()) return false;
+        }
+        return animated && frames.size() > 1;
+    }
+
+    // Supplies IDAT chunks to the inflater straight from the mapped file, or the current APNG frame's data.
+    func readIdat(const u8*& data) -> size_t
+    {
+        if (m_frameData)
+        {
+            if (m_nextData == m_frameData->size()) return 0;
+            const auto& piece = (*m_frameData)[m_nextData++];
+            data = piece.first;
+            return piece.second;
+        }
+
+        while (m_idatLeft == 0)
+        {
+            m_file.skip(4);
+            u32 length = m_file.u32be();
+            u32 type = m_file.u32be();
+            if (m_file.failed() || type != 'IDAT') return 0;
+            m_idatLeft = length;
+        }
+
+        size_t n = m_idatLeft;
+        data = m_file.view(n);
+        m_idatLeft = 0;
+        return data ? n : 0;
+    }
+
+    // Inflates and unfilters the next line into m_line.
+    func nextLine() -> bool
+    {
+        return m_inflater->read(m_line, m_lineSize) == m_lineSize && unfilter();
+    }
+
+    func unfilter() -> bool
+    {
+        u8* cur = m_line + 1;
+        const u8* prior = m_prior + 1;
+        size_t n = m_lineSize - 1;
+        int bpp = m_filterBytes;
+
+        switch (m_line[0])
+        {
+        case 0:
+            break;
+
+        case 1:
+            for (size_t i = bpp; i < n; ++i) cur[i] = u8(cur[i] + cur[i - bpp]);
+            break;
+
+        case 2:
+            for (size_t i = 0; i < n; ++i) cur[i] = u8(cur[i] + prior[i]);
+            break;
+
+        case 3:
+            for (size_t i = 0; i < size_t(bpp) && i < n; ++i) cur[i] = u8(cur[i] + (prior[i] >> 1));
+            for (size_t i = bpp; i < n; ++i) cur[i] = u8(cur[i] + ((cur[i - bpp] + prior[i]) >> 1));
+            break;
+
+        case 4:
+            for (size_t i = 0; i < n; ++i)
+            {
+                int a = i >= size_t(bpp) ? cur[i - bpp] : 0;
+                int b = prior[i];
+                int c = i >= size_t(bpp) ? prior[i - bpp] : 0;
+                int p = a + b - c;
+                int pa = abs(p - a);
+                int pb = abs(p - b);
+                int pc = abs(p - c);
+                cur[i] = u8(cur[i] + ((pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c)));
+            }
+            break;
+
+        default:
+            return false;
+        }
+
+        return true;
+    }
+
+    // The colour of each grey level, as expand() produces it, so grey images can be read as indices.
+    func buildGreys() -> void
+    {
+        m_greys.resize(256);
+        for (int v = 0; v < 256; ++v)
+        {
+            u8 g = u8(v * kScale[m_depth]);
+            m_greys[v] = rgba(g, g, g, (m_hasKey && g == m_key[0]) ? 0 : 255);
+        }
+    }
+
+    // Unpacks the current unfiltered line of a palette or grey image to one index per byte.
+    func unpack(u8* dst) const -> void
+    {
+        const u8* src = m_line + 1;
+
+        if (m_depth == 8)
+        {
+            memcpy(dst, src, m_width);
+            return;
+        }
+
+        int mask = (1 << m_depth) - 1;
+        int perByte = 8 / m_depth;
+        for (int x = 0; x < m_width; ++x)
+        {
+            int shift = 8 - m_depth * (x % perByte + 1);
+            dst[x] = u8((src[x / perByte] >> shift) & mask);
+        }
+    }
+
+    // Converts the current unfiltered line to RGBA.
+    func expand(u32* dst) const -> void
+    {
+        const u8* src = m_line + 1;
+
+        if (m_depth < 8)
+        {
+            int mask = (1 << m_depth) - 1;
+            int perByte = 8 / m_depth;
+            for (int x = 0; x < m_width; ++x)
+            {
+                int shift = 8 - m_depth * (x % perByte + 1);
+                u8 v = u8((src[x / perByte] >> shift) & mask);
+                if (m_colour == 3)
+                {
+                    dst[x] = m_palette[v];
+                }
+                else
+                {
+                    u8 g = u8(v * kScale[m_depth]);
+                    dst[x] = rgba(g, g, g, (m_hasKey && g == m_key[0]) ? 0 : 255);
+                }
+            }
+            return;
+        }
+
+        switch (m_colour)
+        {
+        case 0:
+            for (int x = 0; x < m_width; ++x)
+            {
+                u8 g = src[x];
+                dst[x] = rgba(g, g, g, (m_hasKey && g == m_key[0]) ? 0 : 255);
+            }
+            break;
+
+        case 2:
+            for (int x = 0; x < m_width; ++x, src += 3)
+            {
+                bool keyed = m_hasKey && src[0] == m_key[0] && src[1] == m_key[1] && src[2] == m_key[2];
+                dst[x] = rgba(src[0], src[1], src[2], keyed ? 0 : 255);
+            }
+            break;
+
+        case 3:
+            for (int x = 0; x < m_width; ++x)
+            {
+                dst[x] = m_palette[src[x]];
+            }
+            break;
+
+        case 4:
+            for (int x = 0; x < m_width; ++x, src += 2)
+            {
+                dst[x] = rgba(src[0], src[0], src[0], src[1]);
+            }
+            break;
+
+        case 6:
+            memcpy(dst, src, size_t(m_width) * 4);
+            break;
+        }
+    }
+
+private:
+    // Scales grey values of each bit depth to 8 bits.
+    static constexpr int kScale[9] = { 0, 0xff, 0x55, 0, 0x11, 0, 0, 0, 0x01 };
+
+    optional<Inflater> m_inflater;
+    u32 m_idatLeft = 0;
+    const vector<pair<const u8*, size_t>>* m_frameData = nullptr;
+    size_t m_nextData = 0;
+
+    int m_depth = 0;
+    int m_colour = 0;
+    int m_channels = 0;
+    int m_filterBytes = 0;
+    ScratchBuffer m_lineBuffer;
+    ScratchBuffer m_priorBuffer;
+    u8* m_line = nullptr;       // Filter type byte followed by the current row
+    u8* m_prior = nullptr;      // Previous unfiltered row (zeros before the first)
+    size_t m_lineSize = 0;
+
+    vector<u32> m_palette;
+    u32 m_paletteSize = 0;
+    vector<u32> m_greys;        // Colour of each grey level, for reading grey images as indices
+    bool m_hasKey = false;
+    u8 m_key[3] = {};
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// GIF decoding
+
+using GifColours = array<u32, 256>;
+
+// Reads a GIF colour table.  The transparent entry gets zero alpha.
+static func readGifColours(InputFile& file, GifColours& table, int numEntries, int transparent) -> void
+{
+    for (int i = 0; i < numEntries; ++i)
+    {
+        u8 rgb[3];
+        file.read(rgb, 3);
+        table[i] = rgba(rgb[0], rgb[1], rgb[2], i == transparent ? 0 : 255);
+    }
+}
+
+// Decodes the LZW compressed indices of a w x h frame into dst, whose rows are stride bytes apart, as stb_image does,
+// including its handling of truncated data.
+static func decodeGifIndices(InputFile& file, u8* dst, size_t stride, int w, int h, bool interlaced) -> bool
+{
+    struct Code
+    {
+        i16 prefix;
+        u8 first;
+        u8 suffix;
+    };
+
+    int minCodeSize = file.byte();
+    if (minCodeSize > 12) return false;
+    int clear = 1 << minCodeSize;
+    int codeSize = minCodeSize + 1;
+    int codeMask = (1 << codeSize) - 1;
+    vector<Code> codes(4096);
+    for (int i = 0; i < clear; ++i)
+    {
+        codes[i] = { -1, u8(i), u8(i) };
+    }
+
+    int avail = clear + 2;
+    int oldCode = -1;
+    bool first = true;
+    u32 bits = 0;
+    int numBits = 0;
+    int len = 0;
+
+    // Output position, with interlaced frames visiting every 8th row, then the 4th, 2nd and remaining rows.
+    int curX = 0;
+    int curY = 0;
+    int step = interlaced ? 8 : 1;
+    int pass = interlaced ? 3 : 0;
+    vector<u8> run(4096);
+
+    for (;;)
+    {
+        if (numBits < codeSize)
+        {
+            if (len == 0)
+            {
+                len = file.byte();
+                if (len == 0) return true;
+            }
+            --len;
+            bits |= u32(file.byte()) << numBits;
+            numBits += 8;
+            continue;
+        }
+
+        int code = int(bits & codeMask);
+        bits >>= codeSize;
+        numBits -= codeSize;
+
+        if (code == clear)
+        {
+            codeSize = minCodeSize + 1;
+            codeMask = (1 << codeSize) - 1;
+            avail = clear + 2;
+            oldCode = -1;
+            first = false;
+        }
+        else if (code == clear + 1)
+        {
+            file.skip(len);
+            while ((len = file.byte()) > 0) file.skip(len);
+            return true;
+        }
+        else if (code <= avail)
+        {
+            if (first) return false;
+
+            if (oldCode >= 0)
+            {
+                if (avail >= 4096) return false;
+                Code& c = codes[avail++];
+                c.prefix = i16(oldCode);
+                c.first = codes[oldCode].first;
+                c.suffix = codes[code].first;
+            }
+            else if (code == avail)
+            {
+                return false;
+            }
+
+            // A code expands to a run of indices, found backwards by following the prefixes.
+            int n = 0;
+            for (int c = code; c >= 0; c = codes[c].prefix) run[n++] = codes[c].suffix;
+            while (n > 0 && curY < h)
+            {
+                dst[size_t(curY) * stride + curX] = run[--n];
+                if (++curX == w)
+                {
+                    curX = 0;
+                    curY += step;
+                    while (curY >= h && pass > 0)
+                    {
+                        step = 1 << pass;
+                        curY = step / 2;
+                        --pass;
+                    }
+                }
+            }
+
+            if ((avail & codeMask) == 0 && avail <= 0xfff)
+            {
+                codeSize++;
+                codeMask = (1 << codeSize) - 1;
+            }
+            oldCode = code;
+        }
+        else
+        {
+            return false;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// GifReader
+// The first frame of a GIF, decoded in full to an index plane and expanded a band at a time.  Transparent pixels and
+// any part of the canvas outside the frame take stb_image's background colour with zero alpha; they are given an
+// index whose colour is never drawn, so images that use all 256 colours and leave part of the canvas uncovered are
+// left to stb_image, as are malformed files.
+
+class GifReader : public StreamReader
+{
+public:
+    static func open(const fs::path& path) -> unique_ptr<ImageReader>
+    {
+        auto reader = make_unique<GifReader>(path);
+        return reader->decode() ? move(reader) : nullptr;
+    }
+
+    GifReader(const fs::path& path) : StreamReader(path) {}
+
+    func isBuffered() const -> bool override { return true; }
+
+    func readRows(int numRows) -> const u32* override
+    {
+        u32* out = band(numRows);
+        const u8* src = m_indices.data() + size_t(m_row) * m_width;
+        for (size_t i = 0; i < size_t(numRows) * m_width; ++i)
+        {
+            out[i] = m_table[src[i]];
+        }
+
+        m_row += numRows;
+        return out;
+    }
+
+    func colourTable() const -> const u32* override { return m_table.data(); }
+
+    func readIndices(int numRows) -> const u8* override
+    {
+        const u8* out = m_indices.data() + size_t(m_row) * m_width;
+        m_row += numRows;
+        return out;
+    }
+
+private:
+    func decode() -> bool
+    {
+        u8 sig[6];
+        if (!m_file.isOpen() || m_file.read(sig, 6) != 6 || memcmp(sig, "GIF8", 4) != 0) return false;
+        if ((sig[4] != '7' && sig[4] != '9') || sig[5] != 'a') return false;
+
+        m_width = m_file.u16le();
+        m_height = m_file.u16le();
+        u8 flags = m_file.byte();
+        u8 background = m_file.byte();
+        m_file.skip(1);
+        if (m_file.failed() || m_width == 0 || m_height == 0 || u64(m_width) * m_height * 4 > u64(INT_MAX)) return false;
+
+        // Entries missing from the colour tables are black with zero alpha, as in stb_image.
+        GifColours global = {};
+        if (flags & 0x80) readGifColours(m_file, global, 2 << (flags & 7), -1);
+
+        u8 extFlags = 0;
+        int transparent = -1;
+
+        for (;;)
+        {
+            switch (m_file.byte())
+            {
+            case 0x2c:
+                {
+                    int x = m_file.u16le();
+                    int y = m_file.u16le();
+                    int w = m_file.u16le();
+                    int h = m_file.u16le();
+                    u8 localFlags = m_file.byte();
+                    if (m_file.failed() || w == 0 || h == 0 || x + w > m_width || y + h > m_height) return false;
+
+                    GifColours colours = {};
+                    int frameTransparent = (extFlags & 1) ? transparent : -1;
+                    if (localFlags & 0x80)
+                    {
+                        readGifColours(m_file, colours, 2 << (localFlags & 7), frameTransparent);
+                    }
+                    else if (flags & 0x80)
+                    {
+                        colours = global;
+                        if (frameTransparent >= 0) colours[frameTransparent] &= 0x00ffffff;
+                    }
+                    else
+                    {
+                        return false;
+                    }
+
+                    return decodeFrame(x, y, w, h, (localFlags & 0x40) != 0, colours, global[background] & 0x00ffffff);
+                }
+
+            case 0x21:
+                {
+                    int len;
+                    if (m_file.byte() == 0xf9)
+                    {
+                        if (m_file.byte() != 4) return false;
+                        extFlags = m_file.byte();
+                        m_file.skip(2);
+                        transparent = m_file.byte();
+                    }
+                    while ((len = m_file.byte()) != 0) m_file.skip(len);
+                    if (m_file.failed()) return false;
+                }
+                break;
+
+            default:
+                return false;
+            }
+        }
+    }
+
+    // Decodes the indices of a w x h frame at (x, y).  Indices whose colour has zero alpha are not drawn and show the
+    // background.
+    func decodeFrame(int x, int y, int w, int h, bool interlaced, const GifColours& colours, u32 background) -> bool
+    {
+        int blank = -1;
+        for (int i = 0; i < 256; ++i)
+        {
+            bool drawn = (colours[i] >> 24) != 0;
+            m_table[i] = drawn ? colours[i] : background;
+            if (!drawn && blank < 0) blank = i;
+        }
+        bool covered = x == 0 && y == 0 && w == m_width && h == m_height;
+        if (!covered && blank < 0) return false;
+        m_indices.assign(size_t(m_width) * m_height, u8(max(blank, 0)));
+
+        return decodeGifIndices(m_file, m_indices.data() + size_t(y) * m_width + x, m_width, w, h, interlaced);
+    }
+
+private:
+    GifColours m_table;
+    vector<u8> m_indices;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// FrameBuffer
+// A frame of an animation, holding its own copy of the canvas.
+
+class FrameBuffer : public ImageReader
+{
+public:
+    FrameBuffer(const vector<u32>& canvas, int width, int height)
+        : m_pixels(canvas)
+        , m_row(0)
+    {
+        m_width = width;
+        m_height = height;
+    }
+
+    func isBuffered() const -> bool override { return true; }
+
+    func readRows(int numRows) -> const u32* override
+    {
+        const u32* rows = m_pixels.data() + size_t(m_row) * m_width;
+        m_row += numRows;
+        return rows;
+    }
+
+private:
+    vector<u32> m_pixels;
+    int m_row;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// GifFrameReader
+// The frames of an animated GIF.  Transparent pixels leave the canvas showing through, and after each frame its area is
+// left, cleared to the background colour with zero alpha, or restored, as its graphic control extension says.  The
+// canvas starts as the background colour with zero alpha, so the first frame matches GifReader.
+
+class GifFrameReader : public FrameReader
+{
+public:
+    static func open(const fs::path& path) -> unique_ptr<FrameReader>
+    {
+        auto reader = make_unique<GifFrameReader>(path);
+        return reader->parseHeader() ? move(reader) : nullptr;
+    }
+
+    GifFrameReader(const fs::path& path) : m_file(path) {}
+
+    func nextFrame() -> unique_ptr<ImageReader> override
+    {
+        u8 extFlags = 0;
+        int transparent = -1;
+
+        for (;;)
+        {
+            switch (m_file.byte())
+            {
+            case 0x2c:
+                {
+                    int x = m_file.u16le();
+                    int y = m_file.u16le();
+                    int w = m_file.u16le();
+                    int h = m_file.u16le();
+                    u8 localFlags = m_file.byte();
+                    if (m_file.failed() || w == 0 || h == 0 || x + w > m_width || y + h > m_height)
+                    {
+                        return fail();
+                    }
+
+                    GifColours colours = {};
+                    int frameTransparent = (extFlags & 1) ? transparent : -1;
+                    if (localFlags & 0x80)
+                    {
+                        readGifColours(m_file, colours, 2 << (localFlags & 7), frameTransparent);
+                    }
+                    else if (m_hasGlobal)
+                    {
+                        colours = m_global;
+                        if (frameTransparent >= 0) colours[frameTransparent] &= 0x00ffffff;
+                    }
+                    else
+                    {
+                        return fail();
+                    }
+
+                    // Undo the previous frame, keeping the canvas under this one if it is to be restored.
+                    dispose();
+                    m_dispose = (extFlags >> 2) & 7;
+                    m_x = x;
+                    m_y = y;
+                    m_w = w;
+                    m_h = h;
+                    if (m_dispose == 3) m_saved = m_canvas;
+
+                    // Pixels missing from truncated data take the transparent index, or 0 without one.
+                    m_frame.assign(size_t(w) * h, u8(max(frameTransparent, 0)));
+                    if (!decodeGifIndices(m_file, m_frame.data(), w, w, h, (localFlags & 0x40) != 0)) return fail();
+
+                    for (int row = 0; row < h; ++row)
+                    {
+                        const u8* src = m_frame.data() + size_t(row) * w;
+                        u32* dst = m_canvas.data() + size_t(y + row) * m_width + x;
+                        for (int col = 0; col < w; ++col)
+                        {
+                            u32 c = colours[src[col]];
+                            if (c >> 24) dst[col] = c;
+                        }
+                    }
+
+                    return make_unique<FrameBuffer>(m_canvas, m_width, m_height);
+                }
+
+            case 0x21:
+                {
+                    int len;
+                    if (m_file.byte() == 0xf9)
+                    {
+                        if (m_file.byte() != 4) return fail();
+                        extFlags = m_file.byte();
+                        m_file.skip(2);
+                        transparent = m_file.byte();
+                    }
+                    while ((len = m_file.byte()) != 0) m_file.skip(len);
+                    if (m_file.failed()) return fail();
+                }
+                break;
+
+            case 0x3b:
+                return nullptr;
+
+            default:
+                return fail();
+            }
+        }
+    }
+
+private:
+    // Reads the header and counts the frames, which must be more than one.
+    func parseHeader() -> bool
+    {
+        u8 sig[6];
+        if (!m_file.isOpen() || m_file.read(sig, 6) != 6 || memcmp(sig, "GIF8", 4) != 0) return false;
+        if ((sig[4] != '7' && sig[4] != '9') || sig[5] != 'a') return false;
+
+        m_width = m_file.u16le();
+        m_height = m_file.u16le();
+        u8 flags = m_file.byte();
+        u8 background = m_file.byte();
+        m_file.skip(1);
+        if (m_file.failed() || m_width == 0 || m_height == 0 || u64(m_width) * m_height * 4 > u64(INT_MAX)) return false;
+
+        m_global = {};
+        m_hasGlobal = (flags & 0x80) != 0;
+        if (m_hasGlobal) readGifColours(m_file, m_global, 2 << (flags & 7), -1);
+        m_background = m_global[background] & 0x00ffffff;
+        u64 start = 13 + (m_hasGlobal ? 3 * (2u << (flags & 7)) : 0);
+
+        // Skim the blocks, skipping the image data, to count the frames.
+        for (bool more = true; more && !m_file.failed();)
+        {
+            int len;
+            switch (m_file.byte())
+            {
+            case 0x2c:
+                {
+                    m_file.skip(8);
+                    u8 localFlags = m_file.byte();
+                    if (localFlags & 0x80) m_file.skip(3 * (2u << (localFlags & 7)));
+                    m_file.skip(1);
+                    while ((len = m_file.byte()) != 0) m_file.skip(len);
+                    if (!m_file.failed()) ++m_numFrames;
+                }
+                break;
+
+            case 0x21:
+                m_file.skip(1);
+                while ((len = m_file.byte()) != 0) m_file.skip(len);
+                break;
+
+            default:
+                more = false;
+                break;
+            }
+        }
+
+        m_canvas.assign(size_t(m_width) * m_height, m_background);
+        return m_numFrames > 1 && m_file.seek(start);
+    }
+
+    // Applies the last frame's disposal to its area of the canvas.
+    func dispose() -> void
+    {
+        if (m_dispose != 2 && m_dispose != 3) return;
+
+        for (int row = m_y; row < m_y + m_h; ++row)
+        {
+            size_t i = size_t(row) * m_width + m_x;
+            if (m_dispose == 2)
+            {
+                fill_n(m_canvas.begin() + i, m_w, m_background);
+            }
+            else
+            {
+                copy_n(m_saved.begin() + i, m_w, m_canvas.begin() + i);
+            }
+        }
+    }
+
+    func fail() -> unique_ptr<ImageReader>
+    {
+        m_error = "Corrupt GIF";
+        return nullptr;
+    }
+
+private:
+    InputFile m_file;
+    GifColours m_global;
+    bool m_hasGlobal = false;
+    u32 m_background = 0;
+    vector<u32> m_canvas;
+    vector<u32> m_saved;        // Canvas to restore after a frame with disposal 3
+    vector<u8> m_frame;
+    int m_dispose = 0;          // Disposal of the last frame, and its area
+    int m_x = 0;
+    int m_y = 0;
+    int m_w = 0;
+    int m_h = 0;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// apngFrameCount
+// Returns the number of frames an APNG's acTL chunk declares, or 0 for other files.  Used to tell APNGs that
+// PngReader cannot animate from still PNGs.
+
+static func apngFrameCount(const fs::path& path) -> u32
+{
+    MappedFile file = MappedFile::openRead(path);
+    const u8* data = file.data();
+    u64 size = file.size();
+    if (size < 8 || memcmp(data, "\x89PNG\r\n\x1a\n", 8) != 0) return 0;
+
+    // Animation control must come before the image data.
+    for (u64 pos = 8; pos + 12 <= size;)
+    {
+        u32 length = be32(data + pos);
+        u32 type = be32(data + pos + 4);
+        if (length > size - pos - 12 || type == 'IDAT') break;
+        if (type == 'acTL') return length >= 8 ? be32(data + pos + 8) : 0;
+        pos += 12 + u64(length);
+    }
+
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// ApngFrameReader
+// The frames of an animated PNG, decoded by a PngReader switched from frame to frame and composited as the APNG
+// specification says: each frame replaces or is drawn over its area of a canvas that starts transparent black, and
+// afterwards the area is left, cleared or restored.
+
+class ApngFrameReader : public FrameReader
+{
+public:
+    static func open(const fs::path& path) -> unique_ptr<FrameReader>
+    {
+        auto reader = make_unique<ApngFrameReader>();
+        reader->m_png = PngReader::openAnimation(path, reader->m_frames);
+        if (!reader->m_png) return nullptr;
+
+        reader->m_width = reader->m_png->width();
+        reader->m_height = reader->m_png->height();
+        reader->m_numFrames = int(reader->m_frames.size());
+        reader->m_canvas.assign(size_t(reader->m_width) * reader->m_height, 0);
+        return reader;
+    }
+
+    func nextFrame() -> unique_ptr<ImageReader> override
+    {
+        if (m_next == m_frames.size()) return nullptr;
+
+        // Undo the previous frame, keeping the canvas under this one if it is to be restored.  A first frame that
+        // restores clears instead, as there is nothing before it.
+        const ApngFrame& frame = m_frames[m_next];
+        if (m_next > 0) dispose(m_frames[m_next - 1]);
+        if (frame.dispose == 2 && m_next > 0) m_saved = m_canvas;
+        ++m_next;
+
+        m_png->startFrame(frame);
+        const u32* src = m_png->readRows(frame.height);
+        if (!src)
+        {
+            m_error = m_png->error();
+            return nullptr;
+        }
+
+        for (int row = 0; row < frame.height; ++row, src += frame.width)
+        {
+            u32* dst = m_canvas.data() + size_t(frame.y + row) * m_width + frame.x;
+            if (frame.blend == 0)
+            {
+                copy_n(src, frame.width, dst);
+            }
+            else
+            {
+                for (int col = 0; col < frame.width; ++col) dst[col] = over(src[col], dst[col]);
+            }
+        }
+
+        return make_unique<FrameBuffer>(m_canvas, m_width, m_height);
+    }
+
+private:
+    func dispose(const ApngFrame& frame) -> void
+    {
+        bool restore = frame.dispose == 2 && !m_saved.empty();
+        if (frame.dispose == 0) return;
+
+        for (int row = frame.y; row < frame.y + frame.height; ++row)
+        {
+            size_t i = size_t(row) * m_width + frame.x;
+            if (restore)
+            {
+                copy_n(m_saved.begin() + i, frame.width, m_canvas.begin() + i);
+            }
+            else
+            {
+                fill_n(m_canvas.begin() + i, frame.width, 0);
+            }
+        }
+    }
+
+    // Porter-Duff 'over' of two non-premultiplied RGBA pixels.
+    static func over(u32 src, u32 dst) -> u32
+    {
+        u32 sa = src >> 24;
+        if (sa == 255) return src;
+        if (sa == 0) return dst;
+
+        u32 da = (dst >> 24) * (255 - sa);          // Destination's weight, scaled by 255
+        u32 a = sa * 255 + da;
+        u32 result = ((a + 127) / 255) << 24;
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            u32 c = (((src >> shift) & 0xff) * sa * 255 + ((dst >> shift) & 0xff) * da + a / 2) / a;
+            result |= c << shift;
+        }
+        return result;
+    }
+
+private:
+    unique_ptr<PngReader> m_png;
+    vector<ApngFrame> m_frames;
+    size_t m_next = 0;
+    vector<u32> m_canvas;
+    vector<u32> m_saved;        // Canvas to restore after a frame that disposes by restoring
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// SingleFrameReader
+// A still image as an animation of one frame.
+
+class SingleFrameReader : public FrameReader
+{
+public:
+    SingleFrameReader(unique_ptr<ImageReader> reader)
+        : m_reader(move(reader))
+    {
+        m_width = m_reader->width();
+        m_height = m_reader->height();
+        m_numFrames = 1;
+    }
+
+    func nextFrame() -> unique_ptr<ImageReader> override { return move(m_reader); }
+
+private:
+    unique_ptr<ImageReader> m_reader;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// openImage
+
+func openImage(const fs::path& path, string& error) -> unique_ptr<ImageReader>
+{
+    string ext = path.extension().string();
+    for (auto& c : ext) c = char(tolower(c));
+
+    unique_ptr<ImageReader> reader = PngReader::open(path);
+    if (!reader) reader = BmpReader::open(path);
+    if (!reader && ext == ".tga") reader = TgaReader::open(path);
+    if (!reader) reader = GifReader::open(path);
+
+    if (!reader)
+    {
+        reader = make_unique<StbReader>(path);
+        if (!reader->error().empty())
+        {
+            error = reader->error();
+            return nullptr;
+        }
+    }
+
+    return reader;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// openFrames
+
+func openFrames(const fs::path& path, string& error) -> unique_ptr<FrameReader>
+{
+    unique_ptr<FrameReader> frames = ApngFrameReader::open(path);
+    if (!frames && apngFrameCount(path) > 1)
+    {
+        // Falling back to openImage() would quietly give only the default image.
+        error = "Cannot decode the frames of an interlaced, 16-bit or corrupt APNG";
+        return nullptr;
+    }
+    if (!frames) frames = GifFrameReader::open(path);
+    if (frames) return frames;
+
+    auto reader = openImage(path, error);
+    return reader ? make_unique<SingleFrameReader>(move(reader)) : nullptr;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,123 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Image decoding
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+#include <mapping.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// InputFile
+// A memory mapped input file with a read position and the little and big endian helpers the decoders need.  Decoders
+// can take views straight into the mapping instead of copying.
+
+class InputFile
+{
+public:
+    InputFile(const fs::path& path);
+
+    func isOpen() const -> bool { return m_map.isOpen(); }
+    func size() const -> u64 { return m_map.size(); }
+    func data() const -> const u8* { return m_map.data(); }
+
+    // Returns a pointer to the next size bytes and moves past them, or nullptr if the file is too short.
+    func view(size_t size) -> const u8*;
+
+    func read(void* dst, size_t size) -> size_t;
+    func seek(u64 pos) -> bool;
+    func skip(u64 n) -> bool;
+
+    func byte() -> u8;
+    func u16le() -> u16;
+    func u32le() -> u32;
+    func u32be() -> u32;
+
+    // True once a read has failed or run past the end of the file.
+    func failed() const -> bool { return m_failed; }
+
+private:
+    MappedFile m_map;
+    u64 m_pos;
+    bool m_failed;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// ImageReader
+// Decodes an image a band of rows at a time into RGBA pixels laid out as stb_image returns them, so memory use depends
+// on the band size rather than the image size.  Formats that cannot be streamed are decoded in full up front.
+
+class ImageReader
+{
+public:
+    virtual ~ImageReader() = default;
+
+    func width() const -> int { return m_width; }
+    func height() const -> int { return m_height; }
+
+    // True if the whole image is already in memory, in which case reading it in one band costs nothing extra.
+    virtual func isBuffered() const -> bool { return false; }
+
+    // Returns the next numRows rows.  The pixels remain valid until the next call.  Returns nullptr on a decoding
+    // error, with error() describing it.
+    virtual func readRows(int numRows) -> const u32* = 0;
+
+    // Indexed images (palette and grey PNGs, 4 and 8-bit BMPs, GIFs) can instead be read as one byte per pixel,
+    // indexing a table of 256 colours that holds each pixel as readRows() would return it.  colourTable() returns
+    // nullptr for other images.  An image is read either way, not both.
+    virtual func colourTable() const -> const u32* { return nullptr; }
+    virtual func readIndices(int numRows) -> const u8* { (void)numRows; return nullptr; }
+
+    func error() const -> const string& { return m_error; }
+
+protected:
+    int m_width = 0;
+    int m_height = 0;
+    string m_error;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// openImage
+// Opens an image for reading, using a streaming decoder for PNG, BMP and TGA files where possible, and an indexed
+// decoder for GIFs.  The file is memory mapped and decoded in place.  Returns nullptr if the image cannot be loaded,
+// with the reason in error.
+
+func openImage(const fs::path& path, string& error) -> unique_ptr<ImageReader>;
+
+//----------------------------------------------------------------------------------------------------------------------
+// FrameReader
+// Decodes the frames of an animation in order.  Each frame is composited onto the canvas as a viewer would show it,
+// following the frames' disposal and blending, and handed out as a buffered reader of the whole canvas that owns its
+// pixels, so it can be converted on another thread while later frames decode.
+
+class FrameReader
+{
+public:
+    virtual ~FrameReader() = default;
+
+    func width() const -> int { return m_width; }
+    func height() const -> int { return m_height; }
+    func numFrames() const -> int { return m_numFrames; }
+
+    // Returns the next frame, or nullptr after the last one or on a decoding error, with error() describing it.
+    virtual func nextFrame() -> unique_ptr<ImageReader> = 0;
+
+    func error() const -> const string& { return m_error; }
+
+protected:
+    int m_width = 0;
+    int m_height = 0;
+    int m_numFrames = 0;
+    string m_error;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// openFrames
+// Opens an image for reading frame by frame.  Animated GIFs and APNGs (non-interlaced, as for PNG streaming) give all
+// of their frames; any other image gives one frame, read as openImage() would.  Returns nullptr if the image cannot be
+// loaded, with the reason in error, including APNGs of several frames that cannot be decoded frame by frame.
+
+func openFrames(const fs::path& path, string& error) -> unique_ptr<FrameReader>;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,41 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Per-thread scratch memory
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <scratch.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// Arena
+// The buffers returned to each thread.  Only a handful are ever live at once, so the arena keeps at most
+// kMaxArenaBuffers of them.  Buffers larger than kMaxArenaBufferBytes, such as a whole large image decoded in one band,
+// are freed rather than kept, so one unusual image can't pin its memory for the life of the thread.  Between them the
+// limits keep at most 32MB per thread.
+
+static const size_t kMaxArenaBuffers = 8;
+static const size_t kMaxArenaBufferBytes = 4 * 1024 * 1024;
+
+static thread_local vector<vector<u8>> tl_arena;
+
+//----------------------------------------------------------------------------------------------------------------------
+// Constructor & destructor
+
+ScratchBuffer::ScratchBuffer()
+{
+    if (!tl_arena.empty())
+    {
+        m_data = move(tl_arena.back());
+        tl_arena.pop_back();
+    }
+}
+
+ScratchBuffer::~ScratchBuffer()
+{
+    if (!m_data.empty() && m_data.size() <= kMaxArenaBufferBytes && tl_arena.size() < kMaxArenaBuffers)
+    {
+        tl_arena.push_back(move(m_data));
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,37 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Per-thread scratch memory
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// ScratchBuffer
+// A growable buffer borrowed from the current thread's arena and handed back when destroyed.  Decoders use these for
+// their band, row and window buffers so that converting many images on one thread stops reallocating them.  Contents
+// are undefined when first acquired.
+
+class ScratchBuffer
+{
+public:
+    ScratchBuffer();
+    ~ScratchBuffer();
+
+    ScratchBuffer(const ScratchBuffer&) = delete;
+    ScratchBuffer& operator= (const ScratchBuffer&) = delete;
+
+    // Makes room for count elements of T and returns them.  Only grows, so repeated calls don't allocate.
+    template <typename T>
+    func get(size_t count) -> T*
+    {
+        if (m_data.size() < count * sizeof(T)) m_data.resize(count * sizeof(T));
+        return (T *)m_data.data();
+    }
+
+private:
+    vector<u8> m_data;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,237 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Conversion server
+//----------------------------------------------------------------------------------------------------------------------
+//
+//      nim serve
+//
+// Reads requests from stdin, one per line, and answers each with one line on stdout.  A request is a nim command
+// line without the 'nim', e.g.:
+//
+//      image sprites/ship.png --pal game.nip -4
+//      palette game.pal -9
+//
+// Quoted arguments may contain spaces.  Relative paths are relative to the server's working directory.  The reply
+// is 'OK <output file>' or 'ERROR <message>'; with --stats, 'OK' is followed by the stats as JSON.  Blank lines are
+// ignored and 'quit' (or closing stdin) stops the server.
+//
+// Palettes stay loaded between requests, with their lookup cubes, so converting a sprite costs little more than
+// reading and writing it.  A palette file that changes on disk is reloaded.
+//
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <hash.h>
+#include <image.h>
+#include <serve.h>
+#include <iostream>
+#include <sstream>
+
+//----------------------------------------------------------------------------------------------------------------------
+// tokenise
+// Splits a request into arguments at whitespace, keeping double quoted runs together.
+
+static func tokenise(const string& line) -> vector<string>
+{
+    vector<string> args;
+    size_t i = 0;
+    while (i < line.size())
+    {
+        if (isspace(u8(line[i])))
+        {
+            ++i;
+            continue;
+        }
+
+        string arg;
+        bool quoted = false;
+        for (; i < line.size() && (quoted || !isspace(u8(line[i]))); ++i)
+        {
+            if (line[i] == '"') quoted = !quoted;
+            else arg += line[i];
+        }
+        args.push_back(move(arg));
+    }
+    return args;
+}
+
+// Replies are single lines, so multi-line messages are joined.
+static func oneLine(string text) -> string
+{
+    while (!text.empty() && isspace(u8(text.back()))) text.pop_back();
+    replace(text.begin(), text.end(), '\n', ' ');
+    return text;
+}
+
+static func okReply(const string& text) -> string
+{
+    string line = oneLine(text);
+    return line.empty() ? "OK" : "OK " + line;
+}
+
+// Error messages written for the console start with "ERROR: ", which the reply already says.
+static func errorReply(const string& text) -> string
+{
+    string line = oneLine(text);
+    for (size_t pos; (pos = line.find("ERROR: ")) != string::npos; ) line.erase(pos, 7);
+    return "ERROR " + line;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// PaletteCache
+// Palettes loaded so far, keyed by path ("" is the default palette), with the stamp of the file when it was loaded.
+
+class PaletteCache
+{
+public:
+    func get(const string& path, ostream& err) -> PaletteSlot*
+    {
+        u64 stamp = path.empty() ? 0 : stampFile(path);
+
+        auto it = m_slots.find(path);
+        if (it != m_slots.end() && it->second.stamp == stamp)
+        {
+            return it->second.slot.get();
+        }
+
+        auto p = loadPalette(path, err);
+        if (!p)
+        {
+            m_slots.erase(path);
+            return nullptr;
+        }
+
+        // Requests are usually small sprites, but a resident palette converts enough pixels to pay for its cube.
+        Entry& entry = m_slots[path];
+        entry.stamp = stamp;
+        entry.slot = make_unique<PaletteSlot>(move(*p));
+        entry.slot->quantiser.buildCube();
+        return entry.slot.get();
+    }
+
+private:
+    struct Entry
+    {
+        u64 stamp = 0;
+        unique_ptr<PaletteSlot> slot;
+    };
+
+    map<string, Entry> m_slots;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// serveImage
+// Handles an 'image' request, as image_handler would but using the resident palettes.
+
+static func serveImage(const CmdLine& cmdLine, PaletteCache& palettes) -> string
+{
+    if (cmdLine.numParams() != 1)
+    {
+        return errorReply("Invalid parameters.");
+    }
+
+    ostringstream err;
+    PaletteSlot* slot = palettes.get(cmdLine.longFlag("pal"), err);
+    if (!slot)
+    {
+        return errorReply(err.str());
+    }
+
+    fs::path outPath;
+    optional<ConvertStats> stats;
+    if (imageCommand(cmdLine, *slot, err, outPath, stats) != 0)
+    {
+        return errorReply(err.str());
+    }
+
+    ostringstream reply;
+    reply << outPath.string();
+    if (stats)
+    {
+        reply << " ";
+        printStats(reply, *stats, true);
+    }
+    return okReply(reply.str());
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// serveCommand
+// Runs another command's handler with its console output captured for the reply.
+
+static func serveCommand(const CmdLine& cmdLine, const CmdLine::CmdHandler& handler) -> string
+{
+    ostringstream out;
+    ostringstream err;
+    auto oldOut = cout.rdbuf(out.rdbuf());
+    auto oldErr = cerr.rdbuf(err.rdbuf());
+    int result = 1;
+    try
+    {
+        result = handler(cmdLine);
+    }
+    catch (...)
+    {
+        cout.rdbuf(oldOut);
+        cerr.rdbuf(oldErr);
+        throw;
+    }
+    cout.rdbuf(oldOut);
+    cerr.rdbuf(oldErr);
+
+    if (result != 0)
+    {
+        return errorReply(err.str());
+    }
+    return okReply(out.str());
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Serve command handler
+
+func serve_handler(const CmdLine& /*cmdLine*/, const map<string, CmdLine::CmdHandler>& commands) -> int
+{
+    PaletteCache palettes;
+    string line;
+
+    while (getline(cin, line))
+    {
+        vector<string> args = tokenise(line);
+        if (args.empty()) continue;
+        if (args[0] == "quit") break;
+
+        // CmdLine expects argv as main() receives it.
+        vector<char*> argv = { const_cast<char*>("nim") };
+        for (auto& arg : args) argv.push_back(arg.data());
+        argv.push_back(nullptr);
+        CmdLine request(int(argv.size() - 1), argv.data(), kNimSwitches);
+
+        // A bad request (e.g. a malformed number) must not take the server down.
+        string reply;
+        try
+        {
+            auto it = commands.find(request.command());
+            if (request.command() == "image")
+            {
+                reply = serveImage(request, palettes);
+            }
+            else if (it != commands.end())
+            {
+                reply = serveCommand(request, it->second);
+            }
+            else
+            {
+                reply = errorReply("Unknown command '" + request.command() + "'.");
+            }
+        }
+        catch (const exception& e)
+        {
+            reply = errorReply(e.what());
+        }
+
+        cout << reply << endl;
+    }
+
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,15 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Conversion server
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+#include <cmdline.h>
+
+// Runs the server until stdin closes or a 'quit' request.  Requests for the commands in 'commands' are passed to
+// their handlers; 'image' requests are handled by the server itself.
+func serve_handler(const CmdLine& cmdLine, const map<string, CmdLine::CmdHandler>& commands) -> int;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,347 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Sprite sheets
+//----------------------------------------------------------------------------------------------------------------------
+//
+//      nim sprites <options> <filename.ext>
+//
+// Converts a sheet of sprites to 16x16 patterns for sprite RAM.  Sprites are either the cells of a grid or, with -a,
+// found automatically as the connected areas of non-transparent pixels.  A sprite larger than 16x16 becomes several
+// patterns, left to right and then top to bottom.  Grid cells with no visible pixels are skipped.
+//
+// Writes <filename>.spr, the patterns in sprite RAM order (256 bytes each, or 128 with -4), and <filename>.sprites,
+// which lists each sprite's first pattern number and its area of the sheet: 'pattern x y width height'.
+//
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <cmdline.h>
+#include <image.h>
+#include <jobs.h>
+#include <reader.h>
+#include <sprites.h>
+#include <fstream>
+#include <iostream>
+
+// Size of a hardware sprite pattern.
+static const int kPatternSize = 16;
+
+//----------------------------------------------------------------------------------------------------------------------
+// findSprites
+
+func findSprites(const u8* indices, int width, int height, u8 transparent) -> vector<SpriteBox>
+{
+    vector<SpriteBox> boxes;
+    vector<bool> seen(size_t(width) * height, false);
+    vector<size_t> stack;
+
+    for (size_t start = 0; start < seen.size(); ++start)
+    {
+        if (seen[start] || indices[start] == transparent) continue;
+
+        // Flood fill the area, tracking its extent.
+        int x0 = width, y0 = height, x1 = 0, y1 = 0;
+        seen[start] = true;
+        stack.push_back(start);
+        while (!stack.empty())
+        {
+            size_t i = stack.back();
+            stack.pop_back();
+
+            int x = int(i % width);
+            int y = int(i / width);
+            x0 = min(x0, x);
+            y0 = min(y0, y);
+            x1 = max(x1, x);
+            y1 = max(y1, y);
+
+            for (int ny = max(y - 1, 0); ny <= min(y + 1, height - 1); ++ny)
+            {
+                for (int nx = max(x - 1, 0); nx <= min(x + 1, width - 1); ++nx)
+                {
+                    size_t n = size_t(ny) * width + nx;
+                    if (!seen[n] && indices[n] != transparent)
+                    {
+                        seen[n] = true;
+                        stack.push_back(n);
+                    }
+                }
+            }
+        }
+
+        boxes.push_back({ x0, y0, x1 - x0 + 1, y1 - y0 + 1 });
+    }
+
+    // Stray pixels and detached parts are part of the sprite whose box they fall in.
+    auto overlaps = [](const SpriteBox& a, const SpriteBox& b) {
+        return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+    };
+    for (bool merged = true; merged;)
+    {
+        merged = false;
+        for (size_t i = 0; i < boxes.size(); ++i)
+        {
+            for (size_t j = i + 1; j < boxes.size(); ++j)
+            {
+                if (!overlaps(boxes[i], boxes[j])) continue;
+
+                SpriteBox& a = boxes[i];
+                const SpriteBox& b = boxes[j];
+                int right = max(a.x + a.width, b.x + b.width);
+                int bottom = max(a.y + a.height, b.y + b.height);
+                a.x = min(a.x, b.x);
+                a.y = min(a.y, b.y);
+                a.width = right - a.x;
+                a.height = bottom - a.y;
+                boxes.erase(boxes.begin() + j);
+                merged = true;
+                --j;
+            }
+        }
+    }
+
+    // Sort into reading order of the top left corners.
+    stable_sort(boxes.begin(), boxes.end(), [](const SpriteBox& a, const SpriteBox& b) {
+        return a.y != b.y ? a.y < b.y : a.x < b.x;
+    });
+    return boxes;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// isEmpty
+// True if every pixel of a box within the sheet is transparent.
+
+static func isEmpty(const u8* indices, int width, int height, const SpriteBox& box, u8 transparent) -> bool
+{
+    for (int y = box.y; y < min(box.y + box.height, height); ++y)
+    {
+        const u8* row = indices + size_t(y) * width;
+        for (int x = box.x; x < min(box.x + box.width, width); ++x)
+        {
+            if (row[x] != transparent) return false;
+        }
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// cutPattern
+// Copies the 16x16 pattern at (px, py), packing it for 4-bit sprites.  Pixels right of or below (right, bottom),
+// the end of the sprite within the sheet, are transparent.
+
+static func cutPattern(const u8* indices, int width, int px, int py, int right, int bottom, u8 transparent, bool bit4,
+                       u8* dst) -> void
+{
+    for (int y = py; y < py + kPatternSize; ++y)
+    {
+        for (int x = px; x < px + kPatternSize; x += 2)
+        {
+            u8 a = (x < right && y < bottom) ? indices[size_t(y) * width + x] : transparent;
+            u8 b = (x + 1 < right && y < bottom) ? indices[size_t(y) * width + x + 1] : transparent;
+            if (bit4)
+            {
+                *dst++ = u8((a << 4) | (b & 0xf));
+            }
+            else
+            {
+                *dst++ = a;
+                *dst++ = b;
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// sprites_handler
+
+func sprites_handler(const CmdLine& cmdLine) -> int
+{
+    if (cmdLine.numParams() != 1)
+    {
+        cerr << "ERROR: Invalid parameters." << endl;
+        cerr << "Syntax: " << endl
+            << "    nim sprites <options> <filename.ext>  - Generate .spr sprite patterns from a sheet." << endl
+            << endl
+            << "Options:" << endl
+            << "    --grid <w>x<h>              - Size of the sheet's cells, multiples of 16 (default 16x16)." << endl
+            << "    -a                          - Find sprites by their transparent surroundings, not a grid." << endl
+            << "    -4                          - Output 4-bit patterns." << endl
+            << "    --pal <filename.nip/.pal>   - Define palette to use in conversion." << endl
+            << "    --bank <n>                  - With -4, convert with the palette's nth bank of 16 colours." << endl
+            << "    --dither <mode>             - none, bayer2, bayer4, bayer8, floyd, atkinson or sierra-lite." << endl
+            << "    --jobs <n>                  - Convert using n threads (0 = one per core, default)." << endl;
+        return 1;
+    }
+
+    auto p = loadPalette(cmdLine.longFlag("pal"), cerr);
+    if (!p)
+    {
+        return 1;
+    }
+
+    // The sheet is converted unpacked and row by row, and patterns are packed as they are cut out.
+    ImageOptions opts = imageOptions(cmdLine);
+    bool bit4 = opts.bit4;
+    opts.bit4 = false;
+    opts.jobs = numJobs(cmdLine, 0);
+    opts.layout = Layout::Row;
+
+    if (bit4 && opts.bank >= 0)
+    {
+        auto bank = paletteBank(*p, opts.bank);
+        if (!bank)
+        {
+            cerr << "ERROR: The palette has no bank " << opts.bank << "." << endl;
+            return 1;
+        }
+        p = move(bank);
+    }
+    if (bit4 && p->numColours() > 16)
+    {
+        cerr << "ERROR: Invalid palette for 4-bit mode.  Must be 16 colours or less, or choose a bank with --bank."
+            << endl;
+        return 1;
+    }
+
+    int cellWidth = kPatternSize;
+    int cellHeight = kPatternSize;
+    string grid = cmdLine.longFlag("grid");
+    if (!grid.empty())
+    {
+        size_t x = grid.find('x');
+        cellWidth = stoi(grid.substr(0, x));
+        cellHeight = x == string::npos ? cellWidth : stoi(grid.substr(x + 1));
+        if (cellWidth <= 0 || cellHeight <= 0 || cellWidth % kPatternSize || cellHeight % kPatternSize)
+        {
+            cerr << "ERROR: Grid cells must be multiples of 16 pixels wide and high." << endl;
+            return 1;
+        }
+    }
+
+    fs::path inPath = cmdLine.param(0);
+    string reason;
+    auto reader = openImage(inPath, reason);
+    if (!reader)
+    {
+        cerr << "ERROR: Could not load image " << inPath << " (" << reason << ")." << endl;
+        return 1;
+    }
+
+    int w = reader->width();
+    int h = reader->height();
+    Quantiser q(*p);
+    vector<u8> indices(size_t(w) * h);
+    if (!convertPixels(q, *reader, opts, indices.data(), nullptr))
+    {
+        cerr << "ERROR: Could not load image " << inPath << " (" << reader->error() << ")." << endl;
+        return 1;
+    }
+    u8 transparent = p->getTransColour();
+
+    //
+    // Find the sprites
+    //
+
+    vector<SpriteBox> boxes;
+    int numCells = 0;
+    if (cmdLine.flag('a'))
+    {
+        boxes = findSprites(indices.data(), w, h, transparent);
+    }
+    else
+    {
+        vector<SpriteBox> cells;
+        for (int y = 0; y < h; y += cellHeight)
+        {
+            for (int x = 0; x < w; x += cellWidth)
+            {
+                cells.push_back({ x, y, cellWidth, cellHeight });
+            }
+        }
+        numCells = int(cells.size());
+
+        vector<u8> empty(cells.size());
+        parallelFor(numCells, opts.jobs, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i)
+            {
+                empty[i] = isEmpty(indices.data(), w, h, cells[i], transparent);
+            }
+        });
+        for (int i = 0; i < numCells; ++i)
+        {
+            if (!empty[i]) boxes.push_back(cells[i]);
+        }
+    }
+
+    //
+    // Cut out their patterns
+    //
+
+    auto patternsAcross = [](int size) { return (size + kPatternSize - 1) / kPatternSize; };
+    vector<int> firstPattern;
+    int numPatterns = 0;
+    for (const auto& box : boxes)
+    {
+        firstPattern.push_back(numPatterns);
+        numPatterns += patternsAcross(box.width) * patternsAcross(box.height);
+    }
+
+    size_t patternBytes = bit4 ? kPatternSize * kPatternSize / 2 : kPatternSize * kPatternSize;
+    vector<u8> patterns(size_t(numPatterns) * patternBytes);
+    parallelFor(int(boxes.size()), opts.jobs, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+        {
+            const SpriteBox& box = boxes[i];
+            u8* dst = patterns.data() + size_t(firstPattern[i]) * patternBytes;
+            int right = min(box.x + box.width, w);
+            int bottom = min(box.y + box.height, h);
+            for (int y = box.y; y < box.y + box.height; y += kPatternSize)
+            {
+                for (int x = box.x; x < box.x + box.width; x += kPatternSize)
+                {
+                    cutPattern(indices.data(), w, x, y, right, bottom, transparent, bit4, dst);
+                    dst += patternBytes;
+                }
+            }
+        }
+    });
+
+    //
+    // Write the patterns and the list of sprites
+    //
+
+    fs::path sprPath = inPath;
+    sprPath.replace_extension(".spr");
+    ofstream sprFile(sprPath, ios::binary | ios::trunc);
+    if (!sprFile.write((const char*)patterns.data(), patterns.size()))
+    {
+        cerr << "ERROR: Unable to write " << sprPath << endl;
+        return 1;
+    }
+
+    fs::path listPath = inPath;
+    listPath.replace_extension(".sprites");
+    ofstream listFile(listPath, ios::trunc);
+    for (size_t i = 0; i < boxes.size(); ++i)
+    {
+        listFile << firstPattern[i] << " " << boxes[i].x << " " << boxes[i].y << " "
+            << patternsAcross(boxes[i].width) * kPatternSize << " " << patternsAcross(boxes[i].height) * kPatternSize
+            << "\n";
+    }
+    if (!listFile)
+    {
+        cerr << "ERROR: Unable to write " << listPath << endl;
+        return 1;
+    }
+
+    cout << "Wrote " << numPatterns << (bit4 ? " 4-bit" : " 8-bit") << " patterns for " << boxes.size()
+        << (boxes.size() == 1 ? " sprite" : " sprites");
+    if (numCells)
+    {
+        cout << " (" << numCells - int(boxes.size()) << " empty cells skipped)";
+    }
+    cout << "." << endl;
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,39 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Sprite sheets
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+
+class CmdLine;
+
+//----------------------------------------------------------------------------------------------------------------------
+// SpriteBox
+// A sprite's area of a sheet, in pixels.  It takes one pattern per 16x16 block, with the last row and column of
+// patterns padded with transparent pixels when the width or height is not a multiple of 16.
+
+struct SpriteBox
+{
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// findSprites
+// Finds the bounding boxes of the connected (8-way) areas of a width x height plane of palette indices that are not
+// the transparent index, in reading order of their top left corners.  Areas whose bounding boxes overlap are one
+// sprite.
+
+func findSprites(const u8* indices, int width, int height, u8 transparent) -> vector<SpriteBox>;
+
+//----------------------------------------------------------------------------------------------------------------------
+// sprites_handler
+// 'nim sprites <options> <filename.ext>'
+
+func sprites_handler(const CmdLine& cmdLine) -> int;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
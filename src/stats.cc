@@ -0,0 +1,108 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Conversion statistics
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <platform.h>
+#include <stats.h>
+#include <iomanip>
+
+static const char* kStageNames[] = { "decode", "cube", "quantise", "compress", "write", "total" };
+
+//----------------------------------------------------------------------------------------------------------------------
+// merge
+
+func ConvertStats::merge(const ConvertStats& other) -> void
+{
+    files += other.files;
+    pixels += other.pixels;
+    paletteColours = max(paletteColours, other.paletteColours);
+    bytesRead += other.bytesRead;
+    bytesWritten += other.bytesWritten;
+    lookups.merge(other.lookups);
+    for (int i = 0; i < int(Stage::COUNT); ++i)
+    {
+        seconds[i] += other.seconds[i];
+    }
+
+    // Dimensions only mean something for a single image.
+    width = files == 1 ? other.width : 0;
+    height = files == 1 ? other.height : 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// printStats
+
+func printStats(ostream& out, const ConvertStats& stats, bool json) -> void
+{
+    const LookupCounts& l = stats.lookups;
+    // A hit is a lookup answered by a single table read.
+    u64 hits = l.hardware + l.cubeHits + l.remapped;
+    u64 lookups = hits + l.cubeRefines + l.searches;
+    double hitRate = lookups ? double(hits) / lookups : 0.0;
+    u64 memoLookups = l.memoHits + l.memoMisses;
+    double memoRate = memoLookups ? double(l.memoHits) / memoLookups : 0.0;
+    u64 peak = peakMemory();
+
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << fixed;
+
+    if (json)
+    {
+        out << "{\"files\":" << stats.files
+            << ",\"width\":" << stats.width
+            << ",\"height\":" << stats.height
+            << ",\"pixels\":" << stats.pixels
+            << ",\"paletteColours\":" << stats.paletteColours
+            << ",\"bytesRead\":" << stats.bytesRead
+            << ",\"bytesWritten\":" << stats.bytesWritten
+            << ",\"peakMemory\":" << peak
+            << ",\"lookups\":{\"transparent\":" << l.transparent
+            << ",\"hardware\":" << l.hardware
+            << ",\"cubeHits\":" << l.cubeHits
+            << ",\"cubeRefines\":" << l.cubeRefines
+            << ",\"searches\":" << l.searches
+            << ",\"remapped\":" << l.remapped
+            << ",\"dithered\":" << l.dithered
+            << ",\"memoHits\":" << l.memoHits
+            << ",\"memoMisses\":" << l.memoMisses
+            << ",\"hitRate\":" << setprecision(4) << hitRate << "}"
+            << ",\"timeMs\":{" << setprecision(3);
+        for (int i = 0; i < int(Stage::COUNT); ++i)
+        {
+            out << (i ? "," : "") << "\"" << kStageNames[i] << "\":" << stats.seconds[i] * 1000.0;
+        }
+        out << "}}" << endl;
+    }
+    else
+    {
+        out << "Stats:" << endl
+            << "    files           " << stats.files << endl;
+        if (stats.files == 1)
+        {
+            out << "    size            " << stats.width << "x" << stats.height << endl;
+        }
+        out << "    pixels          " << stats.pixels << endl
+            << "    palette         " << stats.paletteColours << " colours" << endl
+            << "    bytes read      " << stats.bytesRead << endl
+            << "    bytes written   " << stats.bytesWritten << endl
+            << "    peak memory     " << setprecision(1) << peak / 1048576.0 << " MB" << endl
+            << "    lookups         " << l.hardware << " hardware, " << l.cubeHits << " cube hits, "
+            << l.cubeRefines << " refined, " << l.searches << " searched, " << l.remapped << " remapped, "
+            << l.dithered << " dithered, " << l.transparent << " transparent (" << hitRate * 100.0 << "% hit rate)" << endl
+            << "    memo            " << l.memoHits << " hits, " << l.memoMisses << " misses (" << memoRate * 100.0
+            << "% hit rate)" << endl;
+        out << setprecision(3);
+        for (int i = 0; i < int(Stage::COUNT); ++i)
+        {
+            out << "    " << left << setw(16) << kStageNames[i] << right << stats.seconds[i] * 1000.0 << " ms" << endl;
+        }
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
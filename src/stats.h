@@ -0,0 +1,79 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Conversion statistics
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+#include <quantise.h>
+#include <chrono>
+#include <ostream>
+
+//----------------------------------------------------------------------------------------------------------------------
+// ConvertStats
+// Timings and counters gathered by convertImage when --stats is given.  Batch conversions merge the stats of every
+// file, so stage times are summed across threads.
+
+enum class Stage
+{
+    Decode,         // Opening the image and decoding pixels
+    Cube,           // Building the palette lookup cube
+    Quantise,       // Mapping pixels to palette indices, including 4-bit packing
+    Compress,       // Compressing the pixel data and checking it unpacks
+    Write,          // Creating, filling in and closing the output file
+    Total,          // The whole conversion
+
+    COUNT
+};
+
+struct ConvertStats
+{
+    int files = 0;
+    int width = 0;
+    int height = 0;
+    u64 pixels = 0;
+    int paletteColours = 0;
+    u64 bytesRead = 0;
+    u64 bytesWritten = 0;
+    LookupCounts lookups;
+    double seconds[int(Stage::COUNT)] = {};
+
+    func merge(const ConvertStats& other) -> void;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// StageTimer
+// Adds the time until it is destroyed to a stage.  Does nothing if stats is null.
+
+class StageTimer
+{
+public:
+    StageTimer(ConvertStats* stats, Stage stage)
+        : m_stats(stats)
+        , m_stage(stage)
+        , m_start(stats ? chrono::steady_clock::now() : chrono::steady_clock::time_point())
+    {
+    }
+
+    ~StageTimer()
+    {
+        if (m_stats)
+        {
+            m_stats->seconds[int(m_stage)] += chrono::duration<double>(chrono::steady_clock::now() - m_start).count();
+        }
+    }
+
+private:
+    ConvertStats* m_stats;
+    Stage m_stage;
+    chrono::steady_clock::time_point m_start;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// printStats
+// Writes the stats, and the peak memory use of the process, as text or as a single line of JSON.
+
+func printStats(ostream& out, const ConvertStats& stats, bool json) -> void;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,349 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Tilemaps
+//----------------------------------------------------------------------------------------------------------------------
+//
+//      nim tiles <options> <filename.ext>
+//
+// Converts an image to 4-bit indices and slices it into 8x8 tiles for the Next's tilemap layer.  Repeated tiles are
+// stored once, and with -m so are tiles that are mirrored or rotated copies of others, since map entries can
+// transform their tiles.  Writes <filename>.nit (the tiles) and <filename>.ntm (the map).
+//
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <cmdline.h>
+#include <image.h>
+#include <jobs.h>
+#include <reader.h>
+#include <tiles.h>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#   define NIM_SSE2 1
+#   include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#   include <stdlib.h>
+#   define NIM_BSWAP64(x) _byteswap_uint64(x)
+#else
+#   define NIM_BSWAP64(x) __builtin_bswap64(x)
+#endif
+
+// Tiles a tilemap entry can address.
+static const int kMaxTiles = 512;
+
+//----------------------------------------------------------------------------------------------------------------------
+// Tile transforms
+//----------------------------------------------------------------------------------------------------------------------
+
+static func mirrorX(const Tile& t) -> Tile
+{
+    Tile r;
+    for (int y = 0; y < 8; ++y) r[y] = NIM_BSWAP64(t[y]);
+    return r;
+}
+
+static func mirrorY(const Tile& t) -> Tile
+{
+    Tile r;
+    for (int y = 0; y < 8; ++y) r[y] = t[7 - y];
+    return r;
+}
+
+// Swaps rows and columns.  SSE2 does it in three rounds of interleaves: bytes, then pairs, then quads.
+static func transpose(const Tile& t) -> Tile
+{
+    Tile r;
+
+#if NIM_SSE2
+    const __m128i* src = (const __m128i*)t.data();
+    __m128i r01 = _mm_loadu_si128(src);
+    __m128i r23 = _mm_loadu_si128(src + 1);
+    __m128i r45 = _mm_loadu_si128(src + 2);
+    __m128i r67 = _mm_loadu_si128(src + 3);
+
+    __m128i a0 = _mm_unpacklo_epi8(r01, _mm_unpackhi_epi64(r01, r01));
+    __m128i a1 = _mm_unpacklo_epi8(r23, _mm_unpackhi_epi64(r23, r23));
+    __m128i a2 = _mm_unpacklo_epi8(r45, _mm_unpackhi_epi64(r45, r45));
+    __m128i a3 = _mm_unpacklo_epi8(r67, _mm_unpackhi_epi64(r67, r67));
+
+    __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+    __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+    __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+    __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+
+    __m128i* dst = (__m128i*)r.data();
+    _mm_storeu_si128(dst, _mm_unpacklo_epi32(b0, b2));
+    _mm_storeu_si128(dst + 1, _mm_unpackhi_epi32(b0, b2));
+    _mm_storeu_si128(dst + 2, _mm_unpacklo_epi32(b1, b3));
+    _mm_storeu_si128(dst + 3, _mm_unpackhi_epi32(b1, b3));
+#else
+    for (int y = 0; y < 8; ++y)
+    {
+        u64 row = 0;
+        for (int x = 0; x < 8; ++x)
+        {
+            row |= ((t[x] >> (y * 8)) & 0xff) << (x * 8);
+        }
+        r[y] = row;
+    }
+#endif
+
+    return r;
+}
+
+// Applies the transform in a map entry's attributes: rotate clockwise first, then mirror.
+static func transform(const Tile& t, u16 attrs) -> Tile
+{
+    Tile r = (attrs & kTileRotate) ? transpose(mirrorY(t)) : t;
+    if (attrs & kTileMirrorY) r = mirrorY(r);
+    if (attrs & kTileMirrorX) r = mirrorX(r);
+    return r;
+}
+
+// The eight combinations of transform bits, counting up through kTileRotate, kTileMirrorY and kTileMirrorX.
+static func transformBits(int n) -> u16
+{
+    static_assert(kTileMirrorY == kTileRotate << 1 && kTileMirrorX == kTileRotate << 2);
+    return u16(n * kTileRotate);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// tileHash
+// Four independent lanes of multiply-xor so the rows mix in parallel.
+
+static func tileHash(const Tile& t) -> u64
+{
+    const u64 k = 0x9e3779b97f4a7c15ull;
+    u64 h0 = (t[0] ^ 0x243f6a8885a308d3ull) * k;
+    u64 h1 = (t[1] ^ 0x13198a2e03707344ull) * k;
+    u64 h2 = (t[2] ^ 0xa4093822299f31d0ull) * k;
+    u64 h3 = (t[3] ^ 0x082efa98ec4e6c89ull) * k;
+    h0 = ((h0 ^ (h0 >> 29)) ^ t[4]) * k;
+    h1 = ((h1 ^ (h1 >> 29)) ^ t[5]) * k;
+    h2 = ((h2 ^ (h2 >> 29)) ^ t[6]) * k;
+    h3 = ((h3 ^ (h3 >> 29)) ^ t[7]) * k;
+
+    u64 h = h0 ^ (h1 << 17 | h1 >> 47) ^ (h2 << 31 | h2 >> 33) ^ (h3 << 47 | h3 >> 17);
+    h ^= h >> 32;
+    h *= k;
+    return h ^ (h >> 29);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// buildTiles
+
+func buildTiles(const u8* indices, int width, int height, bool transforms, int numJobs) -> TileSet
+{
+    TileSet set;
+    set.width = width / 8;
+    set.height = height / 8;
+    int numTiles = set.width * set.height;
+
+    // Canonicalise and hash each tile.  A transformed tile's canonical form is the least of its eight transforms, so
+    // all of them share it, along with the transform that turns it back into the original.
+    vector<Tile> canonical(numTiles);
+    vector<u64> hashes(numTiles);
+    vector<u16> bits(numTiles, 0);
+
+    parallelFor(numTiles, numJobs, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+        {
+            const u8* src = indices + size_t(i / set.width) * 8 * width + size_t(i % set.width) * 8;
+            Tile tile;
+            for (int y = 0; y < 8; ++y)
+            {
+                memcpy(&tile[y], src + size_t(y) * width, 8);
+            }
+
+            if (transforms)
+            {
+                Tile least = tile;
+                for (int n = 1; n < 8; ++n)
+                {
+                    least = min(least, transform(tile, transformBits(n)));
+                }
+                for (int n = 0; n < 8; ++n)
+                {
+                    if (transform(least, transformBits(n)) == tile)
+                    {
+                        bits[i] = transformBits(n);
+                        break;
+                    }
+                }
+                tile = least;
+            }
+
+            canonical[i] = tile;
+            hashes[i] = tileHash(tile);
+        }
+    });
+
+    // Open-addressed table of tile numbers + 1, sized to stay at most half full.
+    size_t tableSize = 16;
+    while (tableSize < size_t(numTiles) * 2) tableSize *= 2;
+    vector<int> table(tableSize, 0);
+    vector<u64> tileHashes;
+
+    set.map.resize(numTiles);
+    for (int i = 0; i < numTiles; ++i)
+    {
+        size_t slot = hashes[i] & (tableSize - 1);
+        while (table[slot])
+        {
+            int t = table[slot] - 1;
+            if (tileHashes[t] == hashes[i] && set.tiles[t] == canonical[i]) break;
+            slot = (slot + 1) & (tableSize - 1);
+        }
+
+        if (!table[slot])
+        {
+            set.tiles.push_back(canonical[i]);
+            tileHashes.push_back(hashes[i]);
+            table[slot] = int(set.tiles.size());
+        }
+        set.map[i] = u16(table[slot] - 1) | bits[i];
+    }
+
+    return set;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// tiles_handler
+
+func tiles_handler(const CmdLine& cmdLine) -> int
+{
+    if (cmdLine.numParams() != 1)
+    {
+        cerr << "ERROR: Invalid parameters." << endl;
+        cerr << "Syntax: " << endl
+            << "    nim tiles <options> <filename.ext>  - Generate .nit tiles and a .ntm tilemap." << endl
+            << endl
+            << "Options:" << endl
+            << "    --pal <filename.nip/.pal>   - Palette of 16 colours or less to convert with." << endl
+            << "    --bank <n>                  - Convert with the palette's nth bank of 16 colours and set" << endl
+            << "                                  the map's palette offset to n." << endl
+            << "    --dither <mode>             - none, bayer2, bayer4, bayer8, floyd, atkinson or sierra-lite." << endl
+            << "    --jobs <n>                  - Convert using n threads (0 = one per core, default)." << endl
+            << "    -m                          - Also match mirrored and rotated tiles." << endl;
+        return 1;
+    }
+
+    auto p = loadPalette(cmdLine.longFlag("pal"), cerr);
+    if (!p)
+    {
+        return 1;
+    }
+
+    // Tiles are converted unpacked and row by row, and packed once they are known.
+    ImageOptions opts = imageOptions(cmdLine);
+    opts.bit4 = false;
+    opts.jobs = numJobs(cmdLine, 0);
+    opts.layout = Layout::Row;
+
+    if (opts.bank >= 0)
+    {
+        auto bank = paletteBank(*p, opts.bank);
+        if (!bank)
+        {
+            cerr << "ERROR: The palette has no bank " << opts.bank << "." << endl;
+            return 1;
+        }
+        p = move(bank);
+    }
+    if (p->numColours() > 16)
+    {
+        cerr << "ERROR: Tiles need a palette of 16 colours or less, or a bank chosen with --bank." << endl;
+        return 1;
+    }
+
+    fs::path inPath = cmdLine.param(0);
+    string reason;
+    auto reader = openImage(inPath, reason);
+    if (!reader)
+    {
+        cerr << "ERROR: Could not load image " << inPath << " (" << reason << ")." << endl;
+        return 1;
+    }
+
+    int w = reader->width();
+    int h = reader->height();
+    if (w % 8 || h % 8)
+    {
+        cerr << "ERROR: The image must be a multiple of 8 pixels wide and high." << endl;
+        return 1;
+    }
+
+    Quantiser q(*p);
+    vector<u8> indices(size_t(w) * h);
+    if (!convertPixels(q, *reader, opts, indices.data(), nullptr))
+    {
+        cerr << "ERROR: Could not load image " << inPath << " (" << reader->error() << ")." << endl;
+        return 1;
+    }
+
+    TileSet set = buildTiles(indices.data(), w, h, cmdLine.flag('m'), opts.jobs);
+    if (int(set.tiles.size()) > kMaxTiles)
+    {
+        cerr << "ERROR: The image needs " << set.tiles.size() << " distinct tiles but a tilemap can only use "
+            << kMaxTiles << "." << endl;
+        return 1;
+    }
+
+    //
+    // Write the tiles, packed two pixels per byte with the left one in the high nibble
+    //
+
+    fs::path tilesPath = inPath;
+    tilesPath.replace_extension(".nit");
+    vector<u8> data = { 'N', 'I', 'T', '0', u8(set.tiles.size()), u8(set.tiles.size() >> 8) };
+    for (const auto& tile : set.tiles)
+    {
+        for (u64 row : tile)
+        {
+            for (int x = 0; x < 64; x += 16)
+            {
+                data.push_back(u8((((row >> x) & 0xf) << 4) | ((row >> (x + 8)) & 0xf)));
+            }
+        }
+    }
+
+    ofstream tilesFile(tilesPath, ios::binary | ios::trunc);
+    if (!tilesFile.write((const char*)data.data(), data.size()))
+    {
+        cerr << "ERROR: Unable to write " << tilesPath << endl;
+        return 1;
+    }
+
+    //
+    // Write the map
+    //
+
+    fs::path mapPath = inPath;
+    mapPath.replace_extension(".ntm");
+    u16 offset = opts.bank >= 0 ? u16(opts.bank << 12) : 0;
+    data = { 'N', 'T', 'M', '0', u8(set.width), u8(set.width >> 8), u8(set.height), u8(set.height >> 8) };
+    for (u16 entry : set.map)
+    {
+        entry |= offset;
+        data.push_back(u8(entry));
+        data.push_back(u8(entry >> 8));
+    }
+
+    ofstream mapFile(mapPath, ios::binary | ios::trunc);
+    if (!mapFile.write((const char*)data.data(), data.size()))
+    {
+        cerr << "ERROR: Unable to write " << mapPath << endl;
+        return 1;
+    }
+
+    cout << "Wrote " << set.tiles.size() << " distinct tiles for a " << set.width << "x" << set.height << " map."
+        << endl;
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,51 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Tilemaps
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+
+class CmdLine;
+
+//----------------------------------------------------------------------------------------------------------------------
+// Tile
+// An 8x8 tile of palette indices, one row per u64 with the leftmost pixel in the lowest byte.
+
+using Tile = array<u64, 8>;
+
+//----------------------------------------------------------------------------------------------------------------------
+// TileSet
+// The distinct tiles of an image and the map rebuilding it from them.  Map entries are the Next's 2-byte tilemap
+// entries: bits 0-8 are the tile number, bit 9 rotates the tile clockwise, bits 10 and 11 then mirror it in Y and X,
+// and bits 12-15 are the palette offset.
+
+struct TileSet
+{
+    vector<Tile> tiles;
+    vector<u16> map;
+    int width = 0;              // Map size in tiles
+    int height = 0;
+};
+
+// Bits of a tilemap entry's attributes that transform its tile.
+inline constexpr u16 kTileRotate = 1 << 9;
+inline constexpr u16 kTileMirrorY = 1 << 10;
+inline constexpr u16 kTileMirrorX = 1 << 11;
+
+//----------------------------------------------------------------------------------------------------------------------
+// buildTiles
+// Slices a width x height plane of palette indices (both multiples of 8) into tiles and removes duplicates.  With
+// transforms, a tile also matches mirrored and rotated copies of earlier tiles.  Tiles are canonicalised and hashed on
+// numJobs threads; only the final hash table lookups run in order.  Map entries get no palette offset.
+
+func buildTiles(const u8* indices, int width, int height, bool transforms, int numJobs) -> TileSet;
+
+//----------------------------------------------------------------------------------------------------------------------
+// tiles_handler
+// 'nim tiles <options> <filename.ext>'
+
+func tiles_handler(const CmdLine& cmdLine) -> int;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,519 @@
+//----------------------------------------------------------------------------------------------------------------------
+// ZX0 compression
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <core.h>
+#include <zx0.h>
+#include <cstring>
+
+// Format limits.
+static const u32 kInitialOffset = 1;
+static const u32 kMaxOffset = 32640;
+static const u32 kEndMarker = 256;          // Offset MSB that ends the stream
+
+// Arrivals kept at each position.  More finds slightly better parses, more slowly.
+static const int kArrivals = 4;
+
+// Hash chain entries examined per position, and longest-so-far matches kept from them.
+static const int kMaxChain = 64;
+static const int kMaxCandidates = 8;
+
+// Match lengths up to this are all tried.  Beyond it, only the longest length of each Elias gamma code size is, as
+// those cost the same and cover the most.
+static const u32 kFullLengths = 16;
+
+static const u32 kNoCost = ~0u;
+
+//----------------------------------------------------------------------------------------------------------------------
+// Elias gamma sizes
+
+static func log2Floor(u32 v) -> u32
+{
+    u32 n = 0;
+    while (v >>= 1) ++n;
+    return n;
+}
+
+static func gammaBits(u32 v) -> u32
+{
+    return 2 * log2Floor(v) + 1;
+}
+
+// Largest value with the same gamma code size as v.
+static func gammaTop(u32 v) -> u32
+{
+    return (2u << log2Floor(v)) - 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Parse
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace {
+
+enum class Step : u8
+{
+    Start,
+    Literal,                    // One byte of a literal run
+    Repeat,                     // Copy from the last offset
+    Match,                      // Copy from a new offset
+};
+
+// The cheapest known way to reach a position with a given last offset.
+struct Arrival
+{
+    u32 cost = kNoCost;         // Bits so far
+    u32 from;                   // Position the final step started at
+    u32 length;                 // Bytes covered by the final step
+    u32 run;                    // Literals in the current run, 0 after a copy
+    u16 offset;                 // Last offset
+    u8 fromSlot;
+    Step step;
+};
+
+struct Candidate
+{
+    u32 offset;
+    u32 length;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// MatchFinder
+// Hash chains on two-byte prefixes.  The end of the last maximal match found at each offset is remembered, so long
+// runs (flat areas of an image) are measured once rather than at every position along them.
+
+class MatchFinder
+{
+public:
+    MatchFinder(const u8* src, u32 size)
+        : m_src(src)
+        , m_size(size)
+        , m_head(65536, ~0u)
+        , m_prev(size)
+        , m_knownStart(kMaxOffset + 1, 0)
+        , m_knownEnd(kMaxOffset + 1, 0)
+    {
+    }
+
+    // Length of the match at pos with the given offset.
+    func length(u32 pos, u32 offset) -> u32
+    {
+        if (pos >= m_knownStart[offset] && pos < m_knownEnd[offset])
+        {
+            return m_knownEnd[offset] - pos;
+        }
+
+        u32 end = pos;
+        while (end < m_size && m_src[end] == m_src[end - offset]) ++end;
+        m_knownStart[offset] = pos;
+        m_knownEnd[offset] = end;
+        return end - pos;
+    }
+
+    // Finds matches at pos, in order of increasing offset and length, and adds pos to the chains.  Positions must be
+    // visited in order.
+    func find(u32 pos, vector<Candidate>& candidates) -> void
+    {
+        candidates.clear();
+        if (pos + 1 >= m_size) return;
+
+        u32 key = m_src[pos] | (u32(m_src[pos + 1]) << 8);
+        u32 best = 1;
+        int chain = 0;
+        for (u32 j = m_head[key]; j != ~0u && chain < kMaxChain; j = m_prev[j], ++chain)
+        {
+            u32 offset = pos - j;
+            if (offset > kMaxOffset) break;
+
+            u32 len = length(pos, offset);
+            if (len > best)
+            {
+                candidates.push_back({ offset, len });
+                best = len;
+                if (pos + len == m_size || int(candidates.size()) == kMaxCandidates) break;
+            }
+        }
+
+        m_prev[pos] = m_head[key];
+        m_head[key] = pos;
+    }
+
+private:
+    const u8* m_src;
+    u32 m_size;
+    vector<u32> m_head;
+    vector<u32> m_prev;
+    vector<u32> m_knownStart;
+    vector<u32> m_knownEnd;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+// BitWriter
+// ZX0's output: bits are packed most significant first into bytes placed in the stream when their first bit is
+// written, between the literal and offset bytes.  The first bit after an offset byte goes in that byte's spare bit.
+
+class BitWriter
+{
+public:
+    func byte(u8 value) -> void
+    {
+        m_out.push_back(value);
+    }
+
+    func bit(bool value) -> void
+    {
+        if (m_backtrack)
+        {
+            if (value) m_out.back() |= 1;
+            m_backtrack = false;
+            return;
+        }
+
+        if (!m_mask)
+        {
+            m_mask = 0x80;
+            m_bitIndex = m_out.size();
+            m_out.push_back(0);
+        }
+        if (value) m_out[m_bitIndex] |= m_mask;
+        m_mask >>= 1;
+    }
+
+    // Interlaced Elias gamma: each bit of the value after the leading 1 is preceded by a 0, and a 1 ends the code.
+    func gamma(u32 value, bool invert) -> void
+    {
+        for (u32 i = 1u << log2Floor(value); i >>= 1;)
+        {
+            bit(false);
+            bit(((value & i) != 0) != invert);
+        }
+        bit(true);
+    }
+
+    func offset(u32 offset) -> void
+    {
+        gamma((offset - 1) / 128 + 1, true);
+        byte(u8((127 - (offset - 1) % 128) << 1));
+        m_backtrack = true;
+    }
+
+    func take() -> vector<u8> { return move(m_out); }
+
+private:
+    vector<u8> m_out;
+    size_t m_bitIndex = 0;
+    u8 m_mask = 0;
+    bool m_backtrack = false;
+};
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// zx0Compress
+
+func zx0Compress(const u8* src, size_t size) -> vector<u8>
+{
+    u32 n = u32(size);
+    vector<Arrival> arrivals(size_t(n + 1) * kArrivals);
+
+    // Keeps an arrival if it beats the one with the same last offset and kind of step, or failing that the worst.
+    auto arrive = [&](u32 pos, const Arrival& a) {
+        Arrival* slots = &arrivals[size_t(pos) * kArrivals];
+        bool literal = a.step == Step::Literal;
+        int worst = 0;
+        for (int k = 0; k < kArrivals; ++k)
+        {
+            Arrival& s = slots[k];
+            if (s.cost == kNoCost)
+            {
+                s = a;
+                return;
+            }
+            if (s.offset == a.offset && (s.step == Step::Literal) == literal)
+            {
+                if (a.cost < s.cost) s = a;
+                return;
+            }
+            if (s.cost > slots[worst].cost) worst = k;
+        }
+        if (a.cost < slots[worst].cost) slots[worst] = a;
+    };
+
+    // Tries copies of lengths lo to hi from pos, whose lengths are coded as length - bias.
+    auto tryLengths = [&](u32 pos, u32 lo, u32 hi, const Arrival& base, u32 baseCost, u32 bias) {
+        for (u32 len = lo; len <= hi;)
+        {
+            Arrival a = base;
+            a.cost += baseCost + gammaBits(len - bias);
+            a.length = len;
+            arrive(pos + len, a);
+
+            if (len == hi) break;
+            len = len < kFullLengths ? len + 1 : min(hi, gammaTop(len - bias + 1) + bias);
+        }
+    };
+
+    Arrival start;
+    start.cost = 0;
+    start.run = 0;
+    start.offset = u16(kInitialOffset);
+    start.step = Step::Start;
+    arrivals[0] = start;
+
+    MatchFinder finder(src, n);
+    vector<Candidate> candidates;
+
+    for (u32 pos = 0; pos < n; ++pos)
+    {
+        const Arrival* slots = &arrivals[size_t(pos) * kArrivals];
+        finder.find(pos, candidates);
+
+        int best = -1;
+        for (int k = 0; k < kArrivals && slots[k].cost != kNoCost; ++k)
+        {
+            const Arrival& s = slots[k];
+            if (s.step != Step::Start && (best < 0 || s.cost < slots[best].cost)) best = k;
+
+            // Another literal, starting or extending a run.
+            Arrival a;
+            a.from = pos;
+            a.length = 1;
+            a.offset = s.offset;
+            a.fromSlot = u8(k);
+            a.step = Step::Literal;
+            if (s.step == Step::Literal)
+            {
+                a.run = s.run + 1;
+                a.cost = s.cost + 8 + gammaBits(a.run) - gammaBits(s.run);
+            }
+            else
+            {
+                a.run = 1;
+                a.cost = s.cost + (s.step == Step::Start ? 0 : 1) + gammaBits(1) + 8;
+            }
+            arrive(pos + 1, a);
+
+            // A copy from the last offset, which can only follow literals.
+            if (s.step == Step::Literal && pos >= s.offset)
+            {
+                u32 maxLen = finder.length(pos, s.offset);
+                if (maxLen)
+                {
+                    Arrival r = s;
+                    r.from = pos;
+                    r.run = 0;
+                    r.fromSlot = u8(k);
+                    r.step = Step::Repeat;
+                    tryLengths(pos, 1, maxLen, r, 1, 0);
+                }
+            }
+        }
+
+        // Copies from a new offset.  Their cost doesn't depend on the last offset, so only the cheapest arrival needs
+        // trying.  A longer match at a greater offset only adds the lengths the shorter ones couldn't reach.
+        if (best >= 0)
+        {
+            u32 covered = 1;
+            for (const auto& c : candidates)
+            {
+                Arrival m = slots[best];
+                m.from = pos;
+                m.run = 0;
+                m.offset = u16(c.offset);
+                m.fromSlot = u8(best);
+                m.step = Step::Match;
+                u32 offsetBits = 1 + gammaBits((c.offset - 1) / 128 + 1) + 7;
+                tryLengths(pos, covered + 1, c.length, m, offsetBits, 1);
+                covered = c.length;
+            }
+        }
+    }
+
+    //
+    // Trace the cheapest path back from the end
+    //
+
+    struct Element
+    {
+        Step step;
+        u32 length;
+        u32 offset;
+        u32 pos;
+    };
+
+    vector<Element> path;
+    {
+        const Arrival* slots = &arrivals[size_t(n) * kArrivals];
+        int slot = 0;
+        for (int k = 1; k < kArrivals && slots[k].cost != kNoCost; ++k)
+        {
+            if (slots[k].cost < slots[slot].cost) slot = k;
+        }
+
+        u32 pos = n;
+        while (pos > 0)
+        {
+            const Arrival& a = arrivals[size_t(pos) * kArrivals + slot];
+            if (a.step == Step::Literal && !path.empty() && path.back().step == Step::Literal)
+            {
+                path.back().length += 1;
+                path.back().pos = a.from;
+            }
+            else
+            {
+                path.push_back({ a.step, a.length, a.offset, a.from });
+            }
+            slot = a.fromSlot;
+            pos = a.from;
+        }
+        reverse(path.begin(), path.end());
+    }
+
+    //
+    // Write the stream
+    //
+
+    BitWriter out;
+    bool first = true;
+    for (const auto& e : path)
+    {
+        switch (e.step)
+        {
+        case Step::Literal:
+            if (!first) out.bit(false);
+            out.gamma(e.length, false);
+            for (u32 i = 0; i < e.length; ++i) out.byte(src[e.pos + i]);
+            break;
+
+        case Step::Repeat:
+            out.bit(false);
+            out.gamma(e.length, false);
+            break;
+
+        case Step::Match:
+            out.bit(true);
+            out.offset(e.offset);
+            out.gamma(e.length - 1, false);
+            break;
+
+        case Step::Start:
+            break;
+        }
+        first = false;
+    }
+
+    out.bit(true);
+    out.gamma(kEndMarker, true);
+    return out.take();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// zx0Decompress
+
+func zx0Decompress(const u8* src, size_t srcSize, u8* dst, size_t dstSize) -> bool
+{
+    size_t in = 0;
+    size_t out = 0;
+    u8 bits = 0;
+    u8 mask = 0;
+    u8 lastByte = 0;
+    bool backtrack = false;
+    bool failed = false;
+
+    auto byte = [&]() -> u8 {
+        if (in >= srcSize)
+        {
+            failed = true;
+            return 0;
+        }
+        return lastByte = src[in++];
+    };
+
+    auto bit = [&]() -> bool {
+        if (backtrack)
+        {
+            backtrack = false;
+            return lastByte & 1;
+        }
+        mask >>= 1;
+        if (!mask)
+        {
+            mask = 0x80;
+            bits = byte();
+        }
+        return (bits & mask) != 0;
+    };
+
+    auto gamma = [&](bool invert) -> u32 {
+        u32 value = 1;
+        while (!failed && !bit())
+        {
+            if (value > dstSize + kEndMarker) failed = true;
+            value = (value << 1) | u32(bit() != invert);
+        }
+        return failed ? 0 : value;
+    };
+
+    auto copy = [&](u32 offset, u32 length) {
+        if (offset > out || length > dstSize - out)
+        {
+            failed = true;
+            return;
+        }
+        // Byte by byte, as overlapping copies repeat what they have just written.
+        for (u32 i = 0; i < length; ++i, ++out) dst[out] = dst[out - offset];
+    };
+
+    enum { Literals, Repeat, NewOffset } state = Literals;
+    u32 offset = kInitialOffset;
+    while (!failed)
+    {
+        switch (state)
+        {
+        case Literals:
+        {
+            u32 length = gamma(false);
+            if (length > dstSize - out || length > srcSize - in)
+            {
+                failed = true;
+                break;
+            }
+            memcpy(dst + out, src + in, length);
+            in += length;
+            out += length;
+            state = bit() ? NewOffset : Repeat;
+            break;
+        }
+
+        case Repeat:
+            copy(offset, gamma(false));
+            state = bit() ? NewOffset : Literals;
+            break;
+
+        case NewOffset:
+        {
+            u32 msb = gamma(true);
+            if (msb == kEndMarker)
+            {
+                return !failed && out == dstSize;
+            }
+            u32 lsb = byte();
+            if (msb * 128 <= (lsb >> 1))
+            {
+                failed = true;
+                break;
+            }
+            offset = msb * 128 - (lsb >> 1);
+            backtrack = true;
+            copy(offset, gamma(false) + 1);
+            state = bit() ? NewOffset : Literals;
+            break;
+        }
+        }
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,33 @@
+//----------------------------------------------------------------------------------------------------------------------
+// ZX0 compression
+//----------------------------------------------------------------------------------------------------------------------
+//
+// ZX0 is Einar Saukas' LZ format for 8-bit machines, whose decompressor is under 70 bytes of Z80.  A stream is a
+// sequence of literal runs, copies from the last offset and copies from a new offset, described by interlaced Elias
+// gamma codes in a bit stream that is interleaved with the literal and offset bytes.  Streams written here are the
+// forward variant with 2.x offsets and can be unpacked with the standard dzx0_standard.asm routine.
+//
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <core.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+// zx0Compress
+// Compresses a block with an optimal parse: a shortest path over the costs in bits of every literal and match
+// choice, keeping the best few arrivals at each position so that cheap repeat offsets are not lost to a greedy choice.
+// Blocks are independent; offsets never reach before the start.  ZX0 streams begin with a literal, so size must be at
+// least 1.
+
+func zx0Compress(const u8* src, size_t size) -> vector<u8>;
+
+//----------------------------------------------------------------------------------------------------------------------
+// zx0Decompress
+// Unpacks a ZX0 stream into dst, which must be exactly the size of the original block.  Returns false if the stream is
+// malformed or does not unpack to exactly dstSize bytes.
+
+func zx0Decompress(const u8* src, size_t srcSize, u8* dst, size_t dstSize) -> bool;
+
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------